@@ -0,0 +1,510 @@
+// Benchmarks of typical fit topologies, see src/example.
+// Each benchmark is run with both engines, and prints one JSON object per line:
+//   {"benchmark": ..., "engine": ..., "fits": ..., "seconds": ...,
+//    "fits_per_second": ..., "evaluations_per_fit": ...,
+//    "ns_per_evaluation": ..., "allocations_per_fit": ...}
+// where an evaluation is one evaluation of all constraints (counted by NFunctionCalls),
+// and ns_per_evaluation is the time spent in the constraints (ConstraintTime and
+// DerivativeTime of the fit statistics) per evaluation. It's measured in separate fits
+// with CollectStatistics enabled, so the timing doesn't slow down the other numbers,
+// and null if there are no statistics (batch and static benchmarks).
+// For the batch benchmarks, a fit is one FitBatch of 256 events in one thread.
+// The static benchmarks use APLCON::Static, which always fits with the Native engine,
+// so they are run once, with the engine "Static".
+// The smavat benchmarks compare the error propagation A*V*A^T of the C++ kernel
+// with the Fortran routine, printing calls per second and the largest difference.
+// Usage: aplcon_bench [minimal seconds per benchmark, default 0.5] [name filter]
+
+#include <APLCON.hpp>
+#include "detail/APLCON_solver.hpp"
+extern "C" {
+#include "wrapper/APLCON.h"
+}
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// count all heap allocations, see also test/TestAllocations.cc
+// the operators are not inlined, so the compiler doesn't pair free() with new
+
+static atomic<size_t> nAllocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  ++nAllocations;
+  void* p = malloc(size == 0 ? 1 : size);
+  if(p == nullptr)
+    throw bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+
+// a fit does one DoFit() and returns its number of function calls,
+// and the time spent in the constraints if the statistics were collected
+struct fit_calls_t {
+  int Evaluations;
+  double ConstraintSeconds; // NaN if not collected
+};
+typedef function<fit_calls_t()> fit_t;
+typedef function<fit_t(const APLCON::Fit_Settings_t&)> setup_t;
+
+vector<double*> link(vector<double>& v) {
+  vector<double*> p;
+  for(double& d : v)
+    p.push_back(addressof(d));
+  return p;
+}
+
+template<typename Result>
+fit_calls_t calls(const Result& r) {
+  const APLCON::Result_Statistics_t& stats = r.Statistics;
+  return {r.NFunctionCalls, stats.Collected ? stats.ConstraintTime + stats.DerivativeTime
+                                            : numeric_limits<double>::quiet_NaN()};
+}
+
+// branching ratios of 01_simple.cc, 4 variables and 3 constraints
+fit_t setup_simple(const APLCON::Fit_Settings_t& settings) {
+  auto a = make_shared<APLCON>("simple", settings);
+  a->AddMeasuredVariable("BF_e_A",   0.1050, 0.01);
+  a->AddMeasuredVariable("BF_e_B",   0.135,  0.03);
+  a->AddMeasuredVariable("BF_tau_A", 0.095,  0.03);
+  a->AddMeasuredVariable("BF_tau_B", 0.14,   0.03);
+  auto equality_constraint = [] (double a, double b) { return a - b; };
+  a->AddConstraint("BF_e_equal", {"BF_e_A", "BF_e_B"}, equality_constraint);
+  a->AddConstraint("BF_tau_equal", {"BF_tau_A", "BF_tau_B"}, equality_constraint);
+  a->AddConstraint("BF_equal", {"BF_e_A", "BF_tau_A"}, equality_constraint);
+  a->SetCovariance("BF_e_B", "BF_tau_B", 8.96e-4);
+  return [a] () { return calls(a->DoFit()); };
+}
+
+// linked 4-vectors of 03_advanced.cc (Fit B), 12 variables and 9 constraints
+fit_t setup_kinematic(const APLCON::Fit_Settings_t& settings) {
+  const vector<double> start = {
+    sqrt(4+9+16)*1.02,  2,  3,  4,
+    sqrt(4+9+16)*1.05, -2, -3, -4,
+    13,                 0,  0,  0
+  };
+  auto values = make_shared< vector<double> >(start);
+  APLCON::Fit_Settings_t s = settings;
+  s.MaxIterations = 500;
+  auto a = make_shared<APLCON>("kinematic", s);
+  vector<double*> p = link(*values);
+  a->LinkVariable("Vec1", {p[0], p[1], p[2],  p[3]},  vector<double>{0.6});
+  a->LinkVariable("Vec2", {p[4], p[5], p[6],  p[7]},  vector<double>{0.8});
+  a->LinkVariable("Vec3", {p[8], p[9], p[10], p[11]}, vector<double>{0});
+  a->SetCovariance("Vec1", "Vec1", vector<double>{
+                     APLCON::NaN,
+                     APLCON::NaN, 0.004,
+                     APLCON::NaN, 0.005, 0.006
+                   });
+
+  const auto invariant_mass = [] (const vector<double>& v) {
+    return pow(v[0],2) - pow(v[1],2) - pow(v[2],2) - pow(v[3],2);
+  };
+  a->AddConstraint("invariant_mass1", {"Vec1"}, invariant_mass);
+  a->AddConstraint("invariant_mass2", {"Vec2"}, invariant_mass);
+  a->AddConstraint("opposite_momentum", {"Vec1", "Vec2"},
+                   [] (const vector<double>& a, const vector<double>& b) -> vector<double> {
+    return {a[1] + b[1], a[2] + b[2], a[3] + b[3]};
+  });
+  a->AddConstraint("require_conservation", {"Vec1", "Vec2", "Vec3"},
+                   [] (const vector<double>& a, const vector<double>& b, const vector<double>& c) -> vector<double> {
+    return {a[0] + b[0] - c[0], a[1] + b[1] - c[1], a[2] + b[2] - c[2], a[3] + b[3] - c[3]};
+  });
+  return [a, values, start] () {
+    *values = start;
+    return calls(a->DoFit());
+  };
+}
+
+// straight line fit of 04_linefit.cc with n points,
+// fixed x and measured y, n+2 variables and n constraints
+setup_t setup_linefit(size_t n) {
+  return [n] (const APLCON::Fit_Settings_t& settings) -> fit_t {
+    // reproducible data around y = 1 + 0.5*x
+    mt19937 gen(n);
+    normal_distribution<double> noise(0, 0.1);
+    auto x = make_shared< vector<double> >(n);
+    auto y = make_shared< vector<double> >(n);
+    for(size_t i=0;i<n;i++) {
+      (*x)[i] = i;
+      (*y)[i] = 1 + 0.5*i + noise(gen);
+    }
+    const vector<double> x_start = *x;
+    const vector<double> y_start = *y;
+
+    APLCON::Fit_Settings_t s = settings;
+    s.MaxIterations = 500;
+    auto a = make_shared<APLCON>("linefit", s);
+    APLCON::Variable_Settings_t fixed = APLCON::Variable_Settings_t::Default;
+    fixed.StepSize = 0;
+    a->LinkVariable("x", link(*x), vector<double>{0}, {fixed});
+    a->LinkVariable("y", link(*y), vector<double>{0.1});
+    a->AddUnmeasuredVariable("a");
+    a->AddUnmeasuredVariable("b");
+    a->AddConstraint("residuals", vector<string>{"a", "b", "x", "y"},
+                     [] (const vector< vector<double> >& arg) {
+      vector<double> r(arg[2].size());
+      for(size_t i=0;i<r.size();i++)
+        r[i] = arg[0][0] + arg[1][0]*arg[2][i] - arg[3][i];
+      return r;
+    });
+    return [a, x, y, x_start, y_start] () {
+      *x = x_start;
+      *y = y_start;
+      return calls(a->DoFit());
+    };
+  };
+}
+
+// exponential curve with one constraint for each of the n measured points,
+// n+2 variables and n constraints with a sparse Jacobian
+setup_t setup_curve(size_t n) {
+  return [n] (const APLCON::Fit_Settings_t& settings) -> fit_t {
+    APLCON::Fit_Settings_t s = settings;
+    s.MaxIterations = 500;
+    auto a = make_shared<APLCON>("curve", s);
+    a->AddUnmeasuredVariable("a", 1);
+    a->AddUnmeasuredVariable("b", 0);
+    for(size_t i=0;i<n;i++) {
+      const double x = 2.0*i/n;
+      const string y = "y"+to_string(i);
+      a->AddMeasuredVariable(y, 2*exp(0.5*x) + 0.01*sin(i), 0.05);
+      a->AddConstraint(y, {"a", "b", y}, [x] (double a, double b, double y) {
+        return a*exp(b*x) - y;
+      });
+    }
+    return [a] () { return calls(a->DoFit()); };
+  };
+}
+
+// two instances fitted alternately, so each fit has to set up APLCON again
+fit_t setup_alternating(const APLCON::Fit_Settings_t& settings) {
+  auto fits = make_shared< vector<fit_t> >();
+  fits->push_back(setup_simple(settings));
+  fits->push_back(setup_kinematic(settings));
+  auto n = make_shared<size_t>(0);
+  return [fits, n] () { return (*fits)[(*n)++ % fits->size()](); };
+}
+
+// the same fits, each starting from the solution of the previous one
+setup_t warm(const setup_t& setup) {
+  return [setup] (const APLCON::Fit_Settings_t& settings) {
+    APLCON::Fit_Settings_t s = settings;
+    s.WarmStart = APLCON::WarmStart_t::Unmeasured;
+    return setup(s);
+  };
+}
+
+// the same fits, updating the Jacobian between iterations
+setup_t broyden(const setup_t& setup) {
+  return [setup] (const APLCON::Fit_Settings_t& settings) {
+    APLCON::Fit_Settings_t s = settings;
+    s.BroydenUpdates = true;
+    return setup(s);
+  };
+}
+
+// the same fits, evaluating the numerical derivatives in all hardware threads
+setup_t threads(const setup_t& setup) {
+  return [setup] (const APLCON::Fit_Settings_t& settings) {
+    APLCON::Fit_Settings_t s = settings;
+    s.DerivativeThreads = APLCON::AllThreads;
+    return setup(s);
+  };
+}
+
+// the kinematic fit with scalar generic constraints, fitted in batches of
+// slightly different events, in lanes of the given width (0 for one by one)
+struct invariant_mass_lanes {
+  template<typename T>
+  T operator()(const T& E, const T& px, const T& py, const T& pz) const {
+    return E*E - px*px - py*py - pz*pz;
+  }
+};
+
+struct sum_lanes {
+  template<typename T>
+  T operator()(const T& a, const T& b) const {
+    return a + b;
+  }
+};
+
+struct conservation_lanes {
+  template<typename T>
+  T operator()(const T& a, const T& b, const T& c) const {
+    return a + b - c;
+  }
+};
+
+setup_t setup_kinematic_batch(unsigned lanes) {
+  return [lanes] (const APLCON::Fit_Settings_t& settings) -> fit_t {
+    APLCON::Fit_Settings_t s = settings;
+    s.MaxIterations = 500;
+    s.BatchLanes = lanes;
+    auto a = make_shared<APLCON>("kinematic_batch", s);
+    const vector<string> names[3] = {
+      {"E1", "px1", "py1", "pz1"},
+      {"E2", "px2", "py2", "pz2"},
+      {"E3", "px3", "py3", "pz3"}
+    };
+    for(size_t k=0;k<4;k++) {
+      a->AddMeasuredVariable(names[0][k], 0, 0.6);
+      a->AddMeasuredVariable(names[1][k], 0, 0.8);
+      a->AddUnmeasuredVariable(names[2][k]);
+    }
+    a->SetCovariance("px1", "py1", 0.004);
+    a->SetCovariance("px1", "pz1", 0.005);
+    a->SetCovariance("py1", "pz1", 0.006);
+    a->AddLaneConstraint("invariant_mass1", names[0], invariant_mass_lanes());
+    a->AddLaneConstraint("invariant_mass2", names[1], invariant_mass_lanes());
+    for(size_t k=1;k<4;k++)
+      a->AddLaneConstraint("opposite_momentum"+to_string(k), {names[0][k], names[1][k]},
+                           sum_lanes());
+    for(size_t k=0;k<4;k++)
+      a->AddLaneConstraint("require_conservation"+to_string(k),
+                           {names[0][k], names[1][k], names[2][k]}, conservation_lanes());
+
+    // the start values of the kinematic benchmark, smeared for each event
+    const vector<string> order = a->VariableNames();
+    const map<string, double> start = {
+      {"E1", sqrt(4+9+16)*1.02}, {"px1",  2}, {"py1",  3}, {"pz1",  4},
+      {"E2", sqrt(4+9+16)*1.05}, {"px2", -2}, {"py2", -3}, {"pz2", -4},
+      {"E3", 13},                {"px3",  0}, {"py3",  0}, {"pz3",  0}
+    };
+    const size_t N = 256;
+    auto input = make_shared<APLCON::Batch_Input_t>();
+    input->NEvents = N;
+    mt19937 gen(N);
+    normal_distribution<double> smear(0, 0.1);
+    for(size_t i=0;i<order.size();i++) {
+      for(size_t n=0;n<N;n++)
+        input->Values.push_back(start.at(order[i]) + (order[i][0] == 'E' ? smear(gen) : 0));
+    }
+    return [a, input] () {
+      const auto& r = a->FitBatch(*input, 1);
+      int evaluations = 0;
+      for(int calls : r.NFunctionCalls)
+        evaluations += calls;
+      return fit_calls_t{evaluations, numeric_limits<double>::quiet_NaN()};
+    };
+  };
+}
+
+// the kinematic fit with APLCON::Static, differentiated numerically or with dual numbers,
+// filling a compact result as the dynamic instance does for Result_t
+template<typename T>
+void kinematic_constraints(const array<T, 12>& x, array<T, 9>& f) {
+  for(size_t k=0;k<2;k++)
+    f[k] = x[4*k]*x[4*k] - x[4*k+1]*x[4*k+1] - x[4*k+2]*x[4*k+2] - x[4*k+3]*x[4*k+3];
+  for(size_t k=1;k<4;k++)
+    f[1+k] = x[k] + x[4+k];
+  for(size_t k=0;k<4;k++)
+    f[5+k] = x[k] + x[4+k] - x[8+k];
+}
+
+struct kinematic_static_numerical {
+  void operator()(const array<double, 12>& x, array<double, 9>& f) const {
+    kinematic_constraints(x, f);
+  }
+};
+
+struct kinematic_static_dual {
+  template<typename T>
+  void operator()(const array<T, 12>& x, array<T, 9>& f) const {
+    kinematic_constraints(x, f);
+  }
+};
+
+template<typename Constraints>
+fit_t setup_kinematic_static(const APLCON::Fit_Settings_t& settings) {
+  typedef APLCON::Static<12, 9, Constraints> static_t;
+  APLCON::Fit_Settings_t s = settings;
+  s.MaxIterations = 500;
+  auto a = make_shared<static_t>("kinematic_static", array<string, 12>{{
+    "E1", "px1", "py1", "pz1",
+    "E2", "px2", "py2", "pz2",
+    "E3", "px3", "py3", "pz3"
+  }}, Constraints(), s);
+  const double start[12] = {
+    sqrt(4+9+16)*1.02,  2,  3,  4,
+    sqrt(4+9+16)*1.05, -2, -3, -4,
+    13,                 0,  0,  0
+  };
+  for(size_t i=0;i<12;i++)
+    a->SetVariable(i, start[i], i<4 ? 0.6 : i<8 ? 0.8 : 0);
+  a->SetCovariance(1, 2, 0.004);
+  a->SetCovariance(1, 3, 0.005);
+  a->SetCovariance(2, 3, 0.006);
+  auto result = make_shared<APLCON::Compact_Result_t>();
+  return [a, result] () {
+    a->DoFit(*result);
+    return calls(*result);
+  };
+}
+
+// runs the benchmark with the given engine, labelled as given
+void run(const string& name, const setup_t& setup, APLCON::Engine_t engine, const string& label,
+         double min_seconds) {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = engine;
+  // used if Fit_Settings_t::CollectStatistics is enabled
+  settings.AllocationCounter = [] () { return static_cast<long>(nAllocations); };
+  fit_t fit = setup(settings);
+
+  // warm up, the first fit builds the storage
+  fit();
+
+  typedef chrono::steady_clock clock;
+  size_t fits = 0;
+  size_t evaluations = 0;
+  const size_t allocations_before = nAllocations;
+  const auto start = clock::now();
+  double seconds = 0;
+  // check the time only every few fits
+  for(size_t batch = 1; seconds < min_seconds; batch *= 2) {
+    for(size_t i=0;i<batch;i++)
+      evaluations += fit().Evaluations;
+    fits += batch;
+    seconds = chrono::duration<double>(clock::now() - start).count();
+  }
+  const size_t allocations = nAllocations - allocations_before;
+
+  // the time in the constraints from the statistics of a few more fits
+  settings.CollectStatistics = true;
+  fit_t fit_statistics = setup(settings);
+  fit_statistics();
+  size_t statistics_evaluations = 0;
+  double constraint_seconds = 0;
+  for(size_t i=0;i<max<size_t>(1, fits/8);i++) {
+    const fit_calls_t& c = fit_statistics();
+    statistics_evaluations += c.Evaluations;
+    constraint_seconds += c.ConstraintSeconds;
+  }
+
+  cout << "{\"benchmark\": \"" << name << "\""
+       << ", \"engine\": \"" << label << "\""
+       << ", \"fits\": " << fits
+       << ", \"seconds\": " << seconds
+       << ", \"fits_per_second\": " << fits/seconds
+       << ", \"evaluations_per_fit\": " << double(evaluations)/fits
+       << ", \"ns_per_evaluation\": ";
+  if(isnan(constraint_seconds))
+    cout << "null";
+  else
+    cout << 1e9*constraint_seconds/statistics_evaluations;
+  cout << ", \"allocations_per_fit\": " << double(allocations)/fits
+       << "}" << endl;
+}
+
+void run(const string& name, const setup_t& setup, double min_seconds) {
+  run(name, setup, APLCON::Engine_t::Fortran, "Fortran", min_seconds);
+  run(name, setup, APLCON::Engine_t::Native, "Native", min_seconds);
+}
+
+// W = A*V*A^T with a dense V of size n and m rows of A
+void run_smavat(const string& name, size_t n, size_t m, double min_seconds) {
+  mt19937 gen(n);
+  uniform_real_distribution<double> uniform(-1, 1);
+  vector<double> V((n*n+n)/2), A(m*n), AV(m*n), W((m*m+m)/2), W_fortran(W.size());
+  for(double& v : V)
+    v = uniform(gen);
+  for(size_t i=0;i<n;i++)
+    V[(i*i+i)/2+i] += n; // diagonal
+  for(double& a : A)
+    a = uniform(gen);
+
+  const function<void()> engines[2] = {
+    [&] () { c_aplcon_smavat(V.data(), A.data(), W_fortran.data(), n, m); },
+    [&] () { APLCON_::SMAVAT(V.data(), A.data(), n, m, AV.data(), W.data()); }
+  };
+  for(size_t e=0;e<2;e++) {
+    typedef chrono::steady_clock clock;
+    size_t calls = 0;
+    const auto start = clock::now();
+    double seconds = 0;
+    for(size_t batch = 1; seconds < min_seconds; batch *= 2) {
+      for(size_t i=0;i<batch;i++)
+        engines[e]();
+      calls += batch;
+      seconds = chrono::duration<double>(clock::now() - start).count();
+    }
+    double max_difference = 0;
+    for(size_t k=0;k<W.size();k++)
+      max_difference = max(max_difference, abs(W[k]-W_fortran[k])/(1+abs(W_fortran[k])));
+
+    cout << "{\"benchmark\": \"" << name << "\""
+         << ", \"engine\": \"" << (e == 1 ? "Native" : "Fortran") << "\""
+         << ", \"calls\": " << calls
+         << ", \"seconds\": " << seconds
+         << ", \"calls_per_second\": " << calls/seconds
+         << ", \"max_difference\": " << (e == 1 ? max_difference : 0)
+         << "}" << endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const double min_seconds = argc > 1 ? atof(argv[1]) : 0.5;
+  const string filter = argc > 2 ? argv[2] : "";
+
+  const vector< pair<string, setup_t> > benchmarks = {
+    {"simple",       setup_simple},
+    {"kinematic",    setup_kinematic},
+    {"linefit_10",   setup_linefit(10)},
+    {"linefit_100",  setup_linefit(100)},
+    {"linefit_1000", setup_linefit(1000)},
+    {"curve_300",    setup_curve(300)},
+    {"alternating",  setup_alternating},
+    {"kinematic_warm",   warm(setup_kinematic)},
+    {"linefit_100_warm", warm(setup_linefit(100))},
+    {"kinematic_broyden", broyden(setup_kinematic)},
+    {"linefit_100_threads", threads(setup_linefit(100))},
+    {"kinematic_batch",       setup_kinematic_batch(0)},
+    {"kinematic_batch_lanes4", setup_kinematic_batch(4)},
+    {"kinematic_batch_lanes8", setup_kinematic_batch(8)}
+  };
+
+  for(const auto& b : benchmarks) {
+    if(b.first.find(filter) == string::npos)
+      continue;
+    run(b.first, b.second, min_seconds);
+  }
+
+  // APLCON::Static ignores the engine, so these run once
+  const vector< pair<string, setup_t> > static_benchmarks = {
+    {"kinematic_static",      setup_kinematic_static<kinematic_static_numerical>},
+    {"kinematic_static_dual", setup_kinematic_static<kinematic_static_dual>}
+  };
+
+  for(const auto& b : static_benchmarks) {
+    if(b.first.find(filter) == string::npos)
+      continue;
+    run(b.first, b.second, APLCON::Engine_t::Native, "Static", min_seconds);
+  }
+
+  const vector< pair<size_t, size_t> > smavat_sizes = {{20, 10}, {200, 50}, {1000, 100}};
+  for(const auto& size : smavat_sizes) {
+    const string name = "smavat_" + to_string(size.first) + "_" + to_string(size.second);
+    if(name.find(filter) == string::npos)
+      continue;
+    run_smavat(name, size.first, size.second, min_seconds);
+  }
+  return 0;
+}
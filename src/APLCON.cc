@@ -2,6 +2,8 @@
 
 // detail code is in namespace APLCON_ (note the underscore)
 #include "detail/APLCON_cc.hpp"
+#include "detail/APLCON_kernels.hpp"
+#include "detail/APLCON_lanes.hpp"
 
 // long ostream stuff is in extra header
 #include <detail/APLCON_ostream.hpp>
@@ -12,16 +14,19 @@ extern "C" {
 }
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <exception>
 #include <limits>
+#include <memory>
+#include <new>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 
 using namespace std;
 
-int APLCON::instance_counter = 0;
-int APLCON::instance_lastfit = 0;
 std::vector<APLCON::Variable_Settings_t> APLCON::DefaultSettings;
 
 const APLCON::Variable_Settings_t APLCON::Variable_Settings_t::Default = {
@@ -43,6 +48,13 @@ const APLCON::Fit_Settings_t APLCON::Fit_Settings_t::Default = {
   APLCON::NaN, // UnmeasuredStepSizeFactor
   APLCON::NaN, // MinimalStepSizeFactor
   false,       // SkipCovariancesInResult
+  APLCON::Engine_t::Fortran, // Engine
+  false,       // CollectStatistics
+  APLCON::WarmStart_t::None, // WarmStart
+  false,       // BroydenUpdates
+  1,           // DerivativeThreads
+  4,           // BatchLanes
+  nullptr,     // AllocationCounter
 };
 
 // proper default result
@@ -56,7 +68,15 @@ const APLCON::Result_t APLCON::Result_t::Default = {
   -1,
   {},
   {},
-  -1
+  -1,
+  {
+    false, // Statistics not collected
+    APLCON::NaN, APLCON::NaN, APLCON::NaN, APLCON::NaN, APLCON::NaN, APLCON::NaN,
+    -1, -1, -1, -1, -1
+  },
+  nullptr, // Table
+  {},
+  {}
 };
 
 // simple AddVariable methods
@@ -267,7 +287,7 @@ map< string, APLCON::Result_BeforeAfter_t< map<string, double> > >
 APLCON::CalculateCorrelations(const map<string, Result_Variable_t>& variables)
 {
   // slow but simple implementation
-  // see covariances building in DoFit for a faster implementation
+  // see the overload for packed matrices for a faster implementation
 
   map< string, APLCON::Result_BeforeAfter_t< map<string, double> > > correlations;
 
@@ -303,6 +323,32 @@ APLCON::CalculateCorrelations(const map<string, Result_Variable_t>& variables)
   return correlations;
 }
 
+void APLCON::CalculateCorrelations(const vector<double>& covariances,
+                                   vector<double>& correlations)
+{
+  // packed size is n*(n+1)/2
+  const size_t n = (sqrt(8*covariances.size()+1)-1)/2;
+  if(n*(n+1)/2 != covariances.size())
+    throw Error("Packed covariance matrix has invalid size "+to_string(covariances.size()));
+
+  // divide by the sigmas once, then scale each row in one pass
+  const APLCON_::Kernels_t& K = APLCON_::Kernels();
+  vector<double> inv_sigmas(n);
+  K.Diagonal(covariances.data(), n, inv_sigmas.data());
+  for(double& s : inv_sigmas)
+    s = s > 0 ? 1/sqrt(s) : std::numeric_limits<double>::quiet_NaN();
+
+  correlations.resize(covariances.size());
+  K.ScaleSymmetric(covariances.data(), inv_sigmas.data(), n, correlations.data());
+}
+
+vector<double> APLCON::CalculateCorrelations(const vector<double>& covariances)
+{
+  vector<double> correlations;
+  CalculateCorrelations(covariances, correlations);
+  return correlations;
+}
+
 vector<string> APLCON::VariableNames() const {
   vector<string> variableNames;
   for(const auto& it_map : variables) {
@@ -324,168 +370,745 @@ vector<string> APLCON::VariableNames() const {
 
 APLCON::Result_t APLCON::DoFit()
 {
-  // ensure that APLCON is properly initialized
-  // and the value vectors X, F, V
-  Init();
+  // fit into the compact result, then build the maps from it
+  Compact_Result_t compact;
+  DoFit(compact);
 
-  // the main convergence loop
-  int aplcon_ret = -1;
-  do {
-    // evaluate the constraints F_func and
-    // store results in F via iterator F_it
-    auto F_it = F.begin();
-    for(size_t i=0; i<F_func.size(); ++i) {
-      for(const auto& v : F_func[i]()) {
-        *F_it = v;
-        ++F_it;
-      }
-    }
-    // call APLCON iteration
-    c_aplcon_aploop(X.data(), V.data(), F.data(), &aplcon_ret);
-  }
-  while(aplcon_ret<0);
+  Result_Statistics_t& stats = compact.Statistics;
+  APLCON_::stopwatch watch(stats.Collected);
+  const long allocations = stats.Collected && fit_settings.AllocationCounter ? fit_settings.AllocationCounter() : 0;
 
-  // now, after the loop, retrieve the results
-  Result_t result = Result_t::Default;
+  Result_t result = compact.ToResult();
 
-  // make some evil static_cast, but it's way shorter than switch statement
-  if(aplcon_ret >= static_cast<int>(Result_Status_t::_Unknown)) {
-    throw Error("Unkown return value after APLCON fit");
+  // building the maps is part of building the result
+  if(stats.Collected) {
+    result.Statistics.ResultTime += watch.Lap();
+    if(fit_settings.AllocationCounter)
+      result.Statistics.NAllocations += fit_settings.AllocationCounter() - allocations;
   }
-  result.Status = static_cast<Result_Status_t>(aplcon_ret);
-
-  // now retrieve "everything" from APLCON
-
-  // retrieve some info about the fit (directly copy to struct field if possible)
-  float chi2, pval;
-  // chndpv and apstat both return the resulting chi2,
-  // but the latter returns it with double precision
-  c_aplcon_chndpv(&chi2,&result.NDoF,&pval);
-  result.Probability = pval;
-  c_aplcon_apstat(&result.ChiSquare, &result.NFunctionCalls, &result.NIterations);
+  return result;
+}
 
-  // get the pulls from APLCON
-  vector<double> pulls(X.size());
-  c_aplcon_appull(pulls.data());
+void APLCON::DoFit(Compact_Result_t& result)
+{
+  // statistics are only collected if requested
+  Result_Statistics_t* stats = fit_settings.CollectStatistics ? addressof(result.Statistics) : nullptr;
+  APLCON_::stopwatch watch(stats != nullptr);
+  const long allocations = stats && fit_settings.AllocationCounter ? fit_settings.AllocationCounter() : 0;
 
-  // copy just the names of the constraints
-  for(const auto& it_map : constraints) {
-    Result_Constraint_t r_con;
-    r_con.Dimension = it_map.second.Number;
-    result.Constraints[it_map.first] = r_con;
+  // ensure that APLCON is properly initialized
+  // and the value vectors X, F, V
+  Init();
+  result.Statistics = Result_t::Default.Statistics;
+  if(stats) {
+    *stats = {true, watch.Lap(), 0, 0, 0, 0, 0, 0, 0, 0, 0, -1};
   }
-  result.NScalarConstraints = nConstraints;
-  result.Name = instance_name;
 
-  // now we're ready to fill the result.Variables vector
-  // we fill it in the same order as the X vector
-  // which makes debug output from  APLCON comparable to dumps of this structure
+  // run the fit, which books its time into the phases itself,
+  // then retrieve the results
+  result.Status = RunFit(stats);
+  watch.Lap();
+  if(fit_settings.WarmStart == WarmStart_t::Unmeasured && result.Status == Result_Status_t::Success)
+    X_warm.assign(X.begin(), X.end());
+  else
+    X_warm.clear();
+  FillResult(result);
+
+  if(stats) {
+    stats->ResultTime = watch.Lap();
+    if(fit_settings.AllocationCounter)
+      stats->NAllocations = fit_settings.AllocationCounter() - allocations;
+  }
+}
 
+void APLCON::FillResult(Compact_Result_t& result)
+{
+  // now retrieve "everything" from APLCON,
+  // some info about the fit and the pulls
+  result.Pulls.resize(X.size());
+  const statistics_t stats = GetStatistics(result.Pulls.data());
+  result.Name = instance_name;
+  result.ChiSquare = stats.ChiSquare;
+  result.NDoF = stats.NDoF;
+  result.Probability = stats.Probability;
+  result.NIterations = stats.NIterations;
+  result.NFunctionCalls = stats.NFunctionCalls;
+  result.NScalarConstraints = nConstraints;
+  result.Table = result_table;
+
+  // the arrays are indexed like X
+  result.Values.assign(X.begin(), X.end());
+  result.ValuesBefore.resize(X.size());
+  result.SigmasBefore.resize(X.size());
+  // sigma is sqrt of diagonal element in V
+  result.Sigmas.resize(X.size());
+  APLCON_::Kernels().Diagonal(V.data(), X.size(), result.Sigmas.data());
+  for(double& s : result.Sigmas)
+    s = sqrt(s);
   for(const auto& it_map : variables) {
-    const string& name = it_map.first;
-    const variable_t& before = it_map.second;
-
-    for(size_t k=0;k<before.Values.size();k++) {
-      size_t i = before.XOffset+k;
-
-      Result_Variable_t var;
-      const string& varname = APLCON_::BuildVarName(name, before.Values.size(), k);
-      var.PristineName = name;
-      var.Dimension = before.Values.size();
-      var.Index = k;
-      var.Value = {*(before.Values[k]), X[i]};
+    const variable_t& var = it_map.second;
 
-      // sigma is sqrt of diagonal element in V
-      const size_t V_ii = APLCON_::V_ij(i,i);
-      const double after_sigma = sqrt(V[V_ii]);
-      var.Sigma = {*(before.Sigmas[k]), after_sigma};
+    for(size_t k=0;k<var.Values.size();k++) {
+      const size_t i = var.XOffset+k;
+      result.ValuesBefore[i] = *(var.Values[k]);
+      result.SigmasBefore[i] = *(var.Sigmas[k]);
 
       // only copy stuff back if variable is not internally stored
       // which is indicated by an empty internal store
-      if(before.StoredValues.empty())
-        *(before.Values[k]) = X[i];
-      if(before.StoredSigmas.empty())
-        *(before.Sigmas[k]) = after_sigma;
-      if(!before.Pulls.empty())
-        *(before.Pulls[k]) = pulls[i];
+      if(var.StoredValues.empty())
+        *(var.Values[k]) = X[i];
+      if(var.StoredSigmas.empty())
+        *(var.Sigmas[k]) = result.Sigmas[i];
+      if(!var.Pulls.empty())
+        *(var.Pulls[k]) = result.Pulls[i];
+    }
+  }
 
-      // pulls / settings
-      var.Pull = pulls[i];
-      var.Settings = before.Settings[k];
+  if(fit_settings.SkipCovariancesInResult) {
+    result.CovariancesBefore.clear();
+    result.Covariances.clear();
+    return;
+  }
+  result.CovariancesBefore.assign(V_before.begin(), V_before.end());
+  result.Covariances.assign(V.begin(), V.end());
 
-      // iterating over variables should be the right order
-      result.Variables[varname] = var;
+  // consider linked covariances
+  for(const auto& it_map : covariances) {
+    const covariance_t& cov = it_map.second;
+    // don't copy back internally stored values
+    if(!cov.StoredValues.empty())
+      continue;
+    for(size_t i=0;i<cov.Values.size();i++) {
+      double* p = cov.Values[i];
+      // not all covariances might be linked
+      if(p==nullptr)
+        continue;
+      *p = V[cov.V_ij[i]];
     }
   }
+}
 
-  if(fit_settings.SkipCovariancesInResult)
-      return result;
+size_t APLCON::Compact_Result_t::Index(const string& varname) const
+{
+  if(Table) {
+    const vector<string>& names = Table->VariableNames;
+    const auto it = find(names.begin(), names.end(), varname);
+    if(it != names.end())
+      return distance(names.begin(), it);
+  }
+  throw Error("Variable '"+varname+"' not found in result");
+}
 
-  // build the covariances for each variable
-  // use the symmetry of V to make it as fast as possible
-  for(auto it_zipped_i : APLCON_::index(result.Variables)) {
+map<string, APLCON::Result_Variable_t> APLCON::Compact_Result_t::Variables() const
+{
+  map<string, Result_Variable_t> variables;
+  if(!Table)
+    return variables;
+  const Result_Table_t& table = *Table;
+
+  for(size_t i=0;i<Values.size();i++) {
+    Result_Variable_t var;
+    var.PristineName = table.PristineNames[i];
+    var.Dimension = table.Dimensions[i];
+    var.Index = table.Indices[i];
+    var.Value = {ValuesBefore[i], Values[i]};
+    var.Sigma = {SigmasBefore[i], Sigmas[i]};
+    var.Pull = Pulls[i];
+    var.Settings = table.Settings[i];
+    variables.emplace_hint(variables.end(), table.VariableNames[i], var);
+  }
+  return variables;
+}
 
-    for(auto it_zipped_j : APLCON_::index(result.Variables)) {
-      const size_t j = it_zipped_j.first;
-      const size_t i = it_zipped_i.first;
+APLCON::Result_t APLCON::Compact_Result_t::ToResult() const
+{
+  Result_t result = Result_t::Default;
+  result.Name = Name;
+  result.Status = Status;
+  result.ChiSquare = ChiSquare;
+  result.NDoF = NDoF;
+  result.Probability = Probability;
+  result.NIterations = NIterations;
+  result.NFunctionCalls = NFunctionCalls;
+  result.NScalarConstraints = NScalarConstraints;
+  result.Statistics = Statistics;
+  result.Variables = Variables();
+  if(Table)
+    result.Constraints = Table->Constraints;
+  result.Table = Table;
+  result.CovariancesBefore = CovariancesBefore;
+  result.Covariances = Covariances;
+  return result;
+}
 
-      if(i>j)
-        continue;
+// accessors of the packed covariances in Result_t
 
-      auto& it_map_i = it_zipped_i.second;
-      auto& it_map_j = it_zipped_j.second;
+size_t APLCON::Result_t::Index(const string& varname) const
+{
+  if(Table) {
+    const vector<string>& names = Table->VariableNames;
+    const auto it = find(names.begin(), names.end(), varname);
+    if(it != names.end())
+      return distance(names.begin(), it);
+  }
+  throw Error("Variable '"+varname+"' not found in result");
+}
 
-      const string& varname_i = it_map_i.first;
-      Result_Variable_t& var_i = it_map_i.second;
-      const string& varname_j = it_map_j.first;
-      Result_Variable_t& var_j = it_map_j.second;
+namespace {
+double packed_element(const vector<double>& V, size_t i, size_t j) {
+  const size_t V_ij = APLCON_::V_ij(i,j);
+  if(V_ij >= V.size())
+    throw APLCON::Error("Covariance not available in result, see SkipCovariancesInResult");
+  return V[V_ij];
+}
+double packed_correlation(const vector<double>& V, size_t i, size_t j) {
+  return packed_element(V, i, j) / sqrt(packed_element(V, i, i) * packed_element(V, j, j));
+}
+} // namespace
+
+double APLCON::Result_t::Covariance(size_t i, size_t j) const {
+  return packed_element(Covariances, i, j);
+}
+double APLCON::Result_t::Covariance(const string& var1, const string& var2) const {
+  return Covariance(Index(var1), Index(var2));
+}
+double APLCON::Result_t::CovarianceBefore(size_t i, size_t j) const {
+  return packed_element(CovariancesBefore, i, j);
+}
+double APLCON::Result_t::CovarianceBefore(const string& var1, const string& var2) const {
+  return CovarianceBefore(Index(var1), Index(var2));
+}
+double APLCON::Result_t::Correlation(size_t i, size_t j) const {
+  return packed_correlation(Covariances, i, j);
+}
+double APLCON::Result_t::Correlation(const string& var1, const string& var2) const {
+  return Correlation(Index(var1), Index(var2));
+}
+double APLCON::Result_t::CorrelationBefore(size_t i, size_t j) const {
+  return packed_correlation(CovariancesBefore, i, j);
+}
+double APLCON::Result_t::CorrelationBefore(const string& var1, const string& var2) const {
+  return CorrelationBefore(Index(var1), Index(var2));
+}
+
+void APLCON::Result_t::FillCovariances()
+{
+  if(!Table || Covariances.empty())
+    return;
+  const vector<string>& names = Table->VariableNames;
+
+  // find each variable once, in the order of the packed covariances
+  const size_t n = names.size();
+  vector<Result_Variable_t*> vars(n);
+  for(size_t i=0;i<n;i++) {
+    vars[i] = addressof(Variables.at(names[i]));
+    vars[i]->Covariances.Before.clear();
+    vars[i]->Covariances.After.clear();
+  }
 
+  // use the symmetry of V to make it as fast as possible
+  for(size_t i=0;i<n;i++) {
+    Result_Variable_t& var_i = *vars[i];
+    for(size_t j=i;j<n;j++) {
+      Result_Variable_t& var_j = *vars[j];
       const size_t V_ij = APLCON_::V_ij(i,j);
 
       // we use hinted insertion which improves performance by 10%
-      // correlations can be obtained
-
       var_i.Covariances.Before.insert(var_i.Covariances.Before.end(),
-                                      make_pair(varname_j, V_before[V_ij]));
+                                      make_pair(names[j], CovariancesBefore[V_ij]));
       var_i.Covariances.After .insert(var_i.Covariances.After.end(),
-                                      make_pair(varname_j, V[V_ij]));
+                                      make_pair(names[j], Covariances[V_ij]));
       if(i == j)
         continue;
 
       // note that V_ij = V_ji
 
       var_j.Covariances.Before.insert(var_j.Covariances.Before.end(),
-                                      make_pair(varname_i, V_before[V_ij]));
+                                      make_pair(names[i], CovariancesBefore[V_ij]));
       var_j.Covariances.After .insert(var_j.Covariances.After.end(),
-                                      make_pair(varname_i, V[V_ij]));
+                                      make_pair(names[i], Covariances[V_ij]));
     }
   }
+}
+
 
+APLCON::Result_Status_t APLCON::RunFit(Result_Statistics_t* stats)
+{
+  APLCON_::stopwatch watch(stats != nullptr);
+  int aplcon_ret = -1;
+  if(fit_settings.Engine == Engine_t::Native) {
+    // the native engine runs the loop itself
+    APLCON_::Solver::Timing_t timing{0, 0, 0};
+    aplcon_ret = solver.Fit(X.data(), V.data(), F.data(),
+                            [this] () { EvaluateConstraints(); },
+                            [this] () { SetJacobianRows(); },
+                            [this] (const double* x, const size_t* columns, const double* values,
+                                    const size_t* offsets, size_t n, double* const* f) {
+      EvaluatePoints(x, columns, values, offsets, n, f);
+    },
+                            stats ? addressof(timing) : nullptr);
+    if(stats) {
+      stats->ConstraintTime = timing.Constraints;
+      stats->DerivativeTime = timing.Derivatives;
+      stats->MatrixTime = timing.Matrix;
+      stats->EngineTime = watch.Lap() - timing.Constraints - timing.Derivatives - timing.Matrix;
+      stats->NJacobians = solver.NJacobians();
+      stats->NCutSteps = solver.NCutSteps();
+      stats->MatrixRank = solver.MatrixRank();
+      stats->NReusedColumns = solver.NReusedColumns();
+    }
+  }
+  else {
+    // the main convergence loop,
+    // with statistics the time of each step is booked according to APLCON's loop state
+    int istatu = 0;
+    do {
+      if(aplcon_ret == -3) {
+        // APLCON asks for the analytic derivatives at the current X,
+        // F is not needed in this case
+        SetJacobianRows();
+      }
+      else {
+        EvaluateConstraints();
+      }
+      if(stats)
+        (istatu == -1 ? stats->DerivativeTime : stats->ConstraintTime) += watch.Lap();
+
+      // call APLCON iteration
+      c_aplcon_aploop(X.data(), V.data(), F.data(), &aplcon_ret);
+
+      if(stats) {
+        const int istatu_before = istatu;
+        c_aplcon_aplsta(&istatu, &stats->NJacobians, &stats->NCutSteps, &stats->MatrixRank,
+                        &stats->NReusedColumns);
+        // leaving the derivatives (-1, -3) for a test (1) means ANITER was called
+        if(istatu == 1 && (istatu_before == -1 || istatu_before == -3))
+          stats->MatrixTime += watch.Lap();
+        else if(istatu_before == -1)
+          stats->DerivativeTime += watch.Lap();
+        else
+          stats->EngineTime += watch.Lap();
+      }
+    }
+    while(aplcon_ret<0);
+  }
 
+  // make some evil static_cast, but it's way shorter than switch statement
+  if(aplcon_ret >= static_cast<int>(Result_Status_t::_Unknown)) {
+    throw Error("Unkown return value after APLCON fit");
+  }
+  return static_cast<Result_Status_t>(aplcon_ret);
+}
 
-  // consider linked covariances
-  for(const auto& it_map : covariances) {
-    const covariance_t& cov = it_map.second;
-    // don't copy back internally stored values
-    if(!cov.StoredValues.empty())
+void APLCON::EvaluateConstraints()
+{
+  EvaluateConstraints(F_func, F.data());
+}
+
+void APLCON::EvaluateConstraints(const bound_functions_t& f_func, double* f) const
+{
+  // evaluate the constraints f_func and
+  // store results in f via their slices
+  for(size_t i=0; i<f_func.size(); ++i)
+    EvaluateConstraint(f_func, i, f+F_offsets[i]);
+}
+
+void APLCON::EvaluateConstraint(const bound_functions_t& f_func, size_t i, double* out) const
+{
+  const size_t n = F_offsets[i+1]-F_offsets[i];
+  if(f_func[i](out, n) != n) {
+    stringstream msg;
+    msg << "Constraint '" << next(constraints.begin(), i)->first
+        << "' changed its number of values, " << n << " expected";
+    throw Error(msg.str());
+  }
+}
+
+void APLCON::EvaluatePoints(const double* x, const size_t* columns, const double* values,
+                            const size_t* offsets, size_t n, double* const* f)
+{
+  // only the constraints depending on the displaced values are evaluated,
+  // and written one after the other to the slice of f for that point,
+  // the displaced values of one point never share a constraint
+  // x_k is restored from x_center afterwards
+  auto evaluate_point = [this, columns, values, offsets, f]
+      (vector<double>& x_k, const double* x_center, const bound_functions_t& f_func, size_t k) {
+    for(size_t l=offsets[k];l<offsets[k+1];l++)
+      x_k[columns[l]] = values[l];
+    double* out = f[k];
+    for(size_t l=offsets[k];l<offsets[k+1];l++) {
+      for(size_t i : X_constraints[columns[l]]) {
+        EvaluateConstraint(f_func, i, out);
+        out += F_offsets[i+1]-F_offsets[i];
+      }
+    }
+    for(size_t l=offsets[k];l<offsets[k+1];l++)
+      x_k[columns[l]] = x_center[columns[l]];
+  };
+
+  // without workers, x is X itself, so save the displaced values
+  if(derivative_workers.empty()) {
+    for(size_t l=offsets[0];l<offsets[n];l++)
+      X_center[columns[l]] = X[columns[l]];
+    for(size_t k=0;k<n;k++)
+      evaluate_point(X, X_center.data(), F_func, k);
+    return;
+  }
+
+  // the points are handed out one by one via the atomic counter,
+  // each worker displaces one value of its copy of x at a time
+  atomic<size_t> next_point(0);
+  auto worker_loop = [&] (size_t t) {
+    derivative_worker_t& worker = derivative_workers[t];
+    try {
+      copy(x, x+worker.X.size(), worker.X.begin());
+      for(size_t k = next_point++; k < n; k = next_point++)
+        evaluate_point(worker.X, x, worker.F_func, k);
+    }
+    catch(...) {
+      // stop the other workers as well
+      next_point = n;
+      throw;
+    }
+  };
+
+  // the calling thread is the first worker
+  derivative_threads.Run(min(derivative_workers.size(), n), worker_loop);
+}
+
+void APLCON::SetJacobianRows()
+{
+  auto it_map = constraints.begin();
+  int j = 1; // APLCON/Fortran starts counting at 1
+  for(size_t i=0; i<J_func.size(); ++i, ++it_map) {
+    const constraint_t& constraint = it_map->second;
+    if(!J_func[i]) {
+      j += constraint.Number;
       continue;
-    for(size_t i=0;i<cov.Values.size();i++) {
-      double* p = cov.Values[i];
-      // not all covariances might be linked
-      if(p==nullptr)
-        continue;
-      *p = V[cov.V_ij[i]];
+    }
+    const vector<size_t>& indices = J_indices[i];
+    const size_t n = constraint.Number*indices.size();
+    const size_t n_returned = J_func[i](J_values.data(), n);
+    if(n_returned != n) {
+      stringstream msg;
+      msg << "Derivative of constraint '" << it_map->first << "' returns " << n_returned
+          << " derivatives, but the constraint has " << constraint.Number << " values"
+          << " depending on " << indices.size() << " values";
+      throw Error(msg.str());
+    }
+    for(size_t r=0;r<constraint.Number;r++) {
+      const double* row = J_values.data()+r*indices.size();
+      // a variable might be given more than once in the varnames
+      for(size_t k=0;k<indices.size();k++)
+        J_row[indices[k]] += row[k];
+      if(fit_settings.Engine == Engine_t::Native)
+        solver.SetJacobianRow(j-1, X.data(), J_row.data());
+      else
+        c_aplcon_apjrow(X.data(), j, J_row.data());
+      for(size_t k : indices)
+        J_row[k] = 0;
+      ++j;
     }
   }
+}
+
+APLCON::statistics_t APLCON::GetStatistics(double* pulls) const
+{
+  statistics_t stats;
+  if(fit_settings.Engine == Engine_t::Native) {
+    stats.ChiSquare = solver.ChiSquare();
+    stats.NDoF = solver.NDoF();
+    stats.Probability = solver.Probability();
+    stats.NIterations = solver.NIterations();
+    stats.NFunctionCalls = solver.NFunctionCalls();
+    copy(solver.Pulls().begin(), solver.Pulls().end(), pulls);
+    return stats;
+  }
+  // chndpv and apstat both return the resulting chi2,
+  // but the latter returns it with double precision
+  float chi2, pval;
+  c_aplcon_chndpv(&chi2, &stats.NDoF, &pval);
+  stats.Probability = pval;
+  c_aplcon_apstat(&stats.ChiSquare, &stats.NFunctionCalls, &stats.NIterations);
+  c_aplcon_appull(pulls);
+  return stats;
+}
+
+APLCON::Batch_Result_t APLCON::FitBatch(const Batch_Input_t& input, unsigned nThreads)
+{
+  // build the bookkeeping (XOffset, V_ij, F_func) once,
+  // the workers only need to rebind F_func to their own storage
+  Init();
+
+  const size_t N = input.NEvents;
+  const size_t nX = X.size();
+  const size_t nV = V.size();
+
+  if(input.Values.size() != nX*N) {
+    stringstream msg;
+    msg << "Batch input provides " << input.Values.size() << " values, but "
+        << nX << " variables times " << N << " events needed";
+    throw Error(msg.str());
+  }
+  if(!input.Sigmas.empty() && input.Sigmas.size() != nX*N) {
+    stringstream msg;
+    msg << "Batch input provides " << input.Sigmas.size() << " sigmas, but "
+        << nX << " variables times " << N << " events needed";
+    throw Error(msg.str());
+  }
+  if(!input.Covariances.empty()) {
+    if(!input.Sigmas.empty())
+      throw Error("Batch input must not provide both sigmas and covariances");
+    if(input.Covariances.size() != nV*N) {
+      stringstream msg;
+      msg << "Batch input provides " << input.Covariances.size() << " covariances, but "
+          << nV << " matrix elements times " << N << " events needed";
+      throw Error(msg.str());
+    }
+  }
+
+  Batch_Result_t result;
+  result.Name = instance_name;
+  result.NEvents = N;
+  result.VariableNames = VariableNames();
+  result.NScalarConstraints = nConstraints;
+  result.Status.assign(N, Result_Status_t::_Unknown);
+  // assign takes a reference, so NaN can't be used directly
+  const double nan = numeric_limits<double>::quiet_NaN();
+  result.ChiSquare.assign(N, nan);
+  result.NDoF.assign(N, -1);
+  result.Probability.assign(N, nan);
+  result.NIterations.assign(N, -1);
+  result.NFunctionCalls.assign(N, -1);
+  result.Values.resize(nX*N);
+  result.Sigmas.resize(nX*N);
+  result.Pulls.resize(nX*N);
+  if(!fit_settings.SkipCovariancesInResult)
+    result.Covariances.resize(nV*N);
+
+  if(nThreads == 0)
+    nThreads = max(1u, thread::hardware_concurrency());
+  nThreads = min<size_t>(nThreads, max<size_t>(N, 1));
+
+  // the events are fitted in lanes if the constraints and variables allow it,
+  // i.e. with generic lane constraints, Gaussian variables and measured fixed ones
+  const unsigned nLanes = fit_settings.BatchLanes;
+  bool lanes = fit_settings.Engine == Engine_t::Native && (nLanes == 4 || nLanes == 8)
+               && !constraints.empty();
+  for(const auto& it_map : constraints)
+    lanes &= static_cast<bool>(it_map.second.Lanes);
+  if(lanes) {
+    const auto& solver_variables = solver.GetVariables();
+    for(size_t i=0;i<nX;i++) {
+      const APLCON_::Solver::Variable_t& v = solver_variables[i];
+      lanes &= v.Transformation == APLCON_::Solver::Transformation_t::None;
+      lanes &= !v.Fixed || V_before[APLCON_::V_ij(i,i)] != 0;
+    }
+  }
+
+  // the events are handed out one by one via the atomic counter,
+  // the results are written to disjoint elements of the result arrays
+  atomic<size_t> next_event(0);
+
+  auto worker_loop = [&] (APLCON& worker) {
+    try {
+      if(lanes && nLanes == 8) {
+        worker.FitLanes<8>(input, result, [&next_event] () -> size_t { return next_event++; });
+      }
+      else if(lanes) {
+        worker.FitLanes<4>(input, result, [&next_event] () -> size_t { return next_event++; });
+      }
+      else {
+        vector<double> pulls(nX);
+        vector<double> variances(nX);
+        for(size_t n = next_event++; n < N; n = next_event++)
+          worker.FitEvent(input, n, result, pulls.data(), variances.data());
+      }
+    }
+    catch(...) {
+      // stop the other workers as well
+      next_event = N;
+      throw;
+    }
+  };
+
+  // each worker fits on its own copy of this instance,
+  // so the copies need to rebind F_func to their storage,
+  // they are kept until Init() rebuilds this instance
+  vector< unique_ptr<APLCON> >& workers = batch_workers.Copies;
+  while(workers.size() < nThreads) {
+    workers.emplace_back(new APLCON(*this));
+    workers.back()->BindConstraints();
+  }
+
+  // the calling thread is the first worker
+  batch_workers.Threads.Resize(nThreads);
+  batch_workers.Threads.Run(nThreads, [&worker_loop, &workers] (size_t t) {
+    worker_loop(*workers[t]);
+  });
 
   return result;
 }
 
+void APLCON::LoadEvent(const Batch_Input_t& input, size_t n, double* x, double* v) const
+{
+  // the values and covariances of event n, see Batch_Input_t
+  const size_t N = input.NEvents;
+  const size_t nX = X.size();
+  const size_t nV = V.size();
+  for(size_t i=0;i<nX;i++)
+    x[i] = input.Values[i*N+n];
+  if(!input.Covariances.empty()) {
+    for(size_t k=0;k<nV;k++)
+      v[k] = input.Covariances[k*N+n];
+  }
+  else {
+    copy(V_before.begin(), V_before.end(), v);
+    if(!input.Sigmas.empty()) {
+      for(size_t i=0;i<nX;i++)
+        v[APLCON_::V_ij(i,i)] = pow(input.Sigmas[i*N+n], 2);
+    }
+  }
+}
+
+void APLCON::StoreEvent(Batch_Result_t& result, size_t n, Result_Status_t status,
+                        const statistics_t& stats, const double* x, const double* v,
+                        const double* pulls, double* variances) const
+{
+  const size_t N = result.NEvents;
+  const size_t nX = X.size();
+  const size_t nV = V.size();
+  result.Status[n] = status;
+  result.ChiSquare[n] = stats.ChiSquare;
+  result.NDoF[n] = stats.NDoF;
+  result.Probability[n] = stats.Probability;
+  result.NIterations[n] = stats.NIterations;
+  result.NFunctionCalls[n] = stats.NFunctionCalls;
+
+  APLCON_::Kernels().Diagonal(v, nX, variances);
+  for(size_t i=0;i<nX;i++) {
+    result.Values[i*N+n] = x[i];
+    result.Sigmas[i*N+n] = sqrt(variances[i]);
+    result.Pulls[i*N+n]  = pulls[i];
+  }
+  if(!result.Covariances.empty()) {
+    for(size_t k=0;k<nV;k++)
+      result.Covariances[k*N+n] = v[k];
+  }
+}
+
+void APLCON::FitEvent(const Batch_Input_t& input, size_t n, Batch_Result_t& result,
+                      double* pulls, double* variances)
+{
+  LoadEvent(input, n, X.data(), V.data());
+
+  // the events are handed out in arbitrary order, so never warm start
+  InitAPLCON();
+  solver.ClearWarmStart();
+  const Result_Status_t status = RunFit();
+
+  const statistics_t stats = GetStatistics(pulls);
+  StoreEvent(result, n, status, stats, X.data(), V.data(), pulls, variances);
+}
+
+template<size_t L>
+void APLCON::FitLanes(const Batch_Input_t& input, Batch_Result_t& result,
+                      const function<size_t()>& next_event)
+{
+  const size_t N = input.NEvents;
+  const size_t nX = X.size();
+  const size_t nV = V.size();
+
+  // all lanes have the (un)measured and fixed variables of this instance
+  vector<bool> measured(nX);
+  vector<bool> fixed(nX);
+  for(size_t i=0;i<nX;i++) {
+    measured[i] = V_before[APLCON_::V_ij(i,i)] != 0;
+    fixed[i] = solver.GetVariables()[i].Fixed;
+  }
+  APLCON_::LaneSolver<L> lanes;
+  lanes.Init(measured, fixed, nConstraints, solver.GetSettings());
+
+  // each lane constraint is a single scalar constraint in row F_offsets[i],
+  // which returns the derivatives w.r.t. its arguments at J_indices[i]
+  vector<const lane_function_t*> lane_functions;
+  size_t nArguments = 0;
+  for(const auto& it_map : constraints)
+    lane_functions.push_back(addressof(it_map.second.Lanes));
+  for(const vector<size_t>& indices : J_indices)
+    nArguments = max(nArguments, indices.size());
+  vector<double> values(L);
+  vector<double> gradient(nArguments*L);
+
+  auto evaluate = [this, &lane_functions] (const double* x, double* f) {
+    for(size_t i=0;i<lane_functions.size();i++)
+      (*lane_functions[i])(x, J_indices[i].data(), L, f+F_offsets[i]*L, nullptr);
+  };
+  auto jacobian = [this, nX, &lane_functions, &values, &gradient] (const double* x, double* a) {
+    fill(a, a+nConstraints*nX*L, 0);
+    for(size_t i=0;i<lane_functions.size();i++) {
+      const vector<size_t>& indices = J_indices[i];
+      (*lane_functions[i])(x, indices.data(), L, values.data(), gradient.data());
+      // a variable might be given more than once in the varnames
+      double* row = a+F_offsets[i]*nX*L;
+      for(size_t k=0;k<indices.size();k++) {
+        for(size_t l=0;l<L;l++)
+          row[indices[k]*L+l] += gradient[k*L+l];
+      }
+    }
+  };
+
+  // an event not fitting to the lanes is fitted on its own right away
+  vector<double> x(nX);
+  vector<double> v(nV);
+  vector<double> pulls(nX);
+  vector<double> variances(nX);
+  size_t events[L];
+  auto load = [&] (size_t l) {
+    for(size_t n = next_event(); n < N; n = next_event()) {
+      LoadEvent(input, n, x.data(), v.data());
+      if(lanes.Load(l, x.data(), v.data())) {
+        events[l] = n;
+        return;
+      }
+      FitEvent(input, n, result, pulls.data(), variances.data());
+    }
+    lanes.Clear(l);
+  };
+  for(size_t l=0;l<L;l++)
+    load(l);
+
+  // a finished lane is refilled while the others continue
+  while(lanes.Running()) {
+    lanes.Iterate(evaluate, jacobian);
+    for(size_t l=0;l<L;l++) {
+      if(!lanes.Finished(l))
+        continue;
+      const size_t n = events[l];
+      if(lanes.Status(l) < 0) {
+        // the equation system is not positive definite, see LaneSolver::Status
+        FitEvent(input, n, result, pulls.data(), variances.data());
+      }
+      else {
+        statistics_t stats;
+        stats.ChiSquare = lanes.ChiSquare(l);
+        stats.NDoF = lanes.NDoF();
+        stats.Probability = lanes.Probability(l);
+        stats.NIterations = lanes.NIterations(l);
+        stats.NFunctionCalls = lanes.NFunctionCalls(l);
+        lanes.Result(l, x.data(), v.data(), pulls.data());
+        StoreEvent(result, n, static_cast<Result_Status_t>(lanes.Status(l)), stats,
+                   x.data(), v.data(), pulls.data(), variances.data());
+      }
+      load(l);
+    }
+  }
+}
 
 void APLCON::Init()
 {
   // check if we can do some quick init
-  if(initialized && instance_id == instance_lastfit) {
+  if(initialized) {
     // fully init APLCON,
     InitAPLCON();
 
@@ -511,11 +1134,25 @@ void APLCON::Init()
       const auto& cov = it_map.second;
       APLCON_::V_transform(V, cov.Values, cov.V_ij);
     }
+
+    // start unmeasured variables at the previous solution
+    if(!X_warm.empty()) {
+      for(size_t i=0;i<X.size();i++) {
+        if(V[APLCON_::V_ij(i,i)] == 0)
+          X[i] = X_warm[i];
+      }
+    }
     return;
   }
 
+  // APLCON itself cannot be given step sizes or a Jacobian
+  if(fit_settings.Engine == Engine_t::Fortran && fit_settings.WarmStart == WarmStart_t::Derivatives)
+    throw Error("Warm start of derivatives needs the Native engine");
 
   // build the storage arrays X, V, F for APLCON
+  // and forget about any previous solution and the copies of FitBatch
+  X_warm.clear();
+  batch_workers.Copies.clear();
 
   // X are simply the start values, but also track the
   // map of variables names to index in X (as offsets)
@@ -555,46 +1192,82 @@ void APLCON::Init()
 
 
 
+  // the native engine may evaluate the numerical derivatives
+  // concurrently, each thread on its own copy of X
+  unsigned nThreads = fit_settings.DerivativeThreads;
+  if(nThreads == AllThreads)
+    nThreads = max(1u, thread::hardware_concurrency());
+  derivative_workers.clear();
+  if(fit_settings.Engine == Engine_t::Native && nThreads > 1)
+    derivative_workers.resize(nThreads, {X, {}});
+  derivative_threads.Resize(derivative_workers.size());
+
   // F will be set by APLCON iteration loop in DoFit
   // F_func are bound to the double pointers which we know
   // since X is now finally allocated in memory
+  BindConstraints();
+
+  // now, since we have bound the funcs, we can execute them once
+  // to determine the returned number of values and
+  // thus obtain the number of constraints
   nConstraints = 0;
-  F_func.clear();
-  F_func.reserve(constraints.size());
+  F_offsets.assign(1, 0);
+  auto it_F_func = F_func.begin();
   for(auto& it_map : constraints) {
-    // build the vector of double pointers
     constraint_t& constraint = it_map.second;
-    vector< vector<const double*> > args;
-    args.reserve(constraint.VariableNames.size()); // args usually smaller, but probably not larger (but not excluded)
-    for(const string& varname : constraint.VariableNames) {
-      const variable_t& var = GetVariableByName(
-            varname,
-            "Constraint '"+it_map.first+"' refers to unknown variable '"+varname+"'");
-      // check if constraint fits to variables
-      if(constraint.WantsDouble && var.Values.size()>1) {
-        stringstream msg;
-        msg << "Constraint '" << it_map.first << "' wants only single double arguments, "
-            << "but '" << varname << "' consists of " << var.Values.size() << " (i.e. more than 1) values.";
-        throw Error(msg.str());
-      }
-      // build the vector of pointers to X values
-      vector<const double*> p(var.Values.size());
-      const auto& X_offset = X.begin()+var.XOffset;
-      transform(X_offset, X_offset+p.size(), p.begin(), APLCON_::make_pointer<double>);
-      // and store it in args
-      args.push_back(p);
-    }
-    const auto& func = bind(constraint.Function, args);
-    // now, since we have bound the func, we can execute it once
-    // to determine the returned number of values and
-    // thus obtain the number of constraints
-    const vector<double>&  r = func();
-    nConstraints += r.size();
-    constraint.Number = r.size();
-    F_func.push_back(func);
+    // nothing is written, but the number of values is returned
+    constraint.Number = (*it_F_func)(nullptr, 0);
+    nConstraints += constraint.Number;
+    F_offsets.push_back(nConstraints);
+    ++it_F_func;
+  }
+  // the derivatives are called once as well,
+  // which allocates the buffers of the generic functors
+  for(const auto& J : J_func) {
+    if(J)
+      J(nullptr, 0);
   }
   F.resize(nConstraints);
 
+  // the sparsity of the Jacobian follows from the variables of each constraint,
+  // so the numerical derivatives only evaluate the dependent constraints
+  X_constraints.assign(X.size(), {});
+  X_center.resize(X.size());
+  for(size_t i=0;i<J_indices.size();i++) {
+    for(size_t j : J_indices[i]) {
+      // a variable might be given more than once in the varnames
+      if(X_constraints[j].empty() || X_constraints[j].back() != i)
+        X_constraints[j].push_back(i);
+    }
+  }
+
+  // variables which are only used by constraints with analytic derivatives
+  // don't need to be differentiated numerically by APLCON
+  analytic_variables.clear();
+  if(any_of(J_func.begin(), J_func.end(),
+            [] (const function<size_t(double*, size_t)>& f) { return static_cast<bool>(f); })) {
+    vector<bool> numerical(X.size(), false);
+    for(size_t i=0;i<J_func.size();i++) {
+      if(J_func[i])
+        continue;
+      for(size_t j : J_indices[i])
+        numerical[j] = true;
+    }
+    for(size_t j=0;j<X.size();j++) {
+      if(!numerical[j])
+        analytic_variables.push_back(j+1); // APLCON/Fortran starts counting at 1
+    }
+  }
+  J_row.assign(X.size(), 0);
+  // the derivatives of each constraint are written to J_values
+  size_t nJ_values = 0;
+  auto it_constraint = constraints.begin();
+  for(size_t i=0;i<J_func.size();i++, ++it_constraint) {
+    if(J_func[i])
+      nJ_values = max(nJ_values, it_constraint->second.Number*J_indices[i].size());
+  }
+  J_values.assign(nJ_values, 0);
+
   // V filled with off-diagonal elements from covariances
   // the variables already have their Values pointer correctly filled,
   // so it's size can be used for the variables's dimensionality
@@ -703,23 +1376,238 @@ void APLCON::Init()
   }
 
   // finally we know the number of variables and constraints
-  // so we can setup APLCON itself
+  // so we can setup the native engine, or
+  // size the workspace and setup APLCON itself
+  if(fit_settings.Engine == Engine_t::Native)
+    InitSolver();
+  else
+    InitWorkspace();
   InitAPLCON();
 
 
   // save a pristine copy for later
   V_before = V;
 
-  // remember that this instance has inited APLCON
+  // the names for the results
+  BuildResultTable();
+
+  // remember that the storage is built
   initialized = true;
-  instance_lastfit = instance_id;
+}
+
+void APLCON::BuildResultTable()
+{
+  auto table = make_shared<Result_Table_t>();
+  for(const auto& it_map : variables) {
+    const variable_t& var = it_map.second;
+    const size_t n = var.Values.size();
+    for(size_t k=0;k<n;k++) {
+      table->VariableNames.push_back(APLCON_::BuildVarName(it_map.first, n, k));
+      table->PristineNames.push_back(it_map.first);
+      table->Dimensions.push_back(n);
+      table->Indices.push_back(k);
+      table->Settings.push_back(var.Settings[k]);
+    }
+  }
+  for(const auto& it_map : constraints) {
+    Result_Constraint_t r_con;
+    r_con.Dimension = it_map.second.Number;
+    table->Constraints[it_map.first] = r_con;
+  }
+  result_table = table;
+}
+
+void APLCON::InitWorkspace()
+{
+  long long nAUX;
+  c_aplcon_apnaux(nVariables, nConstraints, &nAUX);
+  if(nAUX > numeric_limits<int>::max()) {
+    stringstream msg;
+    msg << "Fit with " << nVariables << " variables and " << nConstraints
+        << " constraints needs workspace of " << nAUX << " elements, which APLCON cannot address";
+    throw Error(msg.str());
+  }
+  try {
+    AUX.resize(nAUX);
+  }
+  catch(const bad_alloc&) {
+    stringstream msg;
+    msg << "Cannot allocate workspace of " << nAUX << " elements for fit with "
+        << nVariables << " variables and " << nConstraints << " constraints";
+    throw Error(msg.str());
+  }
+}
+
+APLCON_::Solver::Settings_t APLCON::SolverSettings(const Fit_Settings_t& fit_settings)
+{
+  // the same settings as given to APLCON in InitAPLCON()
+  APLCON_::Solver::Settings_t settings = APLCON_::Solver::Settings_t::Default;
+  if(isfinite(fit_settings.ConstraintAccuracy))
+    settings.ConstraintAccuracy = fit_settings.ConstraintAccuracy;
+  if(isfinite(fit_settings.Chi2Accuracy))
+    settings.Chi2Accuracy = fit_settings.Chi2Accuracy;
+  if(fit_settings.MaxIterations>=0)
+    settings.MaxIterations = max(3, fit_settings.MaxIterations);
+  if(isfinite(fit_settings.MeasuredStepSizeFactor))
+    settings.MeasuredStepSizeFactor = fit_settings.MeasuredStepSizeFactor;
+  if(isfinite(fit_settings.UnmeasuredStepSizeFactor))
+    settings.UnmeasuredStepSizeFactor = fit_settings.UnmeasuredStepSizeFactor;
+  if(isfinite(fit_settings.MinimalStepSizeFactor))
+    settings.MinimalStepSizeFactor = fit_settings.MinimalStepSizeFactor;
+  settings.WarmStart = fit_settings.WarmStart != WarmStart_t::None;
+  settings.BroydenUpdates = fit_settings.BroydenUpdates;
+  return settings;
+}
+
+APLCON_::Solver::Variable_t APLCON::SolverVariable(const Variable_Settings_t& s)
+{
+  typedef APLCON_::Solver::Transformation_t Transformation_t;
+  APLCON_::Solver::Variable_t v;
+  switch (s.Distribution) {
+  case APLCON::Distribution_t::Poissonian:
+    v.Transformation = Transformation_t::Poisson;
+    break;
+  case APLCON::Distribution_t::LogNormal:
+    v.Transformation = Transformation_t::LogNormal;
+    break;
+  case APLCON::Distribution_t::SquareRoot:
+    v.Transformation = Transformation_t::SquareRoot;
+    break;
+  default:
+    v.Transformation = Transformation_t::None;
+    break;
+  }
+  const bool limited = isfinite(s.Limit.Low) && isfinite(s.Limit.High);
+  v.Low  = limited ? min(s.Limit.Low, s.Limit.High) : 0;
+  v.High = limited ? max(s.Limit.Low, s.Limit.High) : 0;
+  v.Step = isfinite(s.StepSize) ? s.StepSize : 0;
+  v.Fixed = s.StepSize == 0;
+  v.Analytic = false;
+  v.Group = 0;
+  return v;
+}
+
+void APLCON::InitSolver()
+{
+  APLCON_::Solver::Settings_t settings = SolverSettings(fit_settings);
+  settings.EvaluatePointsAtOnce = !derivative_workers.empty();
+
+  vector<APLCON_::Solver::Variable_t> solver_variables(nVariables);
+  for(const auto& it_var : variables) {
+    const variable_t& var = it_var.second;
+    for(size_t j=0;j<var.Settings.size();j++)
+      solver_variables[j+var.XOffset] = SolverVariable(var.Settings[j]);
+  }
+  for(int i : analytic_variables)
+    solver_variables[i-1].Analytic = true;
+  // adjacent slices of F are merged into one range
+  for(size_t j=0;j<X_constraints.size();j++) {
+    auto& rows = solver_variables[j].Rows;
+    for(size_t i : X_constraints[j]) {
+      if(!rows.empty() && rows.back().second == F_offsets[i])
+        rows.back().second = F_offsets[i+1];
+      else
+        rows.emplace_back(F_offsets[i], F_offsets[i+1]);
+    }
+  }
+
+  // variables sharing no constraint are displaced at once by the numerical derivatives,
+  // so group them by greedy coloring, starting with the variables in most constraints
+  vector<size_t> order;
+  for(size_t j=0;j<X_constraints.size();j++) {
+    APLCON_::Solver::Variable_t& v = solver_variables[j];
+    v.Group = 0;
+    if(!v.Fixed && !v.Analytic && !X_constraints[j].empty())
+      order.push_back(j);
+  }
+  stable_sort(order.begin(), order.end(), [this] (size_t a, size_t b) {
+    return X_constraints[a].size() > X_constraints[b].size();
+  });
+  // the groups used by each constraint, and the groups used by
+  // any constraint of variable j are marked with j
+  vector< vector<size_t> > constraint_groups(F_func.size());
+  vector<size_t> used(order.size(), X_constraints.size());
+  for(size_t j : order) {
+    for(size_t i : X_constraints[j]) {
+      for(size_t g : constraint_groups[i])
+        used[g] = j;
+    }
+    size_t g = 0;
+    while(used[g] == j)
+      g++;
+    solver_variables[j].Group = g;
+    for(size_t i : X_constraints[j])
+      constraint_groups[i].push_back(g);
+  }
+
+  solver.Init(solver_variables, nConstraints, settings);
+}
+
+void APLCON::BindConstraints()
+{
+  // build F_func and J_func from the constraints, bound to X,
+  // and the F_func of the derivative workers, bound to their copies of X
+  // only the XOffset's of the variables must be known
+  for(derivative_worker_t& worker : derivative_workers) {
+    worker.F_func.clear();
+    worker.F_func.reserve(constraints.size());
+  }
+  F_func.clear();
+  F_func.reserve(constraints.size());
+  J_func.clear();
+  J_func.reserve(constraints.size());
+  J_indices.clear();
+  J_indices.reserve(constraints.size());
+  for(const auto& it_map : constraints) {
+    // build the vector of spans over X
+    const constraint_t& constraint = it_map.second;
+    arguments_t args;
+    args.reserve(constraint.VariableNames.size()); // args usually smaller, but probably not larger (but not excluded)
+    vector<size_t> indices;
+    for(const string& varname : constraint.VariableNames) {
+      const variable_t& var = GetVariableByName(
+            varname,
+            "Constraint '"+it_map.first+"' refers to unknown variable '"+varname+"'");
+      // check if constraint fits to variables
+      if(constraint.WantsDouble && var.Values.size()>1) {
+        stringstream msg;
+        msg << "Constraint '" << it_map.first << "' wants only single double arguments, "
+            << "but '" << varname << "' consists of " << var.Values.size() << " (i.e. more than 1) values.";
+        throw Error(msg.str());
+      }
+      // the values of a variable are consecutive in X
+      args.push_back({X.data()+var.XOffset, var.Values.size()});
+      // the columns of the Jacobian are the X indices
+      for(size_t k=0;k<var.Values.size();k++)
+        indices.push_back(var.XOffset+k);
+    }
+    F_func.push_back(bind(constraint.Function, args, placeholders::_1, placeholders::_2));
+    for(derivative_worker_t& worker : derivative_workers) {
+      arguments_t worker_args(args);
+      for(APLCON_::span& arg : worker_args)
+        arg.Data = worker.X.data() + (arg.Data - X.data());
+      worker.F_func.push_back(bind(constraint.Function, worker_args, placeholders::_1, placeholders::_2));
+    }
+    if(constraint.Derivative)
+      J_func.push_back(bind(constraint.Derivative, args, placeholders::_1, placeholders::_2));
+    else
+      J_func.emplace_back();
+    J_indices.push_back(indices);
+  }
 }
 
 void APLCON::InitAPLCON() {
 
-  c_aplcon_aplcon(nVariables, nConstraints);
+  // the native engine is completely set up by Init()
+  if(fit_settings.Engine == Engine_t::Native)
+    return;
 
+  // the workspace is owned by this instance, see Init()
+  c_aplcon_apwork(AUX.data(), AUX.size());
+  // the print level must be known before APLCON prints anything
   c_aplcon_aprint(6, fit_settings.DebugLevel); // default output on LUNP 6 (STDOUT)
+  c_aplcon_aplcon(nVariables, nConstraints);
+
   if(isfinite(fit_settings.ConstraintAccuracy))
     c_aplcon_apdeps(fit_settings.ConstraintAccuracy);
   if(isfinite(fit_settings.Chi2Accuracy))
@@ -732,6 +1620,8 @@ void APLCON::InitAPLCON() {
     c_aplcon_apderu(fit_settings.UnmeasuredStepSizeFactor);
   if(isfinite(fit_settings.MinimalStepSizeFactor))
     c_aplcon_apdlow(fit_settings.MinimalStepSizeFactor);
+  if(fit_settings.BroydenUpdates)
+    c_aplcon_apbroy(1);
 
   for(const auto& it_var : variables) {
     const variable_t& var = it_var.second;
@@ -764,4 +1654,7 @@ void APLCON::InitAPLCON() {
         c_aplcon_apstep(i, s.StepSize);
     }
   }
+
+  for(int i : analytic_variables)
+    c_aplcon_apanal(i);
 }
@@ -3,11 +3,14 @@
 
 // detail code is in namespace APLCON_ (note the underscore)
 #include "detail/APLCON_hpp.hpp"
+#include "detail/APLCON_solver.hpp"
+#include "detail/APLCON_threads.hpp"
 
 #include <algorithm>
 #include <functional>
 #include <limits>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
@@ -24,8 +27,44 @@ class APLCON
 {
 public:
 
+  /**
+   * @brief The Engine_t enum selects the implementation of the fit
+   * @see Fit_Settings_t
+   */
+  enum class Engine_t {
+    Fortran, /**< V.Blobel's Fortran code via its reverse-communication loop (default, reference) */
+    Native   /**< C++ implementation of the same algorithm, calling the constraints directly */
+  };
+
+  /**
+   * @brief The WarmStart_t enum selects what a fit takes over from the previous converged fit
+   * @note Only the Native engine reuses the step sizes and the Jacobian, so the Fortran engine
+   * rejects Derivatives, and only starts the unmeasured variables with Unmeasured.
+   * @see Fit_Settings_t
+   */
+  enum class WarmStart_t {
+    None,        /**< each fit starts from scratch (default) */
+    Derivatives, /**< reuse final step sizes, and the Jacobian in the first iteration */
+    Unmeasured   /**< additionally start unmeasured variables at their fitted values */
+  };
+
    /**
    * @brief The Fit_Settings_t struct. See APLCON itself for details.
+   * @note The Native engine does not print anything, so DebugLevel is ignored then.
+   * CollectStatistics fills Result_t::Statistics, which costs some timer calls per iteration.
+   * WarmStart is forgotten whenever the instance is changed, or after a failed fit.
+   * BroydenUpdates updates the Jacobian between iterations instead of recomputing it,
+   * a fit then still converges only with a computed Jacobian.
+   * DerivativeThreads greater than 1 lets the Native engine evaluate the displaced points
+   * of the numerical derivatives concurrently on copies of the variables
+   * (APLCON::AllThreads means std::thread::hardware_concurrency(), 0 and 1 evaluate them serially),
+   * so the constraints must be thread-safe then.
+   * BatchLanes is the number of events FitBatch fits at once with the Native engine,
+   * either 4 or 8, if all constraints were added by AddLaneConstraint (any other value disables this).
+   * AllocationCounter optionally returns a counter of heap allocations, e.g. of a replaced
+   * global operator new (see bench/Bench.cc), which is read before and after DoFit()
+   * for Result_Statistics_t::NAllocations. A process-wide counter also counts the allocations
+   * of other threads meanwhile, so use a thread-local one, or fit in a single thread only.
    */
   struct Fit_Settings_t {
     int DebugLevel;
@@ -36,6 +75,13 @@ public:
     double UnmeasuredStepSizeFactor;
     double MinimalStepSizeFactor;
     bool   SkipCovariancesInResult;
+    Engine_t Engine;
+    bool   CollectStatistics;
+    WarmStart_t WarmStart;
+    bool   BroydenUpdates;
+    unsigned DerivativeThreads;
+    unsigned BatchLanes;
+    std::function<long()> AllocationCounter;
     const static Fit_Settings_t Default;
   };
 
@@ -108,13 +154,23 @@ public:
 
   /**
    * @brief helper method to calculate correlations from covariances
-   * @note used by the ostream<< operators, and might be useful for some users
-   * @param variables from Result_t
+   * @note slow for many variables, prefer the overload for packed matrices
+   * @param variables from Result_t, see Result_t::FillCovariances
    * @return correlations between stringified variables, before and after fit
    */
   static std::map< std::string, Result_BeforeAfter_t< std::map<std::string, double> > >
   CalculateCorrelations(const std::map<std::string, Result_Variable_t>& variables);
 
+  /**
+   * @brief calculate correlations from a packed symmetric covariance matrix
+   * @note used by the ostream<< operators, storage of correlations is reused
+   * @param covariances packed like Result_t::Covariances
+   * @param correlations packed like covariances, NaN if a variance is zero
+   */
+  static void CalculateCorrelations(const std::vector<double>& covariances,
+                                    std::vector<double>& correlations);
+  static std::vector<double> CalculateCorrelations(const std::vector<double>& covariances);
+
   /**
    * @brief The Result_Constraint_t struct contains constraint information
    */
@@ -122,11 +178,50 @@ public:
     size_t Dimension;    // how many scalar constraints are represented by it
   };
 
+  /**
+   * @brief The Result_Statistics_t struct contains timings and counters of one DoFit() call
+   * @see Fit_Settings_t::CollectStatistics
+   * The times are wall times in seconds, the phases add up to the time spent in DoFit().
+   * For the Fortran engine, the phase of each APLOOP call is determined from its loop state.
+   */
+  struct Result_Statistics_t {
+    bool Collected;         /**< false if not enabled, then all other members are not meaningful */
+    double InitTime;        /**< Init(), including the rebuild of the storage if the instance was changed */
+    double ConstraintTime;  /**< constraint evaluations outside the numerical derivatives, and analytic derivatives */
+    double DerivativeTime;  /**< numerical derivatives, including their constraint evaluations */
+    double MatrixTime;      /**< next iteration step, mostly solving the equation system (DUMINV) */
+    double EngineTime;      /**< remaining time of the fit engine, e.g. convergence tests */
+    double ResultTime;      /**< building this result */
+    int NJacobians;         /**< number of Jacobian computations */
+    int NCutSteps;          /**< number of cut-steps, i.e. NCST summed over all iterations */
+    int MatrixRank;         /**< rank of the equation system in the last iteration */
+    int NReusedColumns;     /**< Jacobian columns of linear variables which were not recomputed */
+    long NAllocations;      /**< heap allocations during DoFit() as counted by Fit_Settings_t::AllocationCounter, -1 if not set */
+  };
+
+  /**
+   * @brief The Result_Table_t struct describes the variables and constraints of an instance
+   *
+   * It's indexed like the packed covariances of Result_t, and shared by
+   * all results until the instance is changed.
+   */
+  struct Result_Table_t {
+    std::vector<std::string> VariableNames; /**< appended with [i] if non-scalar, as in Result_t */
+    std::vector<std::string> PristineNames;
+    std::vector<size_t> Dimensions;
+    std::vector<size_t> Indices;
+    std::vector<Variable_Settings_t> Settings;
+    std::map<std::string, Result_Constraint_t> Constraints;
+  };
+
   /**
    * @brief The Result_t struct contains
    * after the fit all information about it.
    * Variables are always referenced by their string representation,
    * appended with [i] if they are non-scalar.
+   *
+   * The covariance matrices are kept packed, and are read by the accessors below.
+   * The maps Result_Variable_t::Covariances are only filled by FillCovariances().
    */
   struct Result_t {
     std::string Name;
@@ -139,7 +234,130 @@ public:
     std::map<std::string, Result_Variable_t>   Variables;
     std::map<std::string, Result_Constraint_t> Constraints;
     int NScalarConstraints;
+    Result_Statistics_t Statistics; /**< only collected if enabled in Fit_Settings_t */
+    std::shared_ptr<const Result_Table_t> Table; /**< names in the order of the packed covariances */
+    std::vector<double> CovariancesBefore; /**< packed as V, empty if SkipCovariancesInResult */
+    std::vector<double> Covariances;       /**< packed as V, empty if SkipCovariancesInResult */
     const static Result_t Default;
+
+    /**
+     * @brief Index of the variable in the packed covariances
+     * @param varname name of the variable, appended with [i] if non-scalar
+     * @return index, throws Error if not found
+     */
+    size_t Index(const std::string& varname) const;
+
+    /**
+     * @brief Covariance between two variables after the fit
+     * @note all accessors throw Error if the covariances were skipped
+     */
+    double Covariance(size_t i, size_t j) const;
+    double Covariance(const std::string& var1, const std::string& var2) const;
+    /**
+     * @brief Covariance between two variables before the fit
+     */
+    double CovarianceBefore(size_t i, size_t j) const;
+    double CovarianceBefore(const std::string& var1, const std::string& var2) const;
+    /**
+     * @brief Correlation between two variables after the fit
+     */
+    double Correlation(size_t i, size_t j) const;
+    double Correlation(const std::string& var1, const std::string& var2) const;
+    /**
+     * @brief Correlation between two variables before the fit
+     */
+    double CorrelationBefore(size_t i, size_t j) const;
+    double CorrelationBefore(const std::string& var1, const std::string& var2) const;
+
+    /**
+     * @brief FillCovariances fills Result_Variable_t::Covariances of all Variables
+     * @note needs O(N^2) map insertions, prefer the accessors above
+     */
+    void FillCovariances();
+  };
+
+  /**
+   * @brief The Batch_Input_t struct contains the input of many events for FitBatch
+   *
+   * The arrays are in structure-of-arrays layout, i.e. the entry of variable i
+   * (in the order of VariableNames()) for event n is stored at index i*NEvents+n.
+   * Sigmas and Covariances are optional, if empty the ones of the template instance are used.
+   * Covariances are the packed symmetric covariance matrices including the diagonal,
+   * element V_ij of event n at index V_ij*NEvents+n. If given, Sigmas must be empty.
+   */
+  struct Batch_Input_t {
+    size_t NEvents;
+    std::vector<double> Values;
+    std::vector<double> Sigmas;
+    std::vector<double> Covariances;
+  };
+
+  /**
+   * @brief The Batch_Result_t struct contains the results of FitBatch
+   *
+   * The per event arrays are indexed by the event number n, the per variable arrays
+   * use the same structure-of-arrays layout as Batch_Input_t.
+   */
+  struct Batch_Result_t {
+    std::string Name;
+    size_t NEvents;
+    std::vector<std::string> VariableNames;
+    int NScalarConstraints;
+    std::vector<Result_Status_t> Status;
+    std::vector<double> ChiSquare;
+    std::vector<int> NDoF;
+    std::vector<double> Probability;
+    std::vector<int> NIterations;
+    std::vector<int> NFunctionCalls;
+    std::vector<double> Values;
+    std::vector<double> Sigmas;
+    std::vector<double> Pulls;
+    std::vector<double> Covariances; /**< packed covariance matrices after fit, empty if SkipCovariancesInResult */
+  };
+
+  /**
+   * @brief The Compact_Result_t struct contains the result without any string-keyed maps
+   *
+   * The per variable arrays are indexed in the order of VariableNames(),
+   * the covariances are packed symmetric matrices including the diagonal,
+   * with element (i,j), i>=j, at index i*(i+1)/2+j.
+   * The map based view of Result_t is only built on request by Variables() or ToResult().
+   */
+  struct Compact_Result_t {
+    std::string Name;
+    Result_Status_t Status;
+    double ChiSquare;
+    int NDoF;
+    double Probability;
+    int NIterations;
+    int NFunctionCalls;
+    int NScalarConstraints;
+    std::shared_ptr<const Result_Table_t> Table;
+    std::vector<double> ValuesBefore;
+    std::vector<double> Values;
+    std::vector<double> SigmasBefore;
+    std::vector<double> Sigmas;
+    std::vector<double> Pulls;
+    std::vector<double> CovariancesBefore; /**< packed, empty if SkipCovariancesInResult */
+    std::vector<double> Covariances;       /**< packed, empty if SkipCovariancesInResult */
+    Result_Statistics_t Statistics;
+
+    /**
+     * @brief Index of the variable, as used by the arrays above
+     * @param varname name of the variable, appended with [i] if non-scalar
+     * @return index, throws Error if not found
+     */
+    size_t Index(const std::string& varname) const;
+    /**
+     * @brief Variables builds the map of Result_t::Variables
+     * @return variables by name, without covariances (see Result_t::FillCovariances)
+     */
+    std::map<std::string, Result_Variable_t> Variables() const;
+    /**
+     * @brief ToResult builds the full Result_t
+     * @return the same as DoFit() would return
+     */
+    Result_t ToResult() const;
   };
 
   /**
@@ -151,7 +369,6 @@ public:
          const Fit_Settings_t& _fit_settings = Fit_Settings_t::Default) :
     instance_name(_name),
     initialized(false),
-    instance_id(++instance_counter),
     fit_settings(_fit_settings) {}
 
   /**
@@ -167,6 +384,8 @@ public:
   {
     instance_name = _name;
     fit_settings  = _fit_settings;
+    // the copied constraints are still bound to _old's storage
+    initialized   = false;
   }
 
   /**
@@ -216,6 +435,23 @@ public:
    */
   Result_t DoFit();
 
+  /**
+   * @brief Fit into a compact result, which avoids building the string-keyed maps of Result_t
+   * @param result filled with the result of the fit, its storage is reused
+   * @note the variables are copied back to linked storage as in DoFit()
+   */
+  void DoFit(Compact_Result_t& result);
+
+  /**
+   * @brief Fit many events with the variables and constraints of this instance
+   * @param input values (and optionally sigmas/covariances) for all events
+   * @param nThreads number of worker threads, 0 means std::thread::hardware_concurrency()
+   * @return the results of all events
+   * @note linked variables of this instance are neither read nor written by the batch fits
+   * @see AddLaneConstraint to fit several events at once in each thread
+   */
+  Batch_Result_t FitBatch(const Batch_Input_t& input, unsigned nThreads = 0);
+
   /**
    * @brief Add measured variable to fitter with given sigma, internally stored
    * @see LinkVariable for linking externally stored values
@@ -325,6 +561,10 @@ public:
    * @param name unique label for the constraint
    * @param varnames variable names the constraint should act on
    * @param constraint lambda function taking varnames size double arguments, and return double. Should vanish if fulfilled.
+   * @note Functors with a templated call operator, like template<typename T> T operator()(const T& a, const T& b) const,
+   * or taking const std::vector<T>& arguments, are differentiated automatically. They are called with
+   * double's for the constraint value, and with dual numbers for the derivatives.
+   * Use unqualified sqrt, pow, etc. in the body (with "using std::sqrt;") to support both.
    */
   template<typename Functor>
   void AddConstraint(const std::string& name,
@@ -333,52 +573,97 @@ public:
   {
     CheckMapKey("Constraint", name, constraints);
 
-    // define shortcut, but need "typedef", not "using" for older gcc versions...
-    typedef APLCON_::function_traits<Functor> trait;
+    // generic functors can't be analyzed by function_traits,
+    // so select the implementation before
+    constraints[name] = add_constraint(name, varnames, constraint, APLCON_::is_generic_functor<Functor>());
+    initialized = false;
+  }
 
-    // non functors are kind of hard to bind later in bind_constraint,
-    // so we forbid this here
-    static_assert(trait::is_functor, "Only functors are supported as constraints. Wrap and/or bind it if you want to pass such things.");
+  /**
+   * @brief Add named constraint together with its analytic derivatives
+   * @param name unique label for the constraint
+   * @param varnames variable names the constraint should act on
+   * @param constraint lambda function as for AddConstraint without derivatives
+   * @param derivative lambda function taking the same arguments as constraint.
+   * It returns the gradient as vector<double> if the constraint returns double,
+   * else the Jacobian as vector<vector<double>> with one row per returned constraint value.
+   * The entries of a row are the derivatives w.r.t. all values of the varnames, in this order.
+   * @note variables which are only used by constraints with derivatives are not numerically differentiated
+   */
+  template<typename Functor, typename Derivative>
+  void AddConstraint(const std::string& name,
+                     const std::vector<std::string>& varnames,
+                     const Functor& constraint,
+                     const Derivative& derivative)
+  {
+    static_assert(!APLCON_::is_generic_functor<Functor>::value, "Generic constraints are differentiated automatically, don't provide a derivative function.");
 
-    using r_type = typename trait::return_type;
+    // does all the checks for the constraint itself
+    AddConstraint(name, varnames, constraint);
 
-    // compile-time check if the Functor returns the proper type
-    constexpr bool returns_double = std::is_same<r_type, double >::value;
-    constexpr bool returns_vector = std::is_same<r_type, std::vector<double> >::value;
-    static_assert(returns_double || returns_vector, "Constraint function does not return double or vector<double>.");
+    typedef APLCON_::function_traits<Functor> trait;
+    typedef APLCON_::function_traits<Derivative> d_trait;
 
-    // compile-time check if the Function wants only double's, or only vector of double's
-    // both bool's can never be true at the same time,
-    // so we require an exclusive or
-    constexpr size_t n = trait::arity; // number of arguments in Functor
-    constexpr bool wants_double = trait::template all_args<double>::value;
-    constexpr bool wants_vector = trait::template all_args< std::vector<double> >::value;
-    constexpr bool wants_matrix = n==1 && trait::template all_args< std::vector< std::vector<double> > >::value;
-    static_assert(wants_double + wants_vector + wants_matrix == 1,
-                  "Constraint function does not either take double's, or vector<double>'s, or single vector<vector<double>> (matrix) as argument(s).");
+    static_assert(d_trait::is_functor, "Only functors are supported as derivatives. Wrap and/or bind it if you want to pass such things.");
 
+    using r_type = typename d_trait::return_type;
+    constexpr bool returns_gradient = std::is_same<r_type, std::vector<double> >::value;
+    constexpr bool returns_jacobian = std::is_same<r_type, std::vector< std::vector<double> > >::value;
+    static_assert(returns_gradient || returns_jacobian, "Derivative function does not return vector<double> or vector<vector<double>>.");
 
-    // runtime check if given variable number matches to Functor
-    if(!wants_matrix && varnames.size() != n) {
-      std::stringstream msg;
-      msg << "Constraint '" << name << "': Function argument number (" << n <<
-             ") does not match the number of provided varnames (" << varnames.size() << ")";
-      throw Error(msg.str());
-    }
+    // the derivative must take exactly the same arguments as the constraint
+    constexpr size_t n = trait::arity;
+    constexpr bool wants_double = trait::template all_args<double>::value;
+    constexpr bool wants_vector = trait::template all_args< std::vector<double> >::value;
+    static_assert(d_trait::arity == n &&
+                  d_trait::template all_args<double>::value == wants_double &&
+                  d_trait::template all_args< std::vector<double> >::value == wants_vector,
+                  "Derivative function does not take the same arguments as the constraint function.");
 
-    // the flag wants_double and returns_double select the corresponding bind_constraint
-    // implementation
-    const auto& bound = bind_constraint<returns_double>
+    constraints[name].Derivative = bind_constraint< APLCON_::jacobian_if<returns_gradient> >
         (std::enable_if<wants_double>(),
          std::enable_if<wants_vector>(),
-         constraint, APLCON_::build_indices<n>{});
+         derivative, APLCON_::build_indices<n>{});
+  }
 
-    constraints[name] = {varnames, bound, wants_double, 0};
-    initialized = false;
+  /**
+   * @brief Add a generic constraint, which FitBatch evaluates for several events at once
+   * @param name unique label for the constraint
+   * @param varnames names of scalar variables the constraint acts on
+   * @param constraint functor with a templated call operator taking double's and returning a double,
+   * as for AddConstraint. FitBatch also calls it with APLCON_::Lanes and APLCON_::DualLanes holding the
+   * values of Fit_Settings_t::BatchLanes events, so it must not compare or branch on its arguments.
+   * @note FitBatch only fits events at once with the Native engine, if all constraints were added
+   * this way and all variables are Gaussian, where fixed variables must be measured. An event which
+   * differs from this instance in its (un)measured variables is fitted on its own.
+   */
+  template<typename Functor>
+  void AddLaneConstraint(const std::string& name,
+                         const std::vector<std::string>& varnames,
+                         const Functor& constraint)
+  {
+    static_assert(APLCON_::is_generic_functor<Functor>::value, "Lane constraints need a templated call operator.");
+    constexpr size_t n = APLCON_::generic_arity<Functor, double>::value;
+    static_assert(n>0, "Lane constraints must be callable with double's.");
+    using r_type = typename std::decay<typename APLCON_::call_traits<Functor, double,
+                   decltype(APLCON_::as_indices(APLCON_::build_indices<n>{}))>::return_type>::type;
+    static_assert(std::is_same<r_type, double>::value, "Lane constraints must return a double.");
+
+    // does all the checks for the constraint itself
+    AddConstraint(name, varnames, constraint);
+
+    constraints[name].Lanes = [constraint] (const double* x, const size_t* index, size_t lanes,
+                                             double* out, double* gradient) {
+      if(lanes == 8)
+        APLCON_::call_lanes<8>(constraint, x, index, out, gradient, APLCON_::build_indices<n>{});
+      else
+        APLCON_::call_lanes<4>(constraint, x, index, out, gradient, APLCON_::build_indices<n>{});
+    };
   }
 
   // shortcuts for double limits (used in default values for methods above)
   constexpr static double NaN = std::numeric_limits<double>::quiet_NaN(); /**< short cut for NaN value */
+  constexpr static unsigned AllThreads = std::numeric_limits<unsigned>::max(); /**< DerivativeThreads for all hardware threads */
   static std::vector<Variable_Settings_t> DefaultSettings; /**< short cut for empty variable settings */
 
   /**
@@ -389,6 +674,13 @@ public:
     explicit Error(const std::string& msg) : runtime_error(msg) {}
   };
 
+  /**
+   * @brief Static fits NVar scalar variables with NCon scalar constraints fixed at compile time,
+   * see detail/APLCON_static.hpp
+   */
+  template<std::size_t NVar, std::size_t NCon, typename Constraints>
+  class Static;
+
   /**
    * @brief The PrintFormatting struct tunes the output of ostream<< operators for APLCON::Result_t
    */
@@ -420,11 +712,24 @@ private:
     std::vector<size_t> V_ij; // for sigmas, see also covariance_t
   };
 
+  // the bound constraint functions read their arguments as spans over X,
+  // and write at most n values into the given slice out (of F),
+  // but they always return the number of values they've got
+  typedef std::vector<APLCON_::span> arguments_t;
+  typedef std::function< size_t (const arguments_t&, double* out, size_t n) > constraint_function_t;
+  // the lane functions read argument k of lane l at x[index[k]*lanes+l], see APLCON_::call_lanes
+  typedef std::function< void (const double* x, const size_t* index, size_t lanes,
+                               double* out, double* gradient) > lane_function_t;
+
   struct constraint_t {
     std::vector<std::string> VariableNames;
-    std::function< std::vector<double> (const std::vector< std::vector<const double*> >&)> Function;
+    constraint_function_t Function;
     bool WantsDouble; // true if Function takes single double as all arguments (set by AddConstraint)
     size_t Number;    // number of represented scalar constraints, set by Init
+    // optional analytic derivatives, writing one row of the Jacobian per scalar constraint
+    constraint_function_t Derivative;
+    // optional, set by AddLaneConstraint
+    lane_function_t Lanes;
   };
 
   // since a variable can represent multiple values
@@ -445,7 +750,7 @@ private:
   covariances_t covariances;
   // the constraints
   // a constraint has a list of variable names and
-  // a corresponding "vectorized" function evaluated on pointers to double
+  // a corresponding "vectorized" function evaluated on spans over X
   std::map<std::string, constraint_t> constraints;
   int nConstraints; // number of double-valued equations, finally determined in Init()
 
@@ -453,24 +758,97 @@ private:
   // X values, V covariances, F constraints
   // and some helper variables
   std::vector<double> X, V, F, V_before;
-  std::vector< std::function<std::vector<double>()> > F_func;
+  // F_func write the values of each constraint into its slice of F,
+  // so evaluating them does not allocate anything
+  typedef std::vector< std::function<size_t(double*, size_t)> > bound_functions_t;
+  bound_functions_t F_func;
+  // analytic derivatives, bound like F_func (but might be empty),
+  // the indices in X of their arguments, and the variables
+  // which APLCON should not differentiate numerically (counting from 1)
+  bound_functions_t J_func;
+  std::vector< std::vector<size_t> > J_indices;
+  // the slice of each constraint in F (with the end of F appended),
+  // and the constraints depending on each value in X,
+  // which is saved to X_center while it is displaced
+  std::vector<size_t> F_offsets;
+  std::vector< std::vector<size_t> > X_constraints;
+  std::vector<double> X_center;
+  std::vector<int> analytic_variables;
+  std::vector<double> J_row, J_values;
+  // workspace of APLCON, sized in Init()
+  std::vector<double> AUX;
+  // names of the variables and constraints, built in Init()
+  std::shared_ptr<const Result_Table_t> result_table;
+  // the native engine, set up in Init()
+  APLCON_::Solver solver;
+  // fitted values of the last converged fit, see WarmStart_t::Unmeasured
+  std::vector<double> X_warm;
+  // copies of X with the constraints bound to them,
+  // one for each thread of Fit_Settings_t::DerivativeThreads,
+  // and the threads evaluating the points on them, both set up in Init()
+  // (the copies of FitBatch start without threads, so they evaluate all points themselves)
+  struct derivative_worker_t {
+    std::vector<double> X;
+    bound_functions_t F_func;
+  };
+  std::vector<derivative_worker_t> derivative_workers;
+  APLCON_::ThreadPool derivative_threads;
+  // copies of this instance fitting the events of FitBatch, and the threads running them,
+  // kept across calls until Init() rebuilds this instance (a copy of it starts without them)
+  struct batch_workers_t {
+    std::vector< std::unique_ptr<APLCON> > Copies;
+    APLCON_::ThreadPool Threads;
+    batch_workers_t() = default;
+    batch_workers_t(const batch_workers_t&) : batch_workers_t() {}
+  };
+  batch_workers_t batch_workers;
 
-  // since APLCON is stateful, multiple instances of this class
-  // need to init APLCON again after switching between them
-  // However, when always the same instance is run, we don't need
-  // to init APLCON
+  // APLCON keeps its state thread-local, and it is fully initialized
+  // at the beginning of each DoFit(), so independent instances can be fitted
+  // concurrently in different threads.
+  // However, the storage above only needs to be rebuilt if this
+  // instance was changed since the last fit
   std::string instance_name;
   bool initialized;
-  static int instance_counter; // global instance counter (never decremented)
-  static int instance_lastfit; // save last instance id
-  int instance_id;
 
   // global APLCON settings
   Fit_Settings_t fit_settings;
 
   // private methods
   void Init();
+  void InitWorkspace();
+  void InitSolver();
+  static APLCON_::Solver::Settings_t SolverSettings(const Fit_Settings_t& fit_settings);
+  static APLCON_::Solver::Variable_t SolverVariable(const Variable_Settings_t& settings);
   void InitAPLCON();
+  void BindConstraints();
+  Result_Status_t RunFit(Result_Statistics_t* stats = nullptr);
+  void FillResult(Compact_Result_t& result);
+  void BuildResultTable();
+  void EvaluateConstraints();
+  void EvaluateConstraints(const bound_functions_t& f_func, double* f) const;
+  void EvaluateConstraint(const bound_functions_t& f_func, size_t i, double* out) const;
+  void EvaluatePoints(const double* x, const size_t* columns, const double* values,
+                      const size_t* offsets, size_t n, double* const* f);
+  void SetJacobianRows();
+
+  // fit statistics from the engine after RunFit()
+  struct statistics_t {
+    double ChiSquare;
+    int NDoF;
+    double Probability;
+    int NIterations;
+    int NFunctionCalls;
+  };
+  statistics_t GetStatistics(double* pulls) const;
+  // the parts of FitBatch, see APLCON.cc
+  void LoadEvent(const Batch_Input_t& input, size_t n, double* x, double* v) const;
+  void StoreEvent(Batch_Result_t& result, size_t n, Result_Status_t status, const statistics_t& stats,
+                  const double* x, const double* v, const double* pulls, double* variances) const;
+  void FitEvent(const Batch_Input_t& input, size_t n, Batch_Result_t& result,
+                double* pulls, double* variances);
+  template<size_t L>
+  void FitLanes(const Batch_Input_t& input, Batch_Result_t& result, const std::function<size_t()>& next_event);
   void AddVariable(const std::string& name, const double value, const double sigma,
                    const APLCON::Variable_Settings_t& settings);
 
@@ -507,10 +885,109 @@ private:
   // define the two different constraint binding functions
   // which are selected on compile-time via their first two arguments
 
+  // add_constraint builds the constraint_t for AddConstraint,
+  // for the usual functors and lambdas the arguments are found via function_traits
+  template<typename Functor>
+  constraint_t add_constraint(const std::string& name,
+                              const std::vector<std::string>& varnames,
+                              const Functor& constraint,
+                              std::false_type // not generic
+                              ) const
+  {
+    // define shortcut, but need "typedef", not "using" for older gcc versions...
+    typedef APLCON_::function_traits<Functor> trait;
+
+    // non functors are kind of hard to bind later in bind_constraint,
+    // so we forbid this here
+    static_assert(trait::is_functor, "Only functors are supported as constraints. Wrap and/or bind it if you want to pass such things.");
+
+    using r_type = typename trait::return_type;
+
+    // compile-time check if the Functor returns the proper type
+    constexpr bool returns_double = std::is_same<r_type, double >::value;
+    constexpr bool returns_vector = std::is_same<r_type, std::vector<double> >::value;
+    static_assert(returns_double || returns_vector, "Constraint function does not return double or vector<double>.");
+
+    // compile-time check if the Function wants only double's, or only vector of double's
+    // both bool's can never be true at the same time,
+    // so we require an exclusive or
+    constexpr size_t n = trait::arity; // number of arguments in Functor
+    constexpr bool wants_double = trait::template all_args<double>::value;
+    constexpr bool wants_vector = trait::template all_args< std::vector<double> >::value;
+    constexpr bool wants_matrix = n==1 && trait::template all_args< std::vector< std::vector<double> > >::value;
+    static_assert(wants_double + wants_vector + wants_matrix == 1,
+                  "Constraint function does not either take double's, or vector<double>'s, or single vector<vector<double>> (matrix) as argument(s).");
+
+
+    // runtime check if given variable number matches to Functor
+    if(!wants_matrix && varnames.size() != n) {
+      std::stringstream msg;
+      msg << "Constraint '" << name << "': Function argument number (" << n <<
+             ") does not match the number of provided varnames (" << varnames.size() << ")";
+      throw Error(msg.str());
+    }
+
+    // the flag wants_double and returns_double select the corresponding bind_constraint
+    // implementation
+    const auto& bound = bind_constraint< APLCON_::vectorize_if<returns_double> >
+        (std::enable_if<wants_double>(),
+         std::enable_if<wants_vector>(),
+         constraint, APLCON_::build_indices<n>{});
+
+    return {varnames, bound, wants_double, 0, {}, {}};
+  }
+
+  // generic functors are probed with double's first, then with vector<double>'s,
+  // then with a single matrix. The derivatives are obtained by calling them with dual numbers
+  template<typename Functor>
+  constraint_t add_constraint(const std::string& name,
+                              const std::vector<std::string>& varnames,
+                              const Functor& constraint,
+                              std::true_type // generic
+                              ) const
+  {
+    using matrix_t = std::vector< std::vector<double> >;
+    constexpr size_t n_double = APLCON_::generic_arity<Functor, double>::value;
+    constexpr size_t n_vector = APLCON_::generic_arity<Functor, const std::vector<double>&>::value;
+    constexpr bool wants_double = n_double>0;
+    constexpr bool wants_vector = !wants_double && n_vector>0;
+    constexpr bool wants_matrix = !wants_double && !wants_vector &&
+                                  APLCON_::call_traits<Functor, const matrix_t&, APLCON_::indices<0> >::value;
+    static_assert(wants_double || wants_vector || wants_matrix,
+                  "Generic constraint function can neither be called with double's, nor vector<double>'s, nor single vector<vector<double>> (matrix) as argument(s).");
+
+    constexpr size_t n = wants_double ? n_double : wants_vector ? n_vector : 1;
+    using arg_type = typename std::conditional<wants_double, double,
+                     typename std::conditional<wants_vector, const std::vector<double>&, const matrix_t&>::type>::type;
+    using r_type = typename std::decay<typename APLCON_::call_traits<Functor, arg_type,
+                   decltype(APLCON_::as_indices(APLCON_::build_indices<n>{}))>::return_type>::type;
+
+    constexpr bool returns_double = std::is_same<r_type, double >::value;
+    constexpr bool returns_vector = std::is_same<r_type, std::vector<double> >::value;
+    static_assert(returns_double || returns_vector, "Generic constraint function does not return double or vector<double> when called with double's.");
+
+    if(!wants_matrix && varnames.size() != n) {
+      std::stringstream msg;
+      msg << "Constraint '" << name << "': Function argument number (" << n <<
+             ") does not match the number of provided varnames (" << varnames.size() << ")";
+      throw Error(msg.str());
+    }
+
+    const auto& bound = bind_constraint< APLCON_::vectorize_if<returns_double> >
+        (std::enable_if<wants_double>(),
+         std::enable_if<wants_vector>(),
+         constraint, APLCON_::build_indices<n>{});
+    const auto& derivative = bind_derivative
+        (std::enable_if<wants_double>(),
+         std::enable_if<wants_vector>(),
+         constraint, APLCON_::build_indices<n>{});
+    return {varnames, bound, wants_double, 0, derivative, {}};
+  }
+
   // the basic idea is to "vectorize" the given constraint function f to fv
   // by defining a lambda fv which is std::bind'ed to the original f
-  // then fv can be called on vectors containing pointers to the values
-  // on which the constraint should be evaluated
+  // then fv can be called on spans over X containing the values
+  // on which the constraint should be evaluated, and stores the result in F
   // see DoFit/Init methods how those arguments for the returned function are constructed
 
   // is it complicated by the fact that f may return scalar/vector and may want scalar/vector
@@ -518,59 +995,89 @@ private:
   // depending on the compile-time analysis of f in AddConstraint. This must be templated because
   // otherwise the compiler evaluates the wrong f call
 
-  using constraint_function_t = std::function< std::vector<double> (const std::vector< std::vector<const double*> >&)>;
+  // the Wrap type is either APLCON_::vectorize_if for the constraints itself,
+  // or APLCON_::jacobian_if for their derivatives
 
-  template <bool R, typename F, size_t... I>
+  template <typename Wrap, typename F, size_t... I>
   constraint_function_t
   bind_constraint(std::enable_if<true>,  // wants double
                   std::enable_if<false>, // does not want vector
                   const F& f, APLCON_::indices<I...>) const {
-    return [f] (const std::vector< std::vector<const double*> >& x) -> std::vector<double> {
-      // dereference the single element inside the inner vector
-      // return vector with single element
-      return APLCON_::vectorize_if<R>::get(f(*(x[I][0])...));
+    return [f] (const arguments_t& x, double* out, size_t n) -> size_t {
+      // take the single element of each span
+      return Wrap::put(f(x[I][0]...), out, n);
     };
   }
 
-  template <bool R, typename F, size_t... I>
+  template <typename Wrap, typename F, size_t... I>
   constraint_function_t
   bind_constraint(std::enable_if<false>, // does not want double
                   std::enable_if<true>,  // wants vector
                   const F& f, APLCON_::indices<I...>) const {
-    return [f] (const std::vector< std::vector<const double*> >& x) -> std::vector<double> {
-      // this might be a little bit inefficient,
-      // since we need to allocate the space for the dereferenced double values
-      // but well, the constraints then look easier
-      std::vector< std::vector<double> > x_(sizeof...(I));
-      for(size_t i=0;i<sizeof...(I);i++) {
-        x_[i].resize(x[i].size());
-        std::transform(x[i].begin(), x[i].end(),
-                       x_[i].begin(),
-                       [] (const double* v) { return *v; }
-        );
-      }
-      return APLCON_::vectorize_if<R>::get(f(x_[I]...));
+    // the values are copied to the buffer x_ owned by the lambda,
+    // which is only allocated at the first call (done by Init)
+    std::vector< std::vector<double> > x_(sizeof...(I));
+    return [f, x_] (const arguments_t& x, double* out, size_t n) mutable -> size_t {
+      for(size_t i=0;i<sizeof...(I);i++)
+        x_[i].assign(x[i].begin(), x[i].end());
+      return Wrap::put(f(x_[I]...), out, n);
     };
   }
 
-  template <bool R, typename F, size_t... I>
+  template <typename Wrap, typename F, size_t... I>
   constraint_function_t
   bind_constraint(std::enable_if<false>, // does not want double
                   std::enable_if<false>, // does not want vector, so wants matrix!
                   const F& f, APLCON_::indices<I...>) const {
-    return [f] (const std::vector< std::vector<const double*> >& x) -> std::vector<double> {
-      // this might be a little bit inefficient,
-      // since we need to allocate the space for the dereferenced double values
-      // but well, the constraints then look easier
-      std::vector< std::vector<double> > x_(x.size());
-      for(size_t i=0;i<x.size();i++) {
-        x_[i].resize(x[i].size());
-        std::transform(x[i].begin(), x[i].end(),
-                       x_[i].begin(),
-                       [] (const double* v) { return *v; }
-        );
-      }
-      return APLCON_::vectorize_if<R>::get(f(x_));
+    // same buffering as for vectors
+    std::vector< std::vector<double> > x_;
+    return [f, x_] (const arguments_t& x, double* out, size_t n) mutable -> size_t {
+      x_.resize(x.size());
+      for(size_t i=0;i<x.size();i++)
+        x_[i].assign(x[i].begin(), x[i].end());
+      return Wrap::put(f(x_), out, n);
+    };
+  }
+
+  // same for generic functors, but called with dual numbers
+  // to obtain the rows of the Jacobian. For double arguments, the gradient
+  // has the size of the arity, otherwise the duals are buffered like the vectors
+  // and f is called once per chunk of APLCON_::dual_chunk values
+
+  template <typename F, size_t... I>
+  constraint_function_t
+  bind_derivative(std::enable_if<true>,  // wants double
+                  std::enable_if<false>, // does not want vector
+                  const F& f, APLCON_::indices<I...>) const {
+    return [f] (const arguments_t& x, double* out, size_t n) -> size_t {
+      using dual_t = APLCON_::Dual<sizeof...(I)>;
+      return APLCON_::put_jacobian(f(dual_t(x[I][0], I)...), 0, sizeof...(I), out, n);
+    };
+  }
+
+  template <typename F, size_t... I>
+  constraint_function_t
+  bind_derivative(std::enable_if<false>, // does not want double
+                  std::enable_if<true>,  // wants vector
+                  const F& f, APLCON_::indices<I...>) const {
+    APLCON_::dual_buffer_t x_;
+    return [f, x_] (const arguments_t& x, double* out, size_t n) mutable -> size_t {
+      return APLCON_::put_jacobian_chunks(x, x_, [&f] (const APLCON_::dual_buffer_t& duals) {
+        return f(duals[I]...);
+      }, out, n);
+    };
+  }
+
+  template <typename F, size_t... I>
+  constraint_function_t
+  bind_derivative(std::enable_if<false>, // does not want double
+                  std::enable_if<false>, // does not want vector, so wants matrix!
+                  const F& f, APLCON_::indices<I...>) const {
+    APLCON_::dual_buffer_t x_;
+    return [f, x_] (const arguments_t& x, double* out, size_t n) mutable -> size_t {
+      return APLCON_::put_jacobian_chunks(x, x_, [&f] (const APLCON_::dual_buffer_t& duals) {
+        return f(duals);
+      }, out, n);
     };
   }
 
@@ -586,4 +1093,6 @@ std::ostream& operator<< (std::ostream&, const APLCON::Distribution_t&);
 std::ostream& operator<< (std::ostream&, const APLCON::Result_Status_t&);
 std::ostream& operator<< (std::ostream&, const APLCON::Result_t&);
 
+#include "detail/APLCON_static.hpp"
+
 #endif // APLCON_HPP
@@ -0,0 +1,82 @@
+#include "detail/APLCON_kernels.hpp"
+
+#include <initializer_list>
+
+using namespace APLCON_;
+
+// each variant includes the same loops, compiled with -ffp-contract=off (see CMakeLists.txt)
+
+namespace {
+
+namespace generic {
+#include "detail/APLCON_kernels_loops.hpp"
+}
+
+const Kernels_t generic_kernels = {
+  Kernels_t::ISA_t::Default,
+  generic::dot, generic::axpy, generic::scale, generic::diagonal, generic::scale_symmetric,
+  generic::multiply_av, generic::multiply_abt
+};
+
+#if defined(__x86_64__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+#include "detail/APLCON_kernels_loops.hpp"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,prefer-vector-width=512")
+namespace avx512 {
+#include "detail/APLCON_kernels_loops.hpp"
+}
+#pragma GCC pop_options
+
+const Kernels_t avx2_kernels = {
+  Kernels_t::ISA_t::AVX2,
+  avx2::dot, avx2::axpy, avx2::scale, avx2::diagonal, avx2::scale_symmetric,
+  avx2::multiply_av, avx2::multiply_abt
+};
+
+const Kernels_t avx512_kernels = {
+  Kernels_t::ISA_t::AVX512,
+  avx512::dot, avx512::axpy, avx512::scale, avx512::diagonal, avx512::scale_symmetric,
+  avx512::multiply_av, avx512::multiply_abt
+};
+
+#endif
+
+} // namespace
+
+const Kernels_t* APLCON_::KernelsFor(Kernels_t::ISA_t isa)
+{
+  switch(isa) {
+  case Kernels_t::ISA_t::Default:
+    return &generic_kernels;
+#if defined(__x86_64__)
+  case Kernels_t::ISA_t::AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &avx2_kernels : nullptr;
+  case Kernels_t::ISA_t::AVX512:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") ? &avx512_kernels : nullptr;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const Kernels_t& APLCON_::Kernels()
+{
+  static const Kernels_t& kernels = [] () -> const Kernels_t& {
+    for(auto isa : {Kernels_t::ISA_t::AVX512, Kernels_t::ISA_t::AVX2}) {
+      const Kernels_t* k = KernelsFor(isa);
+      if(k != nullptr)
+        return *k;
+    }
+    return generic_kernels;
+  }();
+  return kernels;
+}
@@ -0,0 +1,544 @@
+#include "detail/APLCON_lanes.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace APLCON_;
+
+namespace {
+
+// index of element (i,j) in packed symmetric matrix, starting at 0
+inline size_t ijsym(size_t i, size_t j) {
+  return i>j ? i*(i+1)/2 + j : j*(j+1)/2 + i;
+}
+
+} // namespace
+
+template<size_t L>
+void LaneSolver<L>::Init(const vector<bool>& measured, const vector<bool>& fixed_, size_t nF_,
+                         const Solver::Settings_t& settings_)
+{
+  nX = measured.size();
+  nF = nF_;
+  fixed = fixed_;
+  settings = settings_;
+  M.clear();
+  U.clear();
+  for(size_t i=0;i<nX;i++)
+    (measured[i] ? M : U).push_back(i);
+  nM = M.size();
+  nU = U.size();
+  ndf = int(nF)-int(nU);
+
+  const size_t nV = (nX*nX+nX)/2;
+  X.assign(nX*L, 0);
+  V.assign(nV*L, 0);
+  F.assign(nF*L, 0);
+  XS.assign(nX*L, 0);
+  DX.assign(nX*L, 0);
+  XP.assign(nX*L, 0);
+  A.assign(nF*nX*L, 0);
+  AJ.assign(nF*nX*L, 0);
+  pulls.assign(nX*L, 0);
+  R.assign(nF*L, 0);
+  Y.assign(nM*nF*L, 0);
+  S.assign((nF*nF+nF)/2*L, 0);
+  AU.assign(nU*nF*L, 0);
+  KM.assign((nU*nU+nU)/2*L, 0);
+  TX.assign(nX*L, 0);
+  TF.assign(nF*L, 0);
+  TU.assign(nU*L, 0);
+  D.assign(nU*L, 0);
+  TY.assign(nM*nF*L, 0);
+  TG.assign(nM*nU*L, 0);
+  VF.assign(nV*L, 0);
+  for(size_t l=0;l<L;l++)
+    state[l] = State_t::Empty;
+}
+
+template<size_t L>
+bool LaneSolver<L>::Load(size_t l, const double* X_, const double* V_)
+{
+  // the measured variables define the equation system, see SetSteps
+  for(size_t m : M) {
+    if(V_[ijsym(m,m)] == 0)
+      return false;
+  }
+  for(size_t u : U) {
+    if(V_[ijsym(u,u)] != 0)
+      return false;
+  }
+
+  for(size_t i=0;i<nX;i++) {
+    X[i*L+l] = X_[i];
+    DX[i*L+l] = 0;
+    XP[i*L+l] = 0;
+    pulls[i*L+l] = 0;
+  }
+  const size_t nV = (nX*nX+nX)/2;
+  for(size_t k=0;k<nV;k++)
+    V[k*L+l] = V_[k];
+  for(size_t u : U) {
+    for(size_t j=0;j<nX;j++)
+      V[ijsym(u,j)*L+l] = 0;
+  }
+
+  state[l] = State_t::Start;
+  status[l] = -1;
+  iter[l] = 0;
+  ncst[l] = 0;
+  ncalls[l] = 0;
+  chisq[l] = 0;
+  chsqp[l] = 0;
+  ftest[l] = 0;
+  ftestp[l] = 0;
+  weight[l] = 1;
+  return true;
+}
+
+template<size_t L>
+bool LaneSolver<L>::Running() const
+{
+  for(size_t l=0;l<L;l++) {
+    if(state[l] == State_t::Start || state[l] == State_t::Running)
+      return true;
+  }
+  return false;
+}
+
+template<size_t L>
+void LaneSolver<L>::Result(size_t l, double* X_, double* V_, double* pulls_) const
+{
+  for(size_t i=0;i<nX;i++) {
+    X_[i] = X[i*L+l];
+    pulls_[i] = pulls[i*L+l];
+  }
+  const size_t nV = (nX*nX+nX)/2;
+  for(size_t k=0;k<nV;k++)
+    V_[k] = V[k*L+l];
+}
+
+template<size_t L>
+void LaneSolver<L>::Iterate(const evaluate_t& evaluate, const jacobian_t& jacobian)
+{
+  // one pass of the loop in Solver::Fit for each running lane
+  evaluate(X.data(), F.data());
+
+  bool any_finish = false;
+  bool any_next = false;
+  for(size_t l=0;l<L;l++) {
+    finish[l] = false;
+    next[l] = false;
+    if(state[l] != State_t::Start && state[l] != State_t::Running)
+      continue;
+    ncalls[l]++;
+
+    // constraint test summary
+    ftestp[l] = ftest[l];
+    double sum = 0;
+    for(size_t j=0;j<nF;j++)
+      sum += abs(F[j*L+l]);
+    ftest[l] = max(1.0e-16, sum/nF); // average |F|
+
+    if(state[l] == State_t::Start) {
+      for(size_t i=0;i<nX;i++)
+        XS[i*L+l] = X[i*L+l];
+      state[l] = State_t::Running;
+      next[l] = true;
+    }
+    else {
+      const int ret = TestConvergence(l);
+      if(ret >= 0) {
+        status[l] = ret;
+        finish[l] = true;
+      }
+      else if(ret == -2) {
+        // cutstep, only add the reduced corrections
+        AddToX(l);
+      }
+      else {
+        next[l] = true;
+      }
+    }
+    any_finish |= finish[l];
+    any_next |= next[l];
+  }
+
+  if(any_finish)
+    Finish();
+  if(!any_next)
+    return;
+
+  // new Jacobian for the lanes doing the next iteration, zero for fixed variables
+  jacobian(X.data(), AJ.data());
+  for(size_t j=0;j<nF;j++) {
+    for(size_t i=0;i<nX;i++) {
+      double* a = A.data()+(j*nX+i)*L;
+      const double* aj = AJ.data()+(j*nX+i)*L;
+      const bool fix = fixed[i];
+      for(size_t l=0;l<L;l++)
+        a[l] = next[l] ? (fix ? 0 : aj[l]) : a[l];
+    }
+  }
+  for(size_t l=0;l<L;l++) {
+    if(next[l])
+      ncalls[l]++;
+  }
+
+  NextIteration();
+}
+
+template<size_t L>
+int LaneSolver<L>::TestConvergence(size_t l)
+{
+  // see Solver::TestConvergence
+  if(ncst[l] < 2 && iter[l] > 1 && ftest[l] > 2*ftestp[l]+settings.ConstraintAccuracy) {
+    ncst[l]++;
+    weight[l] = 0.5;
+    return -2;
+  }
+  if(iter[l] >= 2 && ncst[l] == 0 &&
+     abs(chisq[l]-chsqp[l]) <= settings.Chi2Accuracy &&
+     ftest[l] < settings.ConstraintAccuracy)
+    return 0;
+  if(iter[l] > settings.MaxIterations)
+    return 2;
+  return -1;
+}
+
+template<size_t L>
+void LaneSolver<L>::AddToX(size_t l)
+{
+  // see ADDTOX, without transformations
+  const double w = weight[l];
+  for(size_t i=0;i<nX;i++) {
+    double& dx = DX[i*L+l];
+    dx = w*dx+(1-w)*XP[i*L+l];
+    X[i*L+l] = XS[i*L+l]+dx;
+  }
+}
+
+template<size_t L>
+void LaneSolver<L>::NextIteration()
+{
+  // see ANITER, the system is solved for all lanes, but only
+  // the lanes doing the next iteration take the solution
+  for(size_t l=0;l<L;l++)
+    failed[l] = false;
+
+  // right-hand side of equation
+  for(size_t j=0;j<nF;j++) {
+    double* r = R.data()+j*L;
+    for(size_t l=0;l<L;l++)
+      r[l] = -F[j*L+l];
+    for(size_t i=0;i<nX;i++) {
+      const double* a = A.data()+(j*nX+i)*L;
+      const double* dx = DX.data()+i*L;
+      for(size_t l=0;l<L;l++)
+        r[l] += a[l]*dx[l];
+    }
+  }
+
+  // Y = A*V, column by column of the measured variables, and S = Y*A^T
+  fill(Y.begin(), Y.end(), 0);
+  for(size_t m=0;m<nM;m++) {
+    double* y = Y.data()+m*nF*L;
+    for(size_t k=0;k<nM;k++) {
+      const double* v = V.data()+ijsym(M[m],M[k])*L;
+      for(size_t j=0;j<nF;j++) {
+        const double* a = A.data()+(j*nX+M[k])*L;
+        for(size_t l=0;l<L;l++)
+          y[j*L+l] += v[l]*a[l];
+      }
+    }
+  }
+  for(size_t j=0;j<nF;j++) {
+    for(size_t k=0;k<=j;k++) {
+      double* s = S.data()+((j*j+j)/2+k)*L;
+      fill(s, s+L, 0);
+      for(size_t m=0;m<nM;m++) {
+        const double* y = Y.data()+(m*nF+j)*L;
+        const double* a = A.data()+(k*nX+M[m])*L;
+        for(size_t l=0;l<L;l++)
+          s[l] += y[l]*a[l];
+      }
+    }
+  }
+  // add A_u*D*A_u^T with D of the size of S over A_u^2 for each unmeasured variable,
+  // which keeps the solution, but makes S positive definite with more constraints
+  // than measured variables (then the covariance of the unmeasured variables is
+  // KM^-1-D, see Finish)
+  double trace[L];
+  fill(trace, trace+L, 0);
+  for(size_t j=0;j<nF;j++) {
+    const double* s = S.data()+((j*j+j)/2+j)*L;
+    for(size_t l=0;l<L;l++)
+      trace[l] += s[l];
+  }
+  for(size_t u=0;u<nU;u++) {
+    double* d = D.data()+u*L;
+    fill(d, d+L, 0);
+    for(size_t j=0;j<nF;j++) {
+      const double* a = A.data()+(j*nX+U[u])*L;
+      for(size_t l=0;l<L;l++)
+        d[l] += a[l]*a[l];
+    }
+    for(size_t l=0;l<L;l++)
+      d[l] = d[l] > 0 ? (trace[l] > 0 ? trace[l] : 1)/d[l] : 1;
+    for(size_t j=0;j<nF;j++) {
+      const double* aj = A.data()+(j*nX+U[u])*L;
+      for(size_t k=0;k<=j;k++) {
+        const double* ak = A.data()+(k*nX+U[u])*L;
+        double* s = S.data()+((j*j+j)/2+k)*L;
+        for(size_t l=0;l<L;l++)
+          s[l] += aj[l]*d[l]*ak[l];
+      }
+    }
+  }
+  Decompose(S.data(), nF);
+
+  // AU = L^-1*A_u, and L^-1*R in TF
+  for(size_t u=0;u<nU;u++) {
+    double* au = AU.data()+u*nF*L;
+    for(size_t j=0;j<nF;j++)
+      copy_n(A.data()+(j*nX+U[u])*L, L, au+j*L);
+    SolveLower(S.data(), nF, au);
+  }
+  copy(R.begin(), R.end(), TF.begin());
+  SolveLower(S.data(), nF, TF.data());
+
+  // the unmeasured corrections from AU^T*AU*x = AU^T*L^-1*R into TU
+  for(size_t u=0;u<nU;u++) {
+    const double* au = AU.data()+u*nF*L;
+    for(size_t v=0;v<=u;v++) {
+      const double* av = AU.data()+v*nF*L;
+      double* km = KM.data()+((u*u+u)/2+v)*L;
+      fill(km, km+L, 0);
+      for(size_t j=0;j<nF;j++) {
+        for(size_t l=0;l<L;l++)
+          km[l] += au[j*L+l]*av[j*L+l];
+      }
+    }
+    double* t = TU.data()+u*L;
+    fill(t, t+L, 0);
+    for(size_t j=0;j<nF;j++) {
+      for(size_t l=0;l<L;l++)
+        t[l] += au[j*L+l]*TF[j*L+l];
+    }
+  }
+  if(nU > 0) {
+    Decompose(KM.data(), nU);
+    SolveLower(KM.data(), nU, TU.data());
+    SolveUpper(KM.data(), nU, TU.data());
+  }
+
+  // the multipliers S^-1*(R-A_u*x) into TF, and the measured corrections Y^T*TF
+  for(size_t u=0;u<nU;u++) {
+    const double* au = AU.data()+u*nF*L;
+    const double* t = TU.data()+u*L;
+    for(size_t j=0;j<nF;j++) {
+      for(size_t l=0;l<L;l++)
+        TF[j*L+l] -= au[j*L+l]*t[l];
+    }
+  }
+  SolveUpper(S.data(), nF, TF.data());
+  for(size_t m=0;m<nM;m++) {
+    const double* y = Y.data()+m*nF*L;
+    double* x = TX.data()+M[m]*L;
+    fill(x, x+L, 0);
+    for(size_t j=0;j<nF;j++) {
+      for(size_t l=0;l<L;l++)
+        x[l] += y[j*L+l]*TF[j*L+l];
+    }
+  }
+  for(size_t u=0;u<nU;u++)
+    copy_n(TU.data()+u*L, L, TX.data()+U[u]*L);
+
+  double chi[L];
+  fill(chi, chi+L, 0);
+  for(size_t j=0;j<nF;j++) {
+    for(size_t l=0;l<L;l++)
+      chi[l] += R[j*L+l]*TF[j*L+l];
+  }
+
+  for(size_t l=0;l<L;l++) {
+    if(!next[l])
+      continue;
+    iter[l]++;
+    chsqp[l] = chisq[l];
+    ncst[l] = 0;
+    chisq[l] = max(0.0, chi[l]);
+
+    // handle corrections and cutstep
+    weight[l] = 1;
+    if(iter[l] > 1 && chisq[l] >= 2*chsqp[l])
+      weight[l] = 0.1;
+    if(iter[l] > 1 && chisq[l] >= 3*chsqp[l])
+      weight[l] = 0.05;
+
+    for(size_t i=0;i<nX;i++) {
+      XP[i*L+l] = DX[i*L+l];
+      DX[i*L+l] = TX[i*L+l];
+    }
+
+    if(failed[l]) {
+      status[l] = -1;
+      state[l] = State_t::Finished;
+      continue;
+    }
+    AddToX(l);
+  }
+}
+
+template<size_t L>
+void LaneSolver<L>::Finish()
+{
+  // see ACOPXV, the fitted covariance matrix from the factors of the last iteration,
+  // V_mm - Z^T*Z + G^T*G for the measured variables with Z = L^-1*Y and G = R^-1*AU^T*Z,
+  // -R^-T*G between unmeasured and measured, and KM^-1-D for the unmeasured variables
+  copy(Y.begin(), Y.end(), TY.begin());
+  for(size_t m=0;m<nM;m++) {
+    const double* z = TY.data()+m*nF*L;
+    SolveLower(S.data(), nF, TY.data()+m*nF*L);
+    double* g = TG.data()+m*nU*L;
+    for(size_t u=0;u<nU;u++) {
+      const double* au = AU.data()+u*nF*L;
+      fill(g+u*L, g+u*L+L, 0);
+      for(size_t j=0;j<nF;j++) {
+        for(size_t l=0;l<L;l++)
+          g[u*L+l] += au[j*L+l]*z[j*L+l];
+      }
+    }
+    if(nU > 0)
+      SolveLower(KM.data(), nU, g);
+  }
+
+  fill(VF.begin(), VF.end(), 0);
+  for(size_t m=0;m<nM;m++) {
+    const double* zm = TY.data()+m*nF*L;
+    const double* gm = TG.data()+m*nU*L;
+    for(size_t k=0;k<=m;k++) {
+      const double* zk = TY.data()+k*nF*L;
+      const double* gk = TG.data()+k*nU*L;
+      const size_t mk = ijsym(M[m],M[k]);
+      double* vf = VF.data()+mk*L;
+      copy_n(V.data()+mk*L, L, vf);
+      for(size_t j=0;j<nF;j++) {
+        for(size_t l=0;l<L;l++)
+          vf[l] -= zm[j*L+l]*zk[j*L+l];
+      }
+      for(size_t u=0;u<nU;u++) {
+        for(size_t l=0;l<L;l++)
+          vf[l] += gm[u*L+l]*gk[u*L+l];
+      }
+    }
+  }
+  if(nU > 0) {
+    for(size_t m=0;m<nM;m++) {
+      double* g = TG.data()+m*nU*L;
+      SolveUpper(KM.data(), nU, g);
+      for(size_t u=0;u<nU;u++) {
+        double* vf = VF.data()+ijsym(U[u],M[m])*L;
+        for(size_t l=0;l<L;l++)
+          vf[l] = -g[u*L+l];
+      }
+    }
+    for(size_t v=0;v<nU;v++) {
+      fill(TU.begin(), TU.end(), 0);
+      fill(TU.begin()+v*L, TU.begin()+v*L+L, 1);
+      SolveLower(KM.data(), nU, TU.data());
+      SolveUpper(KM.data(), nU, TU.data());
+      for(size_t u=v;u<nU;u++)
+        copy_n(TU.data()+u*L, L, VF.data()+ijsym(U[u],U[v])*L);
+      double* vf = VF.data()+ijsym(U[v],U[v])*L;
+      for(size_t l=0;l<L;l++)
+        vf[l] -= D[v*L+l];
+    }
+  }
+
+  // pulls and fitted covariance matrix of the finished lanes
+  const size_t nV = (nX*nX+nX)/2;
+  for(size_t l=0;l<L;l++) {
+    if(!finish[l])
+      continue;
+    for(size_t i=0;i<nX;i++) {
+      const size_t ii = ijsym(i,i)*L+l;
+      pulls[i*L+l] = 0;
+      if(V[ii] > 0 && V[ii]-VF[ii] > 0)
+        pulls[i*L+l] = DX[i*L+l]/sqrt(V[ii]-VF[ii]);
+    }
+    for(size_t k=0;k<nV;k++)
+      V[k*L+l] = VF[k*L+l];
+    state[l] = State_t::Finished;
+  }
+}
+
+template<size_t L>
+void LaneSolver<L>::Decompose(double* S, size_t n)
+{
+  // Cholesky factorization S = L*L^T in place of the packed S, as in the
+  // Cholesky path of Solver, lanes which are not positive definite are marked
+  // as failed and continue with a unit pivot
+  for(size_t j=0;j<n;j++) {
+    double* sj = S+(j*j+j)/2*L;
+    double diag[L];
+    copy_n(sj+j*L, L, diag);
+    for(size_t k=0;k<=j;k++) {
+      const double* sk = S+(k*k+k)/2*L;
+      double sum[L];
+      copy_n(sj+k*L, L, sum);
+      for(size_t i=0;i<k;i++) {
+        for(size_t l=0;l<L;l++)
+          sum[l] -= sj[i*L+l]*sk[i*L+l];
+      }
+      if(k < j) {
+        for(size_t l=0;l<L;l++)
+          sj[k*L+l] = sum[l]/sk[k*L+l];
+      }
+      else {
+        for(size_t l=0;l<L;l++) {
+          const bool positive = sum[l] > 1.0e-12*diag[l];
+          failed[l] |= !positive;
+          sj[j*L+l] = positive ? sqrt(sum[l]) : 1;
+        }
+      }
+    }
+  }
+}
+
+template<size_t L>
+void LaneSolver<L>::SolveLower(const double* S, size_t n, double* b) const
+{
+  // solves L*x = b in place of b, with L from Decompose
+  for(size_t j=0;j<n;j++) {
+    const double* sj = S+(j*j+j)/2*L;
+    double* bj = b+j*L;
+    for(size_t k=0;k<j;k++) {
+      for(size_t l=0;l<L;l++)
+        bj[l] -= sj[k*L+l]*b[k*L+l];
+    }
+    for(size_t l=0;l<L;l++)
+      bj[l] /= sj[j*L+l];
+  }
+}
+
+template<size_t L>
+void LaneSolver<L>::SolveUpper(const double* S, size_t n, double* b) const
+{
+  // solves L^T*x = b in place of b, with L from Decompose
+  for(size_t j=n;j-->0;) {
+    const double* sj = S+(j*j+j)/2*L;
+    double* bj = b+j*L;
+    for(size_t l=0;l<L;l++)
+      bj[l] /= sj[j*L+l];
+    for(size_t k=0;k<j;k++) {
+      for(size_t l=0;l<L;l++)
+        b[k*L+l] -= sj[k*L+l]*bj[l];
+    }
+  }
+}
+
+// the lane counts supported by FitBatch
+template class APLCON_::LaneSolver<4>;
+template class APLCON_::LaneSolver<8>;
@@ -0,0 +1,1276 @@
+#include "detail/APLCON_solver.hpp"
+#include "detail/APLCON_kernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+using namespace APLCON_;
+
+// defaults as set by the Fortran routine APLCON
+const Solver::Settings_t Solver::Settings_t::Default = {
+  1.0e-6, // EPSF
+  1.0e-5, // EPSCHI
+  10,     // ITERMX
+  1.0e-3, // DERFAC
+  1.0e-5, // DERUFC
+  1.0e-2, // DERLOW
+  false,  // no warm start
+  false,  // recompute Jacobian in each iteration
+  false   // evaluate displaced points one by one
+};
+
+namespace {
+
+// index of element (i,j) in packed symmetric matrix, starting at 0
+inline size_t ijsym(size_t i, size_t j) {
+  return i>j ? i*(i+1)/2 + j : j*(j+1)/2 + i;
+}
+
+// incomplete gamma function P(a,x), see DGAMIN in chprob.F
+double gamma_p(double a, double x) {
+  const int itmax = 300;
+  const double eps = 3.0e-7;
+  const double fpmin = 1.0e-30;
+  if(x < 0 || a <= 0)
+    return -1;
+  if(x == 0)
+    return 0;
+  const double gln = lgamma(a);
+  if(x < a+1) {
+    // series representation
+    double ap = a;
+    double sum = 1.0/a;
+    double del = sum;
+    for(int n=0;n<itmax;n++) {
+      ap += 1;
+      del *= x/ap;
+      sum += del;
+      if(abs(del) < abs(sum)*eps)
+        break;
+    }
+    return sum*exp(-x+a*log(x)-gln);
+  }
+  // continued fraction representation
+  double b = x+1-a;
+  double c = 1/fpmin;
+  double d = 1/b;
+  double h = d;
+  for(int i=1;i<=itmax;i++) {
+    const double an = -i*(i-a);
+    b += 2;
+    d = an*d+b;
+    if(abs(d) < fpmin)
+      d = fpmin;
+    c = b+an/c;
+    if(abs(c) < fpmin)
+      c = fpmin;
+    d = 1/d;
+    const double del = d*c;
+    h *= del;
+    if(abs(del-1) < eps)
+      break;
+  }
+  return 1-exp(-x+a*log(x)-gln)*h;
+}
+
+// the sparse path is used for equation systems of at least this size,
+// if at most this fraction of the Jacobian can be non-zero
+const size_t sparse_min_size = 100;
+const double sparse_max_density = 0.1;
+
+// adds the wall time of f() to t, if given
+template<typename Func>
+void timed(double* t, const Func& f) {
+  if(t == nullptr) {
+    f();
+    return;
+  }
+  const auto start = chrono::steady_clock::now();
+  f();
+  *t += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// second part of DUMINV, inverts the packed symmetric matrix WM of size N with the
+// right-hand side RH by pivot search on the diagonal among the indices linked by
+// QNEXT from jfirst, and finally reverses the sign of WM. Returns the number of pivots
+int invert_pivot(double* WM, double* RH, const double* DIAG, int* QNEXT, int N, int jfirst)
+{
+  // the index arithmetic follows the Fortran code, so the accessors count from 1
+  auto W    = [WM]    (int k) -> double& { return WM[k-1]; };
+  auto B    = [RH]    (int k) -> double& { return RH[k-1]; };
+  auto AUX  = [DIAG]  (int k) -> double  { return DIAG[k-1]; };
+  auto NEXT = [QNEXT] (int k) -> int&    { return QNEXT[k-1]; };
+
+  int rank = 0;
+  const double eps = 1.0e-6;
+  for(int n=1;n<=N;n++) {
+    double vkk = 0;
+    int k = 0;
+    int l = 0;
+    int last = 0;
+    for(int j=jfirst; j>0; j=NEXT(j)) {
+      const int jj = (j*j+j)/2;
+      if(abs(W(jj)) > max(abs(vkk), eps*AUX(j))) {
+        vkk = W(jj);
+        k = j;
+        l = last;
+      }
+      last = j;
+    }
+
+    if(k == 0) {
+      // no pivot found, clear the undefined rows/columns
+      for(int i=1;i<=N;i++) {
+        if(NEXT(i) == 0)
+          continue;
+        B(i) = 0;
+        for(int j=1;j<=i;j++) {
+          if(NEXT(j) != 0)
+            W((i*i-i)/2+j) = 0;
+        }
+      }
+      break;
+    }
+
+    rank++;
+    const int kk = (k*k+k)/2;
+    if(l == 0)
+      jfirst = NEXT(k);
+    else
+      NEXT(l) = NEXT(k);
+    NEXT(k) = 0;
+
+    vkk = 1/vkk;
+    W(kk) = -vkk;
+    B(k) *= vkk;
+    int jk = kk-k;
+    int jl = 0;
+    for(int j=1;j<=N;j++) {
+      if(j == k) {
+        jk = kk;
+        jl += j;
+        continue;
+      }
+      if(j < k)
+        jk++;
+      else
+        jk += j-1;
+      const double vjk = W(jk);
+      W(jk) = vkk*vjk;
+      B(j) -= B(k)*vjk;
+      int lk = kk-k;
+      for(int i=1;i<=j;i++) {
+        jl++;
+        if(i == k) {
+          lk = kk;
+        }
+        else {
+          if(i < k)
+            lk++;
+          else
+            lk += i-1;
+          W(jl) -= W(lk)*vjk;
+        }
+      }
+    }
+  }
+
+  // finally reverse sign
+  for(int i=1;i<=(N*N+N)/2;i++)
+    W(i) = -W(i);
+  return rank;
+}
+
+// Cholesky factorization S = L*L^T in place of the packed symmetric matrix S
+// of size n, row by row, so the inner products run over contiguous rows.
+// Returns false if a pivot is not clearly positive, i.e. S is not positive definite
+bool cholesky_decompose(double* S, size_t n)
+{
+  const Kernels_t& K = Kernels();
+  for(size_t j=0;j<n;j++) {
+    double* sj = S+(j*j+j)/2;
+    const double diag = sj[j];
+    for(size_t k=0;k<=j;k++) {
+      const double* sk = S+(k*k+k)/2;
+      const double sum = sj[k] - K.Dot(sj, sk, k);
+      if(k < j)
+        sj[k] = sum/sk[k];
+      else if(sum > 1.0e-12*diag)
+        sj[j] = sqrt(sum);
+      else
+        return false;
+    }
+  }
+  return true;
+}
+
+// solves L*L^T*x = b in place of b, with L from cholesky_decompose
+void cholesky_solve(const double* L, size_t n, double* b)
+{
+  const Kernels_t& K = Kernels();
+  for(size_t j=0;j<n;j++) {
+    const double* lj = L+(j*j+j)/2;
+    b[j] = (b[j] - K.Dot(lj, b, j))/lj[j];
+  }
+  for(size_t j=n;j-->0;) {
+    const double* lj = L+(j*j+j)/2;
+    b[j] /= lj[j];
+    K.Axpy(-b[j], lj, b, j);
+  }
+}
+
+} // namespace
+
+void APLCON_::SMAVAT(const double* V, const double* A, size_t N, size_t M, double* AV, double* W)
+{
+  const Kernels_t& K = Kernels();
+  K.MultiplyAV(V, A, N, M, AV);
+  K.MultiplyABt(AV, A, N, M, W);
+}
+
+double APLCON_::ChiSquareProbability(double chisq, int ndf)
+{
+  // same as CHPROB
+  if(chisq <= 0)
+    return 1;
+  return 1-gamma_p(0.5*ndf, 0.5*chisq);
+}
+
+void Solver::Init(const vector<Variable_t>& variables_, size_t nF_, const Settings_t& settings_)
+{
+  variables = variables_;
+  settings = settings_;
+  nX = variables.size();
+  nF = nF_;
+  warm = false;
+
+  const size_t nXF = nX+nF;
+  ntvar.resize(nX);
+  ntder.resize(nX);
+  ntvar_warm.resize(nX);
+  ST_warm.resize(nX);
+  A.resize(nX*nF);
+  ST.resize(nX);
+  XS.resize(nX);
+  DX.resize(nX);
+  XP.resize(nX);
+  pulls.resize(nX);
+  FC.resize(nF);
+  FCOPY.resize(nF);
+  HH.resize(nF);
+  RH.resize(nXF);
+  DIAG.resize(nXF);
+  QNEXT.resize(nXF);
+  DCOL.resize(nX);
+  KCOL.resize(nX);
+  XD.resize(2*nX);
+  XT.resize(2*nX);
+  ILRDER.resize(nX);
+  FK.resize(2*nX);
+  PC.resize(2*nX);
+  PV.resize(2*nX);
+  POFF.resize(2*nX+1);
+  PF.resize(2*nX);
+
+  // sort the variables by group, counting sort
+  size_t nGroups = 0;
+  for(const Variable_t& v : variables)
+    nGroups = max(nGroups, v.Group+1);
+  GOFF.assign(nGroups+1, 0);
+  for(const Variable_t& v : variables)
+    GOFF[v.Group+1]++;
+  for(size_t g=0;g<nGroups;g++)
+    GOFF[g+1] += GOFF[g];
+  GV.resize(nX);
+  for(size_t i=0;i<nX;i++)
+    GV[GOFF[variables[i].Group]++] = i;
+  for(size_t g=nGroups;g>0;g--)
+    GOFF[g] = GOFF[g-1];
+  GOFF[0] = 0;
+
+  // FD holds the dependent constraints of all points at once,
+  // or of the two points of one group
+  NROWS.resize(nX);
+  for(size_t i=0;i<nX;i++) {
+    NROWS[i] = 0;
+    for(const auto& rows : variables[i].Rows)
+      NROWS[i] += rows.second-rows.first;
+  }
+  size_t nFD = 0;
+  for(size_t g=0;g<nGroups;g++) {
+    size_t nRows = 0;
+    for(size_t l=GOFF[g];l<GOFF[g+1];l++)
+      nRows += NROWS[GV[l]];
+    nFD = settings.EvaluatePointsAtOnce ? nFD+2*nRows : max(nFD, 2*nRows);
+  }
+  FD.resize(nFD);
+
+  // the sparse path needs no storage of size nX+nF squared
+  size_t nnz = 0;
+  for(size_t i=0;i<nX;i++)
+    nnz += NROWS[i];
+  sparse = nXF >= sparse_min_size && nnz <= sparse_max_density*nX*nF;
+  WM.resize(sparse ? 0 : (nXF*nXF+nXF)/2);
+  CS.resize((nF*nF+nF)/2);
+  CB.resize(nF);
+  CY.resize(sparse ? 0 : nF*nX);
+  if(sparse) {
+    WM.shrink_to_fit();
+    KU.resize(nX);
+    KQ.resize(nX);
+    VOFF.resize(nX+1);
+    VD.resize(nX);
+    VY.resize(nX);
+    G.resize(nF);
+    GJ.resize(nF);
+    GS.assign(nF, 0);
+    gstamp = 0;
+  }
+}
+
+int Solver::Fit(double* X, double* V, double* F,
+                const evaluate_t& evaluate, const jacobian_t& jacobian,
+                const evaluate_points_t& evaluate_points, Timing_t* timing)
+{
+  double* t_constraints = timing ? &timing->Constraints : nullptr;
+  double* t_derivatives = timing ? &timing->Derivatives : nullptr;
+  double* t_matrix      = timing ? &timing->Matrix : nullptr;
+
+  // reset everything like APLCON, then define the steps like the first APLOOP call
+  fill(FC.begin(), FC.end(), 0);
+  fill(HH.begin(), HH.end(), 0);
+  fill(DX.begin(), DX.end(), 0);
+  fill(XP.begin(), XP.end(), 0);
+  fill(pulls.begin(), pulls.end(), 0);
+  bool analytic = false;
+  for(size_t i=0;i<nX;i++) {
+    ntvar[i] = variables[i].Transformation;
+    ntder[i] = 0;
+    ST[i] = abs(variables[i].Step);
+    analytic |= variables[i].Analytic;
+  }
+  chisq = 0;
+  ftest = 0;
+  ndf = nF;
+  iter = 0;
+  ncst = 0;
+  weight = 1;
+  njacobians = 0;
+  ncutsteps = 0;
+  rank = 0;
+  nreused = 0;
+  SetSteps(X, V);
+  if(sparse)
+    InitSparse(V);
+
+  // a warm start needs the same transformations as the previous fit,
+  // as the steps and the Jacobian refer to the internal variables
+  bool reuse_jacobian = settings.WarmStart && warm && ntvar == ntvar_warm;
+  if(reuse_jacobian)
+    copy(ST_warm.begin(), ST_warm.end(), ST.begin());
+  else
+    fill(A.begin(), A.end(), 0);
+  warm = false;
+  // true if the Jacobian was not computed at the current point, see LUPDAT
+  bool updated = reuse_jacobian;
+
+  timed(t_constraints, evaluate);
+  ncalls = 1;
+  copy(X, X+nX, XS.begin());
+
+  // the loop of IPLOOP, where each evaluation corresponds to one APLOOP call
+  bool test = false;
+  for(;;) {
+    // constraint test summary
+    ftestp = ftest;
+    ftest = 0;
+    for(size_t j=0;j<nF;j++) {
+      FCOPY[j] = F[j];
+      ftest += abs(F[j]);
+    }
+    ftest = max(1.0e-16, ftest/nF); // average |F|
+
+    bool update = false;
+    if(test) {
+      const int ret = TestConvergence();
+      // only converge with a computed Jacobian, as it defines the covariance matrix
+      if(ret >= 0 && !(ret == 0 && updated)) {
+        Finish(X, V);
+        if(ret == 0 && settings.WarmStart) {
+          copy(ST.begin(), ST.end(), ST_warm.begin());
+          copy(ntvar.begin(), ntvar.end(), ntvar_warm.begin());
+          warm = true;
+        }
+        return ret;
+      }
+      if(ret == -2) {
+        // cutstep, only add the reduced corrections,
+        // and classify the linear variables again (see ADERNL)
+        ncutsteps++;
+        for(int& t : ntder) {
+          if(t == 2)
+            t = 1;
+        }
+        AddToX(X);
+        timed(t_constraints, evaluate);
+        ncalls++;
+        continue;
+      }
+      // update the Jacobian, unless the constraints got worse or after cutstep
+      update = ret == -1 && settings.BroydenUpdates &&
+               !analytic && ncst == 0 && ftest < ftestp;
+    }
+
+    // new Jacobian, unless the previous one is reused or updated, and next iteration
+    if(reuse_jacobian) {
+      reuse_jacobian = false;
+    }
+    else if(update && BroydenUpdate(F)) {
+      updated = true;
+    }
+    else {
+      updated = false;
+      njacobians++;
+      timed(t_derivatives, [&] { NumericalDerivatives(X, evaluate_points); });
+      if(analytic) {
+        timed(t_constraints, jacobian);
+        ncalls++;
+      }
+    }
+    timed(t_matrix, [&] { NextIteration(X, V); });
+    AddToX(X);
+    timed(t_constraints, evaluate);
+    ncalls++;
+    test = true;
+  }
+}
+
+void Solver::SetJacobianRow(size_t j, const double* X, const double* row)
+{
+  if(j >= nF)
+    return;
+  double* a = A.data()+nX*j;
+  for(size_t i=0;i<nX;i++) {
+    // derivatives are w.r.t. internal variables
+    double dxdt = 1;
+    if(ST[i] == 0)
+      dxdt = 0; // fixed variable
+    else if(ntvar[i] == Transformation_t::LogNormal)
+      dxdt = X[i];
+    else if(ntvar[i] == Transformation_t::SquareRoot)
+      dxdt = 2*sqrt(X[i]);
+    a[i] = row[i]*dxdt;
+  }
+}
+
+double Solver::Probability() const
+{
+  return ChiSquareProbability(chisq, ndf);
+}
+
+void Solver::SetSteps(double* X, double* V)
+{
+  // see ASTEPS
+  for(size_t i=0;i<nX;i++) {
+    const double vii = abs(V[ijsym(i,i)]);
+    Transformation_t& t = ntvar[i];
+
+    // transformed variables have to be positive
+    if((t == Transformation_t::LogNormal || t == Transformation_t::SquareRoot) && X[i] <= 0)
+      t = Transformation_t::None;
+
+    // step size for derivative calculation
+    double& st = ST[i];
+    if(vii != 0) {
+      // measured variable
+      if(st > 0) {
+        st = min(st, settings.MeasuredStepSizeFactor*sqrt(vii));
+      }
+      else {
+        st = settings.MeasuredStepSizeFactor*sqrt(vii);
+        const double x = t == Transformation_t::Poisson ? X[i]+1 : X[i];
+        st = min(st, settings.MinimalStepSizeFactor*max(1.0e-6, abs(x)));
+      }
+    }
+    else {
+      // unmeasured variable
+      ndf--;
+      for(size_t j=0;j<nX;j++)
+        V[ijsym(i,j)] = 0;
+      st = settings.UnmeasuredStepSizeFactor*max(1.0, abs(X[i]));
+    }
+    if(variables[i].Fixed)
+      st = 0;
+
+    // transform steps, note that ASTEPS uses the
+    // sqrt step for log-normal variables as well
+    if(st != 0 && t == Transformation_t::LogNormal)
+      st = 0.5*st/sqrt(X[i]);
+
+    // transform covariance matrix
+    if(t == Transformation_t::LogNormal) {
+      for(size_t j=0;j<nX;j++) {
+        V[ijsym(i,j)] /= X[i];
+        if(i == j)
+          V[ijsym(i,j)] /= X[i];
+      }
+    }
+    else if(t == Transformation_t::SquareRoot) {
+      const double f = 0.5/sqrt(X[i]);
+      for(size_t j=0;j<nX;j++) {
+        V[ijsym(i,j)] *= f;
+        if(i == j)
+          V[ijsym(i,j)] *= f;
+      }
+    }
+  }
+}
+
+void Solver::NumericalDerivatives(double* X, const evaluate_points_t& evaluate_points)
+{
+  // see ANUMDE, but the displaced values of all variables are determined first
+  const size_t none = nX;
+  size_t n = 0; // number of differentiated columns
+  for(size_t i=0;i<nX;i++) {
+    KCOL[i] = none;
+    if(ST[i] == 0)
+      continue;
+    if(NROWS[i] == 0)
+      continue; // no constraint depends on the variable
+    if(ntder[i] >= 2) {
+      // linear variable, keep the column
+      nreused++;
+      continue;
+    }
+    if(variables[i].Analytic)
+      continue;
+    const double xsave = X[i];
+    const double low = variables[i].Low;
+    const double high = variables[i].High;
+    double& st = ST[i];
+    double xd[2], xt[2] = {0, 0};
+    int ilrder = 0; // symmetric steps, or one-sided steps to + (1) or - (2)
+
+    // check limits for variable
+    // (ANUMDE tests xsave-st > low here, which we keep)
+    if(low != high && (xsave+st > high || xsave-st > low)) {
+      double stm = 0.9999*min(high-xsave, xsave-low);
+      if(3*stm > st) {
+        st = stm; // smaller symmetric step
+      }
+      else {
+        stm = 0.4999*max(high-xsave, xsave-low);
+        if(2*stm < st)
+          st = stm;
+        if(st < high-xsave) {
+          xd[0] = xsave+st;
+          xd[1] = xsave+2*st;
+          ilrder = 1;
+        }
+        else {
+          xd[0] = xsave-st;
+          xd[1] = xsave-2*st;
+          ilrder = 2;
+        }
+      }
+    }
+
+    // displaced values, internal xt and external xd
+    if(ilrder == 0) {
+      Transformation_t& t = ntvar[i];
+      if(t == Transformation_t::SquareRoot && st*st >= xsave) {
+        if(xsave <= 0)
+          t = Transformation_t::None;
+        else
+          st = 0.9*sqrt(xsave);
+      }
+      if(t == Transformation_t::LogNormal) {
+        xt[0] = log(xsave)+st;
+        xt[1] = log(xsave)-st;
+        xd[0] = exp(xt[0]);
+        xd[1] = exp(xt[1]);
+      }
+      else if(t == Transformation_t::SquareRoot) {
+        xt[0] = sqrt(xsave)+st;
+        xt[1] = sqrt(xsave)-st;
+        xd[0] = xt[0]*xt[0];
+        xd[1] = xt[1]*xt[1];
+      }
+      else {
+        xt[0] = xsave+st;
+        xt[1] = xsave-st;
+        xd[0] = xt[0];
+        xd[1] = xt[1];
+      }
+    }
+
+    DCOL[n] = i;
+    KCOL[i] = n;
+    for(size_t s=0;s<2;s++) {
+      XD[2*n+s] = xd[s];
+      XT[2*n+s] = xt[s];
+    }
+    ILRDER[n] = ilrder;
+    n++;
+  }
+
+  // two points for each group, displacing all its variables to the
+  // first or to the second side, which is possible as they share no row
+  size_t np = 0; // number of points
+  size_t nc = 0; // number of displaced values
+  double* fd = FD.data();
+  POFF[0] = 0;
+  for(size_t g=0;g+1<GOFF.size();g++) {
+    // without EvaluatePointsAtOnce, the groups share FD
+    if(!settings.EvaluatePointsAtOnce)
+      fd = FD.data();
+    for(size_t s=0;s<2;s++) {
+      PF[np] = fd;
+      for(size_t l=GOFF[g];l<GOFF[g+1];l++) {
+        const size_t k = KCOL[GV[l]];
+        if(k == none)
+          continue;
+        PC[nc] = DCOL[k];
+        PV[nc] = XD[2*k+s];
+        nc++;
+        FK[2*k+s] = fd;
+        fd += NROWS[DCOL[k]];
+      }
+      if(nc == POFF[np])
+        break; // nothing to differentiate in this group
+      POFF[++np] = nc;
+    }
+  }
+  ncalls += np;
+
+  if(settings.EvaluatePointsAtOnce) {
+    evaluate_points(X, PC.data(), PV.data(), POFF.data(), np, PF.data());
+    for(size_t k=0;k<n;k++)
+      SetColumn(k);
+    return;
+  }
+
+  // one group after the other
+  for(size_t p=0;p<np;p+=2) {
+    evaluate_points(X, PC.data(), PV.data(), POFF.data()+p, 2, PF.data()+p);
+    for(size_t l=POFF[p];l<POFF[p+1];l++)
+      SetColumn(KCOL[PC[l]]);
+  }
+}
+
+void Solver::SetColumn(size_t k)
+{
+  // derivatives w.r.t. variable DCOL[k] from the dependent constraints
+  // at its first and second displaced point
+  const size_t i = DCOL[k];
+  const double st = ST[i];
+  const double* f1 = FK[2*k];
+  const double* f2 = FK[2*k+1];
+  double ratmax = 0; // max of diff-ratio to previous Jacobian
+  size_t j_zero = 0; // the rows up to the next range are zero
+  for(const auto& rows : variables[i].Rows) {
+    // the Broyden updates might have filled the zero elements
+    for(size_t j=j_zero;j<rows.first;j++) {
+      double& a = A[i+nX*j];
+      if(a != 0)
+        ratmax = 1;
+      a = 0;
+    }
+    j_zero = rows.second;
+    for(size_t j=rows.first;j<rows.second;j++, f1++, f2++) {
+      double der;
+      if(ILRDER[k] == 0) {
+        der = (*f1-*f2)/(XT[2*k]-XT[2*k+1]);
+      }
+      else {
+        der = 0.5*(3*FC[j]+*f2-4*(*f1))/st;
+        if(ILRDER[k] == 2)
+          der = -der;
+      }
+      double& a = A[i+nX*j];
+      if(der != a)
+        ratmax = max(ratmax, abs(a-der)/(abs(a)+abs(der)));
+      a = der;
+      // second difference, zero if constraint j is linear in variable i
+      const double d2 = ILRDER[k] == 0 ? *f1-2*FCOPY[j]+*f2 : FCOPY[j]-2*(*f1)+*f2;
+      if(abs(d2) > 1.0e-10*(abs(*f1)+2*abs(FCOPY[j])+abs(*f2)))
+        ratmax = 1; // not linear
+    }
+  }
+  for(size_t j=j_zero;j<nF;j++) {
+    double& a = A[i+nX*j];
+    if(a != 0)
+      ratmax = 1;
+    a = 0;
+  }
+  // the column is not recomputed if the constraints are linear in the variable
+  // and it is unchanged in two subsequent Jacobians (see also ADERNL)
+  ntder[i] = ntder[i] == 0 || ratmax >= 1.0e-12 ? 1 : 2;
+}
+
+bool Solver::BroydenUpdate(const double* F)
+{
+  // see ABROYD, rank-one update with the last step s = DX - XP
+  // and the change of the constraints since the last iteration,
+  // the columns of linear variables are kept
+  double ss = 0;
+  for(size_t i=0;i<nX;i++) {
+    if(ntder[i] < 2)
+      ss += (DX[i]-XP[i])*(DX[i]-XP[i]);
+  }
+  if(ss <= 0)
+    return false;
+  if(sparse) {
+    // the sparse path relies on the zeros outside the Rows, so only their
+    // elements are updated, each row scaled by its own step (Schubert's update)
+    fill(HH.begin(), HH.end(), 0);
+    for(size_t i=0;i<nX;i++) {
+      if(ntder[i] >= 2)
+        continue;
+      for(const auto& rows : variables[i].Rows) {
+        for(size_t j=rows.first;j<rows.second;j++)
+          HH[j] += (DX[i]-XP[i])*(DX[i]-XP[i]);
+      }
+    }
+    for(size_t j=0;j<nF;j++) {
+      if(HH[j] <= 0)
+        continue;
+      const double* a = A.data()+nX*j;
+      double r = F[j]-FC[j];
+      for(size_t i=0;i<nX;i++)
+        r -= a[i]*(DX[i]-XP[i]);
+      HH[j] = r/HH[j];
+    }
+    for(size_t i=0;i<nX;i++) {
+      if(ntder[i] >= 2)
+        continue;
+      for(const auto& rows : variables[i].Rows) {
+        for(size_t j=rows.first;j<rows.second;j++)
+          A[i+nX*j] += HH[j]*(DX[i]-XP[i]);
+      }
+    }
+    return true;
+  }
+  for(size_t j=0;j<nF;j++) {
+    double* a = A.data()+nX*j;
+    double r = F[j]-FC[j]; // residual of linear prediction
+    for(size_t i=0;i<nX;i++)
+      r -= a[i]*(DX[i]-XP[i]);
+    r /= ss;
+    for(size_t i=0;i<nX;i++) {
+      if(ntder[i] < 2)
+        a[i] += r*(DX[i]-XP[i]);
+    }
+  }
+  return true;
+}
+
+void Solver::NextIteration(const double* X, const double* V)
+{
+  // see ANITER
+  iter++;
+  chsqp = chisq;
+
+  // right-hand side of equation
+  ncst = 0;
+  fill(RH.begin(), RH.begin()+nX, 0);
+  for(size_t j=0;j<nF;j++) {
+    FC[j] = FCOPY[j];
+    double r = -FCOPY[j];
+    const double* a = A.data()+nX*j;
+    for(size_t i=0;i<nX;i++)
+      r += a[i]*DX[i];
+    RH[nX+j] = r;
+    HH[j] = r;
+  }
+
+  // form matrix with -V and solve
+  if(sparse) {
+    SolveSparse(X, V);
+  }
+  else {
+    Kernels().Scale(-1, V, WM.data(), (nX*nX+nX)/2);
+    for(size_t i=0;i<nX;i++) {
+      if(ntvar[i] == Transformation_t::Poisson)
+        WM[ijsym(i,i)] = -sqrt(1+X[i]*X[i]);
+    }
+    cholesky = SolveCholesky();
+    if(!cholesky)
+      SolveMatrix();
+  }
+
+  double sum = 0;
+  for(size_t j=0;j<nF;j++)
+    sum += HH[j]*RH[nX+j];
+  chisq = -sum;
+  if(chisq < 0)
+    chisq = 0;
+
+  // handle corrections and cutstep
+  weight = 1;
+  if(iter > 1 && chisq >= 2*chsqp)
+    weight = 0.1;
+  if(iter > 1 && chisq >= 3*chsqp)
+    weight = 0.05;
+
+  copy(DX.begin(), DX.end(), XP.begin());
+  copy(RH.begin(), RH.begin()+nX, DX.begin());
+}
+
+int Solver::TestConvergence()
+{
+  // see ANTEST, returns -1 for a new Jacobian, -2 for a cutstep
+  if(ncst < 2 && iter > 1 && ftest > 2*ftestp+settings.ConstraintAccuracy) {
+    ncst++;
+    weight = 0.5;
+    return -2;
+  }
+  if(iter >= 2 && ncst == 0 &&
+     abs(chisq-chsqp) <= settings.Chi2Accuracy &&
+     ftest < settings.ConstraintAccuracy)
+    return 0;
+  if(iter > settings.MaxIterations)
+    return 2;
+  return -1;
+}
+
+void Solver::AddToX(double* X)
+{
+  // see ADDTOX
+  for(size_t i=0;i<nX;i++) {
+    DX[i] = weight*DX[i]+(1-weight)*XP[i];
+    if(ntvar[i] == Transformation_t::LogNormal)
+      X[i] = exp(log(XS[i])+DX[i]);
+    else if(ntvar[i] == Transformation_t::SquareRoot)
+      X[i] = pow(sqrt(XS[i])+DX[i], 2);
+    else
+      X[i] = XS[i]+DX[i];
+  }
+}
+
+void Solver::Finish(const double* X, double* V)
+{
+  // see ACOPXV, pulls and fitted covariance matrix
+  if(sparse) {
+    FinishSparse(V);
+  }
+  else {
+    if(cholesky)
+      CholeskyCovariance();
+    for(size_t i=0;i<nX;i++) {
+      const size_t ii = ijsym(i,i);
+      pulls[i] = 0;
+      if(V[ii] > 0 && V[ii]-WM[ii] > 0)
+        pulls[i] = DX[i]/sqrt(V[ii]-WM[ii]);
+    }
+    const size_t nV = (nX*nX+nX)/2;
+    copy(WM.begin(), WM.begin()+nV, V);
+  }
+
+  // back to external variables, see ATITOE
+  for(size_t i=0;i<nX;i++) {
+    double f = 1;
+    if(ntvar[i] == Transformation_t::LogNormal)
+      f = X[i];
+    else if(ntvar[i] == Transformation_t::SquareRoot)
+      f = 2*sqrt(X[i]);
+    else
+      continue;
+    for(size_t j=0;j<nX;j++) {
+      V[ijsym(i,j)] *= f;
+      if(i == j)
+        V[ijsym(i,j)] *= f;
+    }
+  }
+}
+
+void Solver::SolveMatrix()
+{
+  // see DUMINV/DBMINV, solves the system of size N=nX+nF in WM and RH,
+  // where the -V part is already inserted and treated as inverted for measured variables.
+  // The index arithmetic follows the Fortran code, so the accessors count from 1
+  const int NX = nX;
+  const int NF = nF;
+  const int N = NX+NF;
+  auto W    = [this] (int k) -> double& { return WM[k-1]; };
+  auto AUX  = [this] (int k) -> double& { return DIAG[k-1]; };
+  auto NEXT = [this] (int k) -> int&    { return QNEXT[k-1]; };
+
+  for(int i=1;i<=N;i++) {
+    NEXT(i) = 0;
+    AUX(i) = 0;
+  }
+
+  // copy A into W_12, reset W_22
+  int ij = (NX*NX+NX)/2;
+  int ia = 0;
+  for(int j=1;j<=NF;j++) {
+    for(int i=1;i<=NX;i++)
+      W(ij+i) = A[ia+i-1];
+    for(int i=1;i<=j;i++)
+      W(ij+NX+i) = 0;
+    ij += NX+j;
+    ia += NX;
+  }
+
+  // distinguish between measured and unmeasured variables
+  int jfirst = 0;
+  int jlast = 0;
+  int nmeas = 0;
+  for(int i=1;i<=NX;i++) {
+    if(W((i*i+i)/2) < 0) {
+      if(jfirst == 0)
+        jfirst = i;
+      else
+        NEXT(jlast) = i;
+      jlast = i;
+      nmeas++;
+    }
+  }
+  // the measured part is inverted by -V
+  rank = nmeas;
+
+  if(jlast != 0) {
+    NEXT(jlast) = -1;
+
+    // apply exchange algorithm to sub-matrices
+    for(int i=NX+1;i<=N;i++) {
+      int j = jfirst;
+      for(int m=1;m<=nmeas;m++) {
+        double sum = 0;
+        int jk = (j*j-j)/2;
+        for(int k=1;k<=NX;k++) {
+          if(k <= j)
+            jk++;
+          if(NEXT(k) != 0)
+            sum += W(jk)*W((i*i-i)/2+k);
+          if(k >= j)
+            jk += k;
+        }
+        AUX(j) = sum;
+        j = NEXT(j);
+      }
+
+      for(int k=i;k<=N;k++) {
+        double sum = 0;
+        j = jfirst;
+        for(int m=1;m<=nmeas;m++) {
+          sum += W((k*k-k)/2+j)*AUX(j);
+          j = NEXT(j);
+        }
+        W((k*k-k)/2+i) += sum;
+      }
+
+      j = jfirst;
+      for(int m=1;m<=nmeas;m++) {
+        W((i*i-i)/2+j) = -AUX(j);
+        j = NEXT(j);
+      }
+    }
+
+    // set pointer for unmeasured variables and constraints
+    jfirst = 0;
+    jlast = 0;
+    for(int i=1;i<=N;i++) {
+      if(NEXT(i) == 0) {
+        if(jfirst == 0)
+          jfirst = i;
+        else
+          NEXT(jlast) = i;
+        jlast = i;
+      }
+      else {
+        NEXT(i) = 0;
+      }
+    }
+    if(jlast != 0)
+      NEXT(jlast) = -1;
+  }
+
+  // invert the remaining part
+  rank += invert_pivot(WM.data(), RH.data(), DIAG.data(), QNEXT.data(), N, jfirst);
+}
+
+void Solver::InitSparse(const double* V)
+{
+  // measured variables as in SolveMatrix, where Poisson variables always are
+  nU = 0;
+  for(size_t i=0;i<nX;i++) {
+    const bool measured = V[ijsym(i,i)] > 0 || ntvar[i] == Transformation_t::Poisson;
+    KQ[i] = measured ? nX : nU;
+    if(!measured)
+      KU[nU++] = i;
+  }
+  // non-zero covariances between different measured variables,
+  // the storage only grows if the covariance matrix gets denser
+  VN.clear();
+  for(size_t i=0;i<nX;i++) {
+    VOFF[i] = VN.size();
+    if(KQ[i] != nX)
+      continue;
+    for(size_t k=0;k<nX;k++) {
+      const double v = V[ijsym(i,k)];
+      if(k != i && KQ[k] == nX && v != 0)
+        VN.emplace_back(k, v);
+    }
+  }
+  VOFF[nX] = VN.size();
+  const size_t nK = nU+nF;
+  KW.resize((nK*nK+nK)/2);
+  KB.resize(nK);
+  E.resize(nK);
+}
+
+void Solver::SolveSparse(const double* X, const double* V)
+{
+  // like SolveMatrix, but the exchange of the measured variables is done with the
+  // sparse A and V, so only the system K of the unmeasured variables (first, with
+  // -V) and the constraints (with A and -A*V*A^T) is inverted. Its solution
+  // contains the corrections of the unmeasured variables and the multipliers,
+  // the corrections of the measured variables are then -V*A^T times the multipliers
+  const size_t nK = nU+nF;
+  for(size_t i=0;i<nX;i++) {
+    VD[i] = V[ijsym(i,i)];
+    if(ntvar[i] == Transformation_t::Poisson)
+      VD[i] = sqrt(1+X[i]*X[i]);
+  }
+
+  fill(KW.begin(), KW.end(), 0);
+  for(size_t q=0;q<nU;q++) {
+    for(size_t p=0;p<=q;p++)
+      KW[ijsym(q,p)] = -V[ijsym(KU[q],KU[p])];
+    for(const auto& rows : variables[KU[q]].Rows) {
+      for(size_t j=rows.first;j<rows.second;j++)
+        KW[ijsym(nU+j,q)] = A[KU[q]+nX*j];
+    }
+  }
+
+  // add -A_i*v*A_k^T for the element v of V, which only has non-zero elements
+  // in the rows of both variables, and its transposed if i != k
+  auto add_element = [this] (size_t i, size_t k, double v) {
+    for(const auto& rows_i : variables[i].Rows) {
+      for(size_t j=rows_i.first;j<rows_i.second;j++) {
+        const double aj = v*A[i+nX*j];
+        if(aj == 0)
+          continue;
+        for(const auto& rows_k : variables[k].Rows) {
+          for(size_t l=rows_k.first;l<rows_k.second && (i != k || l <= j);l++) {
+            const double w = aj*A[k+nX*l];
+            KW[ijsym(nU+j,nU+l)] -= i != k && j == l ? 2*w : w;
+          }
+        }
+      }
+    }
+  };
+  size_t nmeas = 0;
+  for(size_t i=0;i<nX;i++) {
+    if(KQ[i] != nX)
+      continue;
+    nmeas++;
+    add_element(i, i, VD[i]);
+    for(size_t n=VOFF[i];n<VOFF[i+1] && VN[n].first<i;n++)
+      add_element(i, VN[n].first, VN[n].second);
+  }
+
+  for(size_t q=0;q<nU;q++)
+    KB[q] = RH[KU[q]];
+  for(size_t j=0;j<nF;j++)
+    KB[nU+j] = RH[nX+j];
+
+  // the measured part is inverted by -V, as in SolveMatrix
+  rank = nmeas;
+  if(nmeas == 0)
+    return;
+  cholesky = false;
+  if(nU == 0) {
+    // all variables measured, so K is -A*V*A^T, see SolveCholesky
+    for(size_t jl=0;jl<CS.size();jl++)
+      CS[jl] = -KW[jl];
+    cholesky = cholesky_decompose(CS.data(), nF);
+    if(cholesky) {
+      cholesky_solve(CS.data(), nF, KB.data());
+      for(size_t j=0;j<nF;j++)
+        KB[j] = -KB[j];
+      rank += nF;
+    }
+  }
+  if(!cholesky && nK > 0) {
+    for(size_t m=0;m<nK;m++) {
+      DIAG[m] = 0;
+      QNEXT[m] = m+1 < nK ? m+2 : -1;
+    }
+    rank += invert_pivot(KW.data(), KB.data(), DIAG.data(), QNEXT.data(), nK, 1);
+  }
+
+  for(size_t q=0;q<nU;q++)
+    RH[KU[q]] = KB[q];
+  for(size_t j=0;j<nF;j++)
+    RH[nX+j] = KB[nU+j];
+  for(size_t k=0;k<nX;k++) {
+    VY[k] = 0;
+    if(KQ[k] != nX)
+      continue;
+    for(const auto& rows : variables[k].Rows) {
+      for(size_t j=rows.first;j<rows.second;j++)
+        VY[k] += A[k+nX*j]*RH[nX+j];
+    }
+  }
+  for(size_t i=0;i<nX;i++) {
+    if(KQ[i] != nX)
+      continue;
+    double dx = VD[i]*VY[i];
+    for(size_t n=VOFF[i];n<VOFF[i+1];n++)
+      dx += VN[n].second*VY[VN[n].first];
+    RH[i] = -dx;
+  }
+}
+
+void Solver::ColumnAV(size_t k)
+{
+  // the rows of A*V in column k are the rows of k and its correlated variables
+  gstamp++;
+  nG = 0;
+  auto add_column = [this] (size_t i, double v) {
+    for(const auto& rows : variables[i].Rows) {
+      for(size_t j=rows.first;j<rows.second;j++) {
+        if(GS[j] != gstamp) {
+          GS[j] = gstamp;
+          G[j] = 0;
+          GJ[nG++] = j;
+        }
+        G[j] += A[i+nX*j]*v;
+      }
+    }
+  };
+  add_column(k, VD[k]);
+  for(size_t n=VOFF[k];n<VOFF[k+1];n++)
+    add_column(VN[n].first, VN[n].second);
+}
+
+void Solver::FinishSparse(double* V)
+{
+  // the fitted covariance matrix as SolveMatrix would give it from the inverted K,
+  // which is V+V*A^T*K_ff*A*V for measured, -V*A^T*K_fu between measured
+  // and unmeasured, and K_uu for unmeasured variables. It is filled column by
+  // column from the diagonal, so V is only replaced after its last use
+  const size_t nK = nU+nF;
+  if(cholesky) {
+    // K was not inverted, its inverse -(A*V*A^T)^-1 column by column
+    for(size_t m=0;m<nF;m++) {
+      fill(CB.begin(), CB.end(), 0);
+      CB[m] = 1;
+      cholesky_solve(CS.data(), nF, CB.data());
+      for(size_t j=m;j<nF;j++)
+        KW[ijsym(j,m)] = -CB[j];
+    }
+  }
+  for(size_t k=0;k<nX;k++) {
+    const size_t qk = KQ[k];
+    if(qk == nX) {
+      // product of K with the column of A*V in E
+      ColumnAV(k);
+      for(size_t m=0;m<nK;m++) {
+        double sum = 0;
+        for(size_t n=0;n<nG;n++)
+          sum += KW[ijsym(m,nU+GJ[n])]*G[GJ[n]];
+        E[m] = sum;
+      }
+    }
+    else {
+      // the column of K in E
+      for(size_t m=0;m<nK;m++)
+        E[m] = KW[ijsym(m,qk)];
+    }
+
+    size_t n_cov = VOFF[k];
+    for(size_t i=k;i<nX;i++) {
+      const size_t qi = KQ[i];
+      double c;
+      if(qi != nX) {
+        c = qk == nX ? -E[qi] : E[qi];
+      }
+      else {
+        ColumnAV(i);
+        c = 0;
+        for(size_t n=0;n<nG;n++)
+          c += G[GJ[n]]*E[nU+GJ[n]];
+        if(qk != nX) {
+          c = -c;
+        }
+        else if(i == k) {
+          c += VD[k];
+        }
+        else {
+          for(;n_cov<VOFF[k+1] && VN[n_cov].first<=i;n_cov++) {
+            if(VN[n_cov].first == i)
+              c += VN[n_cov].second;
+          }
+        }
+      }
+      double& v = V[ijsym(i,k)];
+      if(i == k) {
+        pulls[k] = 0;
+        if(v > 0 && v-c > 0)
+          pulls[k] = DX[k]/sqrt(v-c);
+      }
+      v = c;
+    }
+  }
+}
+
+bool Solver::SolveCholesky()
+{
+  // without unmeasured variables, the system in WM reduces to S*lambda = r with
+  // S = A*V*A^T, and the corrections are V*A^T*lambda. The multipliers are
+  // returned as -lambda and the rank as full, like SolveMatrix does.
+  // Returns false, with WM and RH untouched, if S is not positive definite
+  for(size_t i=0;i<nX;i++) {
+    if(!(WM[ijsym(i,i)] < 0))
+      return false;
+  }
+
+  // CY = A*V and CS = A*V*A^T, from -V in WM
+  const Kernels_t& K = Kernels();
+  SMAVAT(WM.data(), A.data(), nX, nF, CY.data(), CS.data());
+  K.Scale(-1, CY.data(), CY.data(), CY.size());
+  K.Scale(-1, CS.data(), CS.data(), CS.size());
+  if(!cholesky_decompose(CS.data(), nF))
+    return false;
+
+  for(size_t j=0;j<nF;j++)
+    CB[j] = RH[nX+j];
+  cholesky_solve(CS.data(), nF, CB.data());
+  fill(RH.begin(), RH.begin()+nX, 0);
+  for(size_t j=0;j<nF;j++) {
+    K.Axpy(CB[j], CY.data()+nX*j, RH.data(), nX);
+    RH[nX+j] = -CB[j];
+  }
+  rank = nX+nF;
+  return true;
+}
+
+void Solver::CholeskyCovariance()
+{
+  // WM still holds -V, replaced by the fitted covariance matrix
+  // V-(A*V)^T*S^-1*(A*V) = V-Y^T*Y with Y = L^-1*A*V, overwriting CY
+  const Kernels_t& K = Kernels();
+  for(size_t j=0;j<nF;j++) {
+    double* yj = CY.data()+nX*j;
+    const double* lj = CS.data()+(j*j+j)/2;
+    for(size_t l=0;l<j;l++)
+      K.Axpy(-lj[l], CY.data()+nX*l, yj, nX);
+    for(size_t i=0;i<nX;i++)
+      yj[i] /= lj[j];
+  }
+  K.Scale(-1, WM.data(), WM.data(), (nX*nX+nX)/2);
+  for(size_t j=0;j<nF;j++) {
+    const double* y = CY.data()+nX*j;
+    size_t ik = 0;
+    for(size_t i=0;i<nX;i++) {
+      K.Axpy(-y[i], y, WM.data()+ik, i+1);
+      ik += i+1;
+    }
+  }
+}
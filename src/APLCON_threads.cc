@@ -0,0 +1,100 @@
+#include "detail/APLCON_threads.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace APLCON_ {
+
+void ThreadPool::Resize(size_t n)
+{
+  if(n < 1)
+    n = 1;
+  if(n == Size())
+    return;
+
+  // stop all threads, then start the new number of them
+  {
+    lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wakeup.notify_all();
+  for(thread& t : threads)
+    t.join();
+  threads.clear();
+  stop = false;
+
+  // the calling thread runs task 0,
+  // the new threads wait for the next generation of tasks
+  for(size_t t=1;t<n;t++)
+    threads.emplace_back(&ThreadPool::Loop, this, t, generation);
+}
+
+void ThreadPool::Run(size_t n, const function<void(size_t)>& _task)
+{
+  n = min(n, Size());
+  if(n == 0)
+    return;
+  if(n == 1) {
+    _task(0);
+    return;
+  }
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    task = &_task;
+    nTasks = n;
+    running = n-1;
+    error = nullptr;
+    ++generation;
+  }
+  wakeup.notify_all();
+
+  exception_ptr first_error;
+  try {
+    _task(0);
+  }
+  catch(...) {
+    first_error = current_exception();
+  }
+
+  unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] () { return running == 0; });
+  task = nullptr;
+  if(!first_error)
+    first_error = error;
+  lock.unlock();
+
+  if(first_error)
+    rethrow_exception(first_error);
+}
+
+void ThreadPool::Loop(size_t t, size_t seen)
+{
+  unique_lock<std::mutex> lock(mutex);
+  for(;;) {
+    wakeup.wait(lock, [this, seen] () { return stop || generation != seen; });
+    if(stop)
+      return;
+    seen = generation;
+    if(t >= nTasks)
+      continue;
+
+    const function<void(size_t)>& current = *task;
+    lock.unlock();
+    exception_ptr task_error;
+    try {
+      current(t);
+    }
+    catch(...) {
+      task_error = current_exception();
+    }
+    lock.lock();
+    if(task_error && !error)
+      error = task_error;
+    if(--running == 0)
+      done.notify_one();
+  }
+}
+
+} // namespace APLCON_
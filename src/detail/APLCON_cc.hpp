@@ -2,6 +2,7 @@
 #define _APLCON_APLCON_CC_HPP 1
 
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <sstream>
 #include <vector>
@@ -44,11 +45,13 @@ bool V_validentry(const double* p) {
   return p!=nullptr && std::isfinite(*p);
 }
 
+// the transform is a template parameter, so it is inlined into the gather
+template<typename Transform>
 void V_transform(
     std::vector<double>& V,
     const std::vector<double*>& values,
     const std::vector<size_t>& V_ij,
-    std::function<double(double)> transform = [] (double d) {return d;} // identity function as default
+    const Transform& transform
     )
 {
   for(size_t i=0;i<values.size();i++) {
@@ -60,6 +63,15 @@ void V_transform(
   }
 }
 
+void V_transform(
+    std::vector<double>& V,
+    const std::vector<double*>& values,
+    const std::vector<size_t>& V_ij
+    )
+{
+  V_transform(V, values, V_ij, [] (double d) {return d;});
+}
+
 std::string BuildVarName(const std::string& name, size_t n, size_t k) {
   std::stringstream s_name;
   s_name << name;
@@ -116,6 +128,30 @@ private:
 template <typename T>
 Indexer<T> index(T& t) { return Indexer<T>(t); }
 
+/**
+ * @brief The stopwatch class measures the wall time between subsequent Lap() calls
+ * @note if not enabled, the clock is never read and Lap() returns 0
+ */
+class stopwatch {
+public:
+  explicit stopwatch(bool enabled) : enabled(enabled) {
+    if(enabled)
+      last = clock::now();
+  }
+  double Lap() {
+    if(!enabled)
+      return 0;
+    const clock::time_point now = clock::now();
+    const double seconds = std::chrono::duration<double>(now - last).count();
+    last = now;
+    return seconds;
+  }
+private:
+  typedef std::chrono::steady_clock clock;
+  bool enabled;
+  clock::time_point last;
+};
+
 
 } // end namespace APLCON_
 
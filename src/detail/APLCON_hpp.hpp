@@ -1,29 +1,69 @@
 #ifndef _APLCON_APLCON_HPP_HPP
 #define _APLCON_APLCON_HPP_HPP 1
 
+#include <array>
 #include <type_traits>
 #include <vector>
 #include <functional>
 #include <algorithm>
+#include <cmath>
 
 namespace APLCON_ {
 
-// vectorize by template, that means wrap double value around initializer list {}
+// a non-owning view on the consecutive values of one variable inside X,
+// those are the arguments of the bound constraint functions
+
+struct span {
+  const double* Data;
+  std::size_t Size;
+  const double* begin() const { return Data; }
+  const double* end() const { return Data+Size; }
+  std::size_t size() const { return Size; }
+  const double& operator[](std::size_t i) const { return Data[i]; }
+};
+
+// store the returned value(s) of a constraint in the slice out of F by template,
+// that means either a single double value or all elements of the vector
+// at most n values are written, but the number of returned values is counted
 
 template<bool ReturnDouble>
 struct vectorize_if {};
 
 template<>
 struct vectorize_if<true>  {
-  static std::vector<double> get(const double& v) {
-    return {v};
+  static std::size_t put(const double& v, double* out, std::size_t n) {
+    if(n>0)
+      out[0] = v;
+    return 1;
   }
 };
 
 template<>
 struct vectorize_if<false>  {
-  static std::vector<double> get(const std::vector<double>& v) {
-    return v;
+  static std::size_t put(const std::vector<double>& v, double* out, std::size_t n) {
+    std::copy_n(v.begin(), std::min(n, v.size()), out);
+    return v.size();
+  }
+};
+
+// same for derivatives, the gradient of a scalar constraint
+// is the single row of a Jacobian, the rows are stored one after another
+
+template<bool ReturnGradient>
+struct jacobian_if {};
+
+template<>
+struct jacobian_if<true> : vectorize_if<false> {};
+
+template<>
+struct jacobian_if<false>  {
+  static std::size_t put(const std::vector< std::vector<double> >& rows, double* out, std::size_t n) {
+    std::size_t k = 0;
+    for(const auto& row : rows) {
+      vectorize_if<false>::put(row, out+std::min(k, n), n-std::min(k, n));
+      k += row.size();
+    }
+    return k;
   }
 };
 
@@ -113,9 +153,404 @@ struct build_indices : build_indices<N-1, N-1, Is...> {};
 
 template <std::size_t... Is>
 struct build_indices<0, Is...> : indices<Is...> {};
+
+// the plain indices type of build_indices, usable for partial specialization
+template <std::size_t... Is>
+indices<Is...> as_indices(indices<Is...>);
 /// @endcond
 
+// functors with a templated call operator (or C++14 generic lambdas)
+// cannot be analyzed by function_traits, since &F::operator() is ambiguous.
+// Instead, they are probed with N arguments of type Arg, which only works if the
+// return type does not need the body to be deduced (e.g. template<typename T> T operator()...)
+
+template<class F>
+struct has_call_operator {
+private:
+  template<class C>
+  static std::true_type check(decltype(&C::operator()));
+  template<class C>
+  static std::false_type check(...);
+public:
+  static constexpr bool value = decltype(check<F>(nullptr))::value;
+};
+
+template<class F>
+struct is_generic_functor :
+    std::integral_constant<bool, std::is_class<F>::value && !has_call_operator<F>::value>
+{};
+
+template<typename T, std::size_t>
+struct repeat_type {
+  using type = T;
+};
+
+template<class F, typename Arg, typename Indices>
+struct call_traits;
+
+template<class F, typename Arg, std::size_t... I>
+struct call_traits<F, Arg, indices<I...> > {
+private:
+  template<class C>
+  static auto check(int) -> decltype(std::declval<const C&>()(std::declval<typename repeat_type<Arg, I>::type>()...));
+  template<class C>
+  static std::false_type check(...);
+  template<class C>
+  static std::true_type callable(decltype(std::declval<const C&>()(std::declval<typename repeat_type<Arg, I>::type>()...))*);
+  template<class C>
+  static std::false_type callable(...);
+public:
+  static constexpr bool value = decltype(callable<F>(nullptr))::value;
+  using return_type = decltype(check<F>(0));
+};
+
+// find the smallest N>0 such that F is callable with N arguments of type Arg,
+// evaluates to zero if there's no such N
+constexpr std::size_t max_generic_arity = 10;
+
+template<class F, typename Arg, std::size_t N = 1, bool Stop = (N>max_generic_arity)>
+struct generic_arity :
+    std::integral_constant<std::size_t,
+    call_traits<F, Arg, decltype(as_indices(build_indices<N>{}))>::value ? N : generic_arity<F, Arg, N+1>::value>
+{};
+
+template<class F, typename Arg, std::size_t N>
+struct generic_arity<F, Arg, N, true> : std::integral_constant<std::size_t, 0> {};
+
+// a forward-mode dual number carrying the gradient w.r.t. N arguments of a constraint,
+// which is a fixed-size array, so differentiating never allocates.
+// Vector arguments are seeded in chunks of dual_chunk values (see set_duals),
+// as their number of values is only known in Init().
+// The mathematical functions are found via ADL, so write sqrt(x) instead of std::sqrt(x)
+// in generic constraints (and add "using std::sqrt;" for the double instantiation)
+
+template<std::size_t N>
+struct Dual {
+  double Value;
+  std::array<double, N> Gradient;
+
+  Dual(double value = 0) : Value(value), Gradient() {}
+  Dual(double value, std::size_t i) : Value(value), Gradient() {
+    Gradient[i] = 1;
+  }
+
+  // this = a*this + b*other
+  Dual& chain(double a, const Dual& other, double b) {
+    for(std::size_t i=0;i<N;i++)
+      Gradient[i] = a*Gradient[i] + b*other.Gradient[i];
+    return *this;
+  }
+
+  bool constant() const {
+    return std::all_of(Gradient.begin(), Gradient.end(), [] (double d) { return d == 0; });
+  }
+
+  Dual& operator+=(const Dual& o) { Value += o.Value;  return chain(1, o, 1); }
+  Dual& operator-=(const Dual& o) { Value -= o.Value;  return chain(1, o, -1); }
+  Dual& operator*=(const Dual& o) {
+    const double v = Value;
+    Value *= o.Value;
+    return chain(o.Value, o, v);
+  }
+  Dual& operator/=(const Dual& o) {
+    Value /= o.Value;
+    return chain(1/o.Value, o, -Value/o.Value);
+  }
+
+  // derivative of a unary function at x, times the gradient of x
+  static Dual unary(double value, double derivative, const Dual& x) {
+    Dual r(value);
+    return r.chain(0, x, derivative);
+  }
+
+  // friends defined here are no templates, so doubles are converted implicitly
+  friend Dual operator+(Dual a, const Dual& b) { return a += b; }
+  friend Dual operator-(Dual a, const Dual& b) { return a -= b; }
+  friend Dual operator*(Dual a, const Dual& b) { return a *= b; }
+  friend Dual operator/(Dual a, const Dual& b) { return a /= b; }
+  friend Dual operator+(const Dual& a) { return a; }
+  friend Dual operator-(const Dual& a) { return unary(-a.Value, -1, a); }
+
+  friend bool operator<(const Dual& a, const Dual& b)  { return a.Value <  b.Value; }
+  friend bool operator>(const Dual& a, const Dual& b)  { return a.Value >  b.Value; }
+  friend bool operator<=(const Dual& a, const Dual& b) { return a.Value <= b.Value; }
+  friend bool operator>=(const Dual& a, const Dual& b) { return a.Value >= b.Value; }
+  friend bool operator==(const Dual& a, const Dual& b) { return a.Value == b.Value; }
+  friend bool operator!=(const Dual& a, const Dual& b) { return a.Value != b.Value; }
+
+  friend Dual sqrt(const Dual& x) {
+    const double v = std::sqrt(x.Value);
+    return unary(v, 0.5/v, x);
+  }
+  friend Dual exp(const Dual& x) {
+    const double v = std::exp(x.Value);
+    return unary(v, v, x);
+  }
+  friend Dual log(const Dual& x) { return unary(std::log(x.Value), 1/x.Value, x); }
+  friend Dual sin(const Dual& x) { return unary(std::sin(x.Value), std::cos(x.Value), x); }
+  friend Dual cos(const Dual& x) { return unary(std::cos(x.Value), -std::sin(x.Value), x); }
+  friend Dual tan(const Dual& x) {
+    const double v = std::tan(x.Value);
+    return unary(v, 1+v*v, x);
+  }
+  friend Dual asin(const Dual& x) { return unary(std::asin(x.Value), 1/std::sqrt(1-x.Value*x.Value), x); }
+  friend Dual acos(const Dual& x) { return unary(std::acos(x.Value), -1/std::sqrt(1-x.Value*x.Value), x); }
+  friend Dual atan(const Dual& x) { return unary(std::atan(x.Value), 1/(1+x.Value*x.Value), x); }
+  friend Dual atan2(const Dual& y, const Dual& x) {
+    const double r2 = x.Value*x.Value + y.Value*y.Value;
+    Dual r = unary(std::atan2(y.Value, x.Value), x.Value/r2, y);
+    return r.chain(1, x, -y.Value/r2);
+  }
+  friend Dual abs(const Dual& x)  { return x.Value<0 ? -x : x; }
+  friend Dual fabs(const Dual& x) { return abs(x); }
+  friend Dual pow(const Dual& x, double p) {
+    return unary(std::pow(x.Value, p), p*std::pow(x.Value, p-1), x);
+  }
+  friend Dual pow(const Dual& x, const Dual& p) {
+    // x^p = exp(p*log(x)), but keep integer powers of negative x working
+    if(p.constant())
+      return pow(x, p.Value);
+    return exp(p*log(x));
+  }
+};
+
+// the duals of vector arguments, each seeding one of the dual_chunk
+// values [offset, offset+dual_chunk) counted through all arguments
+constexpr std::size_t dual_chunk = 8;
+using dual_buffer_t = std::vector< std::vector< Dual<dual_chunk> > >;
+
+// fill the buffer x_ with the duals of all values of x for the chunk at offset,
+// x_ is only resized at the first call, returns the total number of values
+inline std::size_t set_duals(const std::vector<span>& x, dual_buffer_t& x_, std::size_t offset) {
+  x_.resize(x.size());
+  std::size_t k = 0;
+  for(std::size_t i=0;i<x.size();i++) {
+    x_[i].resize(x[i].size());
+    for(std::size_t j=0;j<x[i].size();j++, k++) {
+      if(k>=offset && k<offset+dual_chunk)
+        x_[i][j] = Dual<dual_chunk>(x[i][j], k-offset);
+      else
+        x_[i][j] = Dual<dual_chunk>(x[i][j]);
+    }
+  }
+  return k;
+}
+
+// store the columns [offset, offset+N) of the Jacobian rows from the returned dual(s),
+// each row has the given number of values
+template<std::size_t N>
+std::size_t put_jacobian(const Dual<N>& f, std::size_t offset, std::size_t values, double* out, std::size_t n) {
+  for(std::size_t k=offset;k<offset+N && k<values && k<n;k++)
+    out[k] = f.Gradient[k-offset];
+  return values;
+}
+
+template<std::size_t N>
+std::size_t put_jacobian(const std::vector< Dual<N> >& f, std::size_t offset, std::size_t values,
+                         double* out, std::size_t n) {
+  std::size_t k = 0;
+  for(const Dual<N>& d : f) {
+    put_jacobian(d, offset, values, out+std::min(k, n), n-std::min(k, n));
+    k += values;
+  }
+  return k;
+}
+
+// differentiate f for vector arguments, calling it once per chunk
+// with the duals in the buffer x_
+template<typename Call>
+std::size_t put_jacobian_chunks(const std::vector<span>& x, dual_buffer_t& x_, const Call& f,
+                                double* out, std::size_t n) {
+  std::size_t values = 0;
+  for(const span& v : x)
+    values += v.size();
+  std::size_t returned = 0;
+  for(std::size_t offset=0;offset<values;offset+=dual_chunk) {
+    set_duals(x, x_, offset);
+    returned = put_jacobian(f(x_), offset, values, out, n);
+  }
+  return returned;
+}
+
+// the values of L events at once, used by FitBatch for constraints added by AddLaneConstraint,
+// so that the loops over the lanes are vectorized. The operators and mathematical functions
+// are found via ADL as for Dual, but there are no comparisons, as the lanes may differ
+
+template<std::size_t L>
+struct Lanes {
+  double Value[L];
+
+  Lanes(double value = 0) {
+    for(std::size_t l=0;l<L;l++)
+      Value[l] = value;
+  }
+  explicit Lanes(const double* values) {
+    for(std::size_t l=0;l<L;l++)
+      Value[l] = values[l];
+  }
+
+  template<typename Func>
+  static Lanes map(const Lanes& x, const Func& f) {
+    Lanes r;
+    for(std::size_t l=0;l<L;l++)
+      r.Value[l] = f(x.Value[l]);
+    return r;
+  }
+  template<typename Func>
+  static Lanes map(const Lanes& x, const Lanes& y, const Func& f) {
+    Lanes r;
+    for(std::size_t l=0;l<L;l++)
+      r.Value[l] = f(x.Value[l], y.Value[l]);
+    return r;
+  }
+
+  Lanes& operator+=(const Lanes& o) { for(std::size_t l=0;l<L;l++) Value[l] += o.Value[l]; return *this; }
+  Lanes& operator-=(const Lanes& o) { for(std::size_t l=0;l<L;l++) Value[l] -= o.Value[l]; return *this; }
+  Lanes& operator*=(const Lanes& o) { for(std::size_t l=0;l<L;l++) Value[l] *= o.Value[l]; return *this; }
+  Lanes& operator/=(const Lanes& o) { for(std::size_t l=0;l<L;l++) Value[l] /= o.Value[l]; return *this; }
+
+  // friends defined here are no templates, so doubles are converted implicitly
+  friend Lanes operator+(Lanes a, const Lanes& b) { return a += b; }
+  friend Lanes operator-(Lanes a, const Lanes& b) { return a -= b; }
+  friend Lanes operator*(Lanes a, const Lanes& b) { return a *= b; }
+  friend Lanes operator/(Lanes a, const Lanes& b) { return a /= b; }
+  friend Lanes operator+(const Lanes& a) { return a; }
+  friend Lanes operator-(const Lanes& a) { return map(a, [] (double v) { return -v; }); }
+
+  friend Lanes sqrt(const Lanes& x) { return map(x, [] (double v) { return std::sqrt(v); }); }
+  friend Lanes exp(const Lanes& x)  { return map(x, [] (double v) { return std::exp(v); }); }
+  friend Lanes log(const Lanes& x)  { return map(x, [] (double v) { return std::log(v); }); }
+  friend Lanes sin(const Lanes& x)  { return map(x, [] (double v) { return std::sin(v); }); }
+  friend Lanes cos(const Lanes& x)  { return map(x, [] (double v) { return std::cos(v); }); }
+  friend Lanes tan(const Lanes& x)  { return map(x, [] (double v) { return std::tan(v); }); }
+  friend Lanes asin(const Lanes& x) { return map(x, [] (double v) { return std::asin(v); }); }
+  friend Lanes acos(const Lanes& x) { return map(x, [] (double v) { return std::acos(v); }); }
+  friend Lanes atan(const Lanes& x) { return map(x, [] (double v) { return std::atan(v); }); }
+  friend Lanes atan2(const Lanes& y, const Lanes& x) {
+    return map(y, x, [] (double a, double b) { return std::atan2(a, b); });
+  }
+  friend Lanes abs(const Lanes& x)  { return map(x, [] (double v) { return std::abs(v); }); }
+  friend Lanes fabs(const Lanes& x) { return abs(x); }
+  friend Lanes pow(const Lanes& x, double p) {
+    return map(x, [p] (double v) { return std::pow(v, p); });
+  }
+  friend Lanes pow(const Lanes& x, const Lanes& p) {
+    return map(x, p, [] (double v, double q) { return std::pow(v, q); });
+  }
+};
+
+// the dual numbers of L events at once, with the gradient w.r.t. the N arguments
+// of a constraint. The gradient is computed in the same order as by Dual
+
+template<std::size_t L, std::size_t N>
+struct DualLanes {
+  Lanes<L> Value;
+  Lanes<L> Gradient[N];
+
+  DualLanes(double value = 0) : Value(value), Gradient() {}
+  DualLanes(const double* values, std::size_t i) : Value(values), Gradient() {
+    Gradient[i] = 1;
+  }
+
+  // this = a*this + b*other
+  DualLanes& chain(const Lanes<L>& a, const DualLanes& other, const Lanes<L>& b) {
+    for(std::size_t i=0;i<N;i++)
+      Gradient[i] = Gradient[i]*a + b*other.Gradient[i];
+    return *this;
+  }
+
+  DualLanes& operator+=(const DualLanes& o) { Value += o.Value; return chain(1, o, 1); }
+  DualLanes& operator-=(const DualLanes& o) { Value -= o.Value; return chain(1, o, -1); }
+  DualLanes& operator*=(const DualLanes& o) {
+    const Lanes<L> v = Value;
+    Value *= o.Value;
+    return chain(o.Value, o, v);
+  }
+  DualLanes& operator/=(const DualLanes& o) {
+    Value /= o.Value;
+    return chain(1/o.Value, o, -Value/o.Value);
+  }
+
+  // derivative of a unary function at x, times the gradient of x
+  static DualLanes unary(const Lanes<L>& value, const Lanes<L>& derivative, const DualLanes& x) {
+    DualLanes r;
+    r.Value = value;
+    for(std::size_t i=0;i<N;i++)
+      r.Gradient[i] = derivative*x.Gradient[i];
+    return r;
+  }
+
+  friend DualLanes operator+(DualLanes a, const DualLanes& b) { return a += b; }
+  friend DualLanes operator-(DualLanes a, const DualLanes& b) { return a -= b; }
+  friend DualLanes operator*(DualLanes a, const DualLanes& b) { return a *= b; }
+  friend DualLanes operator/(DualLanes a, const DualLanes& b) { return a /= b; }
+  friend DualLanes operator+(const DualLanes& a) { return a; }
+  friend DualLanes operator-(const DualLanes& a) { return unary(-a.Value, -1, a); }
+
+  friend DualLanes sqrt(const DualLanes& x) {
+    const Lanes<L> v = sqrt(x.Value);
+    return unary(v, 0.5/v, x);
+  }
+  friend DualLanes exp(const DualLanes& x) {
+    const Lanes<L> v = exp(x.Value);
+    return unary(v, v, x);
+  }
+  friend DualLanes log(const DualLanes& x) { return unary(log(x.Value), 1/x.Value, x); }
+  friend DualLanes sin(const DualLanes& x) { return unary(sin(x.Value), cos(x.Value), x); }
+  friend DualLanes cos(const DualLanes& x) { return unary(cos(x.Value), -sin(x.Value), x); }
+  friend DualLanes tan(const DualLanes& x) {
+    const Lanes<L> v = tan(x.Value);
+    return unary(v, 1+v*v, x);
+  }
+  friend DualLanes asin(const DualLanes& x) { return unary(asin(x.Value), 1/sqrt(1-x.Value*x.Value), x); }
+  friend DualLanes acos(const DualLanes& x) { return unary(acos(x.Value), -1/sqrt(1-x.Value*x.Value), x); }
+  friend DualLanes atan(const DualLanes& x) { return unary(atan(x.Value), 1/(1+x.Value*x.Value), x); }
+  friend DualLanes atan2(const DualLanes& y, const DualLanes& x) {
+    const Lanes<L> r2 = x.Value*x.Value + y.Value*y.Value;
+    DualLanes r = unary(atan2(y.Value, x.Value), x.Value/r2, y);
+    return r.chain(1, x, -y.Value/r2);
+  }
+  friend DualLanes abs(const DualLanes& x) {
+    const Lanes<L> sign = Lanes<L>::map(x.Value, [] (double v) { return v<0 ? -1.0 : 1.0; });
+    return unary(abs(x.Value), sign, x);
+  }
+  friend DualLanes fabs(const DualLanes& x) { return abs(x); }
+  friend DualLanes pow(const DualLanes& x, double p) {
+    return unary(pow(x.Value, p), p*pow(x.Value, p-1), x);
+  }
+  friend DualLanes pow(const DualLanes& x, const DualLanes& p) {
+    // as for Dual, constant powers of negative x keep working
+    bool constant = true;
+    for(std::size_t i=0;i<N;i++) {
+      for(std::size_t l=0;l<L;l++)
+        constant &= p.Gradient[i].Value[l] == 0;
+    }
+    if(constant)
+      return unary(pow(x.Value, p.Value), p.Value*pow(x.Value, p.Value-1), x);
+    return exp(p*log(x));
+  }
+};
+
+// evaluates the generic functor f taking n double's for L events at once,
+// where argument k of the event in lane l is x[index[k]*L+l]. The values are written
+// to out[l], and the derivatives w.r.t. argument k to gradient[k*L+l] if gradient is given
+
+template<std::size_t L, typename F, std::size_t... I>
+void call_lanes(const F& f, const double* x, const std::size_t* index,
+                double* out, double* gradient, indices<I...>)
+{
+  if(gradient == nullptr) {
+    const Lanes<L> r = f(Lanes<L>(x+index[I]*L)...);
+    std::copy_n(r.Value, L, out);
+    return;
+  }
+  constexpr std::size_t n = sizeof...(I);
+  const DualLanes<L, n> r = f(DualLanes<L, n>(x+index[I]*L, I)...);
+  std::copy_n(r.Value.Value, L, out);
+  for(std::size_t k=0;k<n;k++)
+    std::copy_n(r.Gradient[k].Value, L, gradient+k*L);
+}
+
 } // end namespace APLCON_
 
 #endif // _APLCON_APLCON_HPP_HPP
-
@@ -0,0 +1,55 @@
+#ifndef _APLCON_APLCON_KERNELS_HPP
+#define _APLCON_APLCON_KERNELS_HPP 1
+
+#include <cstddef>
+
+namespace APLCON_ {
+
+/**
+ * @brief The Kernels_t struct holds the vectorized loops on vectors and packed symmetric
+ * matrices (lower triangle row by row), compiled for several instruction sets
+ *
+ * The loops sum in a fixed order and do not contract multiply-adds,
+ * so all variants give bit-identical results.
+ */
+struct Kernels_t {
+  /**
+   * @brief The ISA_t enum lists the variants, Default is SSE2 on x86-64
+   */
+  enum class ISA_t {
+    Default,
+    AVX2,
+    AVX512
+  };
+  ISA_t ISA;
+  // x*y of length n, in four interleaved partial sums
+  double (*Dot)(const double* x, const double* y, size_t n);
+  // y += a*x
+  void (*Axpy)(double a, const double* x, double* y, size_t n);
+  // y = a*x, also in place, so a = 1 copies and a = -1 negates
+  void (*Scale)(double a, const double* x, double* y, size_t n);
+  // d = diagonal of the packed V of size n
+  void (*Diagonal)(const double* V, size_t n, double* d);
+  // packed R_ij = V_ij*s_i*s_j of size n
+  void (*ScaleSymmetric)(const double* V, const double* s, size_t n, double* R);
+  // AV = A*V for the packed V of size N and A with M rows of length N
+  void (*MultiplyAV)(const double* V, const double* A, size_t N, size_t M, double* AV);
+  // packed W = X*A^T for X and A with M rows of length N, where W is symmetric
+  void (*MultiplyABt)(const double* X, const double* A, size_t N, size_t M, double* W);
+};
+
+/**
+ * @brief Kernels returns the best variant for the CPU, selected by cpuid at the first call
+ */
+const Kernels_t& Kernels();
+
+/**
+ * @brief KernelsFor returns the given variant
+ * @param isa instruction set
+ * @return nullptr if the CPU or the build does not support it
+ */
+const Kernels_t* KernelsFor(Kernels_t::ISA_t isa);
+
+} // namespace APLCON_
+
+#endif // _APLCON_APLCON_KERNELS_HPP
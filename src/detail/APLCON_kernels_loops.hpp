@@ -0,0 +1,79 @@
+// The loops of APLCON_::Kernels_t, included by APLCON_kernels.cc
+// once for each instruction set, within its own namespace
+
+double dot(const double* x, const double* y, size_t n)
+{
+  double sum[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for(;i+4<=n;i+=4) {
+    sum[0] += x[i]*y[i];
+    sum[1] += x[i+1]*y[i+1];
+    sum[2] += x[i+2]*y[i+2];
+    sum[3] += x[i+3]*y[i+3];
+  }
+  for(;i<n;i++)
+    sum[0] += x[i]*y[i];
+  return (sum[0]+sum[1])+(sum[2]+sum[3]);
+}
+
+void axpy(double a, const double* x, double* y, size_t n)
+{
+  for(size_t i=0;i<n;i++)
+    y[i] += a*x[i];
+}
+
+void scale(double a, const double* x, double* y, size_t n)
+{
+  for(size_t i=0;i<n;i++)
+    y[i] = a*x[i];
+}
+
+void diagonal(const double* V, size_t n, double* d)
+{
+  for(size_t i=0;i<n;i++)
+    d[i] = V[(i*i+3*i)/2];
+}
+
+void scale_symmetric(const double* V, const double* s, size_t n, double* R)
+{
+  for(size_t i=0;i<n;i++) {
+    const double s_i = s[i];
+    for(size_t j=0;j<=i;j++)
+      R[j] = V[j]*s_i*s[j];
+    V += i+1;
+    R += i+1;
+  }
+}
+
+// AV = A*V for the packed V, going through the packed rows of V once while they
+// are in cache: V_ik of row i with k<=i contributes to AV_jk, and to AV_ji if k<i,
+// so both are contiguous multiply-adds. The leading zeros of each row are skipped
+void multiply_av(const double* V, const double* A, size_t N, size_t M, double* AV)
+{
+  for(size_t k=0;k<M*N;k++)
+    AV[k] = 0;
+  for(size_t i=0;i<N;i++) {
+    const double* v = V+(i*i+i)/2;
+    size_t first = 0;
+    while(first < i && v[first] == 0)
+      first++;
+    for(size_t j=0;j<M;j++) {
+      const double* a = A+N*j;
+      double* y = AV+N*j;
+      const double aji = a[i];
+      if(aji != 0)
+        axpy(aji, v+first, y+first, i+1-first);
+      y[i] += dot(a+first, v+first, i-first);
+    }
+  }
+}
+
+// packed W = X*A^T for X and A with M rows of length N, where W is symmetric
+void multiply_abt(const double* X, const double* A, size_t N, size_t M, double* W)
+{
+  for(size_t j=0;j<M;j++) {
+    const double* x = X+N*j;
+    for(size_t l=0;l<=j;l++)
+      *W++ = dot(x, A+N*l, N);
+  }
+}
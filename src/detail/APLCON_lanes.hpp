@@ -0,0 +1,134 @@
+#ifndef _APLCON_APLCON_LANES_HPP
+#define _APLCON_APLCON_LANES_HPP 1
+
+#include "detail/APLCON_solver.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace APLCON_ {
+
+/**
+ * @brief The LaneSolver class fits L events of the same fit at once, one in each lane
+ *
+ * It runs the iterations of Solver::Fit for Gaussian variables and analytic derivatives,
+ * where each variable is measured in all events or in none. All vectors hold the L values
+ * of each element one after another, i.e. element i of lane l at i*L+l, so the loops over
+ * the lanes are vectorized. Only the tests of ANTEST differ between the lanes: each lane
+ * keeps its own state and does its cut-steps on its own, and is finished as soon as its
+ * fit is, so it can be loaded with the next event while the others continue.
+ * The equation system is solved by Cholesky factorizations of S = A*V*A^T + A_u*D*A_u^T,
+ * where the diagonal D over the unmeasured variables u does not change the solution,
+ * and of A_u^T*S^-1*A_u, which agrees with DUMINV up to rounding.
+ */
+template<std::size_t L>
+class LaneSolver {
+public:
+
+  // evaluate the constraints at all lanes of X into F
+  typedef std::function<void(const double* X, double* F)> evaluate_t;
+  // the derivatives of the constraints at all lanes of X into A,
+  // nX columns for each of the nF constraints
+  typedef std::function<void(const double* X, double* A)> jacobian_t;
+
+  /**
+   * @brief Init sets up the solver and sizes its storage, all lanes are empty
+   * @param measured true for the variables with non-zero sigma
+   * @param fixed true for the fixed variables, which must be measured
+   * @param nF number of scalar constraints
+   * @param settings fit settings, only the accuracies and MaxIterations are used
+   */
+  void Init(const std::vector<bool>& measured, const std::vector<bool>& fixed,
+            size_t nF, const Solver::Settings_t& settings);
+
+  /**
+   * @brief Load starts the fit of an event in lane l
+   * @param X values
+   * @param V packed covariance matrix
+   * @return false if the event's measured variables differ from the ones given to Init
+   */
+  bool Load(size_t l, const double* X, const double* V);
+
+  /**
+   * @brief Clear empties lane l
+   */
+  void Clear(size_t l) { state[l] = State_t::Empty; }
+
+  /**
+   * @brief Iterate evaluates the constraints in all running lanes, then each of them
+   * finishes its fit, does a cut-step, or computes the Jacobian for the next iteration
+   * @param evaluate callback for the constraints
+   * @param jacobian callback for the derivatives
+   */
+  void Iterate(const evaluate_t& evaluate, const jacobian_t& jacobian);
+
+  bool Running() const;
+  bool Finished(size_t l) const { return state[l] == State_t::Finished; }
+
+  /**
+   * @brief Status of a finished lane
+   * @return status as Solver::Fit, or -1 if the equation system is not positive definite,
+   * then the event needs to be fitted by Solver
+   */
+  int Status(size_t l) const { return status[l]; }
+
+  /**
+   * @brief Result copies the fit of a finished lane
+   * @param X fitted values
+   * @param V packed fitted covariance matrix
+   * @param pulls pulls
+   */
+  void Result(size_t l, double* X, double* V, double* pulls) const;
+
+  double ChiSquare(size_t l) const { return chisq[l]; }
+  int NDoF() const { return ndf; }
+  double Probability(size_t l) const { return ChiSquareProbability(chisq[l], ndf); }
+  int NIterations(size_t l) const { return iter[l]; }
+  int NFunctionCalls(size_t l) const { return ncalls[l]; }
+
+private:
+
+  enum class State_t {
+    Empty,
+    Start,    // loaded, waiting for its first evaluation
+    Running,
+    Finished
+  };
+
+  // setup of the fit, M and U index the measured and unmeasured variables
+  size_t nX = 0, nF = 0, nM = 0, nU = 0;
+  int ndf = 0;
+  std::vector<size_t> M, U;
+  std::vector<bool> fixed;
+  Solver::Settings_t settings = Solver::Settings_t::Default;
+
+  // state of each lane, named as in Solver
+  State_t state[L];
+  int status[L], iter[L], ncst[L], ncalls[L];
+  double chisq[L], chsqp[L], ftest[L], ftestp[L], weight[L];
+  // the lanes which do the next iteration, and which have finished in this one
+  bool next[L], finish[L];
+
+  // lane by lane storage, V is replaced by the fitted covariance matrix when finished
+  std::vector<double> X, V, F, XS, DX, XP, A, AJ, pulls;
+  // equation system: the right-hand side R, Y = A*V over the measured variables,
+  // the Cholesky factor of S = A*V*A^T + A_u*D*A_u^T, the columns AU = L^-1*A_u of
+  // the unmeasured variables, the factor of KM = AU^T*AU, the solution in TX, and
+  // temporary vectors TF, TU of size nF, nU. Finish uses L^-1*Y in TY, TG of size
+  // nU*nM and VF for the result
+  std::vector<double> R, Y, S, D, AU, KM, TX, TF, TU, TY, TG, VF;
+  bool failed[L]; // set by Decompose if not positive definite
+
+  void AddToX(size_t l);
+  int TestConvergence(size_t l);
+  void NextIteration();
+  void Finish();
+  void Decompose(double* S, size_t n);
+  void SolveLower(const double* S, size_t n, double* b) const;
+  void SolveUpper(const double* S, size_t n, double* b) const;
+};
+
+} // namespace APLCON_
+
+#endif // _APLCON_APLCON_LANES_HPP
@@ -3,7 +3,9 @@
 
 #include "APLCON.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <memory>
 #include <string>
 #include <ostream>
 #include <iomanip>
@@ -105,6 +107,23 @@ std::ostream& operator<< (std::ostream& o, const APLCON::Variable_Settings_t& s)
            << std::right;
 }
 
+namespace APLCON_ {
+
+// packed matrices of a result, indexed in the order of the variables map
+struct packed_matrices_t {
+  std::vector<size_t> Order; // index of i-th map entry in packed matrices
+  std::vector<double> CorrelationsBefore;
+  std::vector<double> CorrelationsAfter;
+  const std::vector<double>* CovariancesBefore = nullptr;
+  const std::vector<double>* CovariancesAfter = nullptr;
+
+  double at(const std::vector<double>& V, size_t i, size_t j) const {
+    return V[V_ij(Order[i], Order[j])];
+  }
+};
+
+} // namespace APLCON_
+
 template<typename F>
 void stringify_covariances(
     std::ostream& o,
@@ -135,7 +154,8 @@ void stringify_covariances(
 
   // print matrix
 
-  std::vector<APLCON::Result_Variable_t> v_variables;
+  std::vector<bool> skip;
+  skip.reserve(variables.size());
 
   for(const auto& it_zipped : APLCON_::index(variables)) {
     const size_t i = it_zipped.first;
@@ -143,9 +163,9 @@ void stringify_covariances(
     const std::string varname = it_map.first;
     const APLCON::Result_Variable_t& v = it_map.second;
 
-    v_variables.emplace_back(v);
+    skip.push_back(skipUnmeasured && v.Sigma.Before == 0);
 
-    if(skipUnmeasured && v.Sigma.Before == 0)
+    if(skip.back())
       continue;
 
     std::stringstream i_;
@@ -154,19 +174,10 @@ void stringify_covariances(
     o << in << std::setw(4-padding) << i_.str()
       << std::left << std::setw(w_varname-4) << varname << std::right;
 
-    const auto& cov = f(varname, v);
-    for(const auto& it_zipped : APLCON_::index(cov)) {
-      const size_t j = it_zipped.first;
-      const auto& it_map = it_zipped.second;
-      const double& cov_val = it_map.second;
-
-      if(j>i)
+    for(size_t j=0;j<=i;j++) {
+      if(skip[j])
         continue;
-
-      const APLCON::Result_Variable_t& v_j = v_variables[j];
-      if(skipUnmeasured && v_j.Sigma.Before == 0)
-        continue;
-      o << std::setw(w) << cov_val*factor;
+      o << std::setw(w) << f(i, j)*factor;
     }
     o << std::endl;
   }
@@ -189,6 +200,7 @@ void stringify_covariances(
 void stringify_variables(
     std::ostream& o,
     const std::map<std::string, APLCON::Result_Variable_t>& variables,
+    const APLCON_::packed_matrices_t* packed,
     const std::string& extra_indent = "",
     const bool success = true) {
   // do some extra work and find out the maximum length of
@@ -201,10 +213,6 @@ void stringify_variables(
   }
   w_varname += 2;
 
-
-  // calculate the correlations
-  auto correlations = APLCON::CalculateCorrelations(variables);
-
   const std::string& in = extra_indent + APLCON::PrintFormatting::Indent;
   const std::string& ma = extra_indent + APLCON::PrintFormatting::Marker;
 
@@ -232,26 +240,23 @@ void stringify_variables(
   }
   o << std::endl;
 
-  if(!correlations.empty()) {
+  if(packed != nullptr) {
       o << in << "Covariances: " << std::endl;
       stringify_covariances(o, variables, in,
-                            [](const std::string&, const APLCON::Result_Variable_t& v) {
-          return v.Covariances.Before;
+                            [packed] (size_t i, size_t j) {
+          return packed->at(*packed->CovariancesBefore, i, j);
       },
       w_varname,
       true);
       o << std::endl;
       o << in << "Correlations (in %): " << std::endl;
-      auto correlations_before = [&correlations]
-              (const std::string& varname,
-              const APLCON::Result_Variable_t&) {
-          return correlations[varname].Before;
-      };
       stringify_covariances(o, variables, in,
-                            correlations_before,
-                            w_varname,
-                            true,
-                            100);
+                            [packed] (size_t i, size_t j) {
+          return packed->at(packed->CorrelationsBefore, i, j);
+      },
+      w_varname,
+      true,
+      100);
   }
 
   if(!success)
@@ -276,26 +281,23 @@ void stringify_variables(
   }
   o << std::endl;
 
-  if(!correlations.empty()) {
+  if(packed != nullptr) {
       o << in << "Covariances: " << std::endl;
       stringify_covariances(o, variables, in,
-                            [](const std::string&, const APLCON::Result_Variable_t& v) {
-          return v.Covariances.After;
+                            [packed] (size_t i, size_t j) {
+          return packed->at(*packed->CovariancesAfter, i, j);
       },
       w_varname,
       false);
       o << std::endl;
       o << in << "Correlations (in %): " << std::endl;
-      auto correlations_after = [&correlations]
-              (const std::string& varname,
-              const APLCON::Result_Variable_t&) {
-          return correlations[varname].After;
-      };
       stringify_covariances(o, variables, in,
-                            correlations_after,
-                            w_varname,
-                            false,
-                            100);
+                            [packed] (size_t i, size_t j) {
+          return packed->at(packed->CorrelationsAfter, i, j);
+      },
+      w_varname,
+      false,
+      100);
 
   }
 
@@ -329,7 +331,25 @@ std::ostream& operator<< (std::ostream& o, const APLCON::Result_t& r) {
   }
   o << std::endl;
 
-  stringify_variables(o, r.Variables, in, success);
+  if(!r.Table || r.Covariances.empty()) {
+    // covariances skipped, see Fit_Settings_t::SkipCovariancesInResult
+    stringify_variables(o, r.Variables, nullptr, in, success);
+    return o;
+  }
+
+  // print from the packed matrices, sorted like the variables map
+  APLCON_::packed_matrices_t packed;
+  const std::vector<std::string>& names = r.Table->VariableNames;
+  packed.Order.resize(names.size());
+  for(size_t i=0;i<names.size();i++)
+    packed.Order[i] = i;
+  std::sort(packed.Order.begin(), packed.Order.end(),
+            [&names] (size_t i, size_t j) { return names[i] < names[j]; });
+  packed.CovariancesBefore = std::addressof(r.CovariancesBefore);
+  packed.CovariancesAfter = std::addressof(r.Covariances);
+  APLCON::CalculateCorrelations(r.CovariancesBefore, packed.CorrelationsBefore);
+  APLCON::CalculateCorrelations(r.Covariances, packed.CorrelationsAfter);
+  stringify_variables(o, r.Variables, std::addressof(packed), in, success);
   return o;
 }
 
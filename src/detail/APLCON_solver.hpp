@@ -0,0 +1,242 @@
+#ifndef _APLCON_APLCON_SOLVER_HPP
+#define _APLCON_APLCON_SOLVER_HPP 1
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace APLCON_ {
+
+/**
+ * @brief The Solver class is the native C++ implementation of APLCON's fit
+ *
+ * It follows the Fortran routines IPLOOP, ASTEPS, ANUMDE, ANITER, ANTEST, ADDTOX,
+ * ACOPXV and DUMINV (see APLCON/aploop.F and APLCON/condutil.F) step by step,
+ * but calls the constraints directly instead of returning to the caller for each evaluation.
+ * The state of a fit is kept in the instance, and the storage is only sized in Init(),
+ * so independent instances can fit concurrently and Fit() does not allocate.
+ * With WarmStart, a fit reuses the final step sizes and the last Jacobian
+ * of the previous converged fit instead of computing them in the first iteration.
+ * With BroydenUpdates, the Jacobian is updated between iterations like ABROYD.
+ * The numerical derivatives only evaluate the constraints depending on the displaced
+ * variable (see Variable_t::Rows), the other elements of its column are zero.
+ * Variables of the same Variable_t::Group are displaced at once.
+ * With EvaluatePointsAtOnce, the displaced points of the numerical derivatives
+ * are handed to the caller all at once, which may evaluate them concurrently.
+ * Large fits with a sparse Jacobian eliminate the measured variables using the Rows
+ * and the non-zero covariances, and only invert the remaining system of the
+ * constraints and unmeasured variables (see SolveSparse).
+ * Without unmeasured variables, both reduce to A*V*A^T, which is solved by a
+ * Cholesky factorization unless it is not positive definite (see SolveCholesky).
+ * Profile analysis and debug printout are not supported.
+ */
+class Solver {
+public:
+
+  /**
+   * @brief The Transformation_t enum, numbered like NTVAR in the Fortran code
+   */
+  enum class Transformation_t : int {
+    None = 0,
+    Poisson = 2,
+    LogNormal = 4,
+    SquareRoot = 5
+  };
+
+  /**
+   * @brief The Variable_t struct contains the settings of one variable (see APSTEP, APLIMT, ...)
+   */
+  struct Variable_t {
+    Transformation_t Transformation;
+    double Low;    // limits are only used if Low != High
+    double High;
+    double Step;   // step size for numerical derivatives, 0 if undefined
+    bool Fixed;
+    bool Analytic; // derivatives provided by SetJacobianRow, not differentiated numerically
+    // ranges [first, second) of the constraints depending on this variable
+    std::vector< std::pair<size_t, size_t> > Rows;
+    // variables of the same group must not share any row
+    size_t Group;
+  };
+
+  /**
+   * @brief The Settings_t struct corresponds to EPSF, EPSCHI, ITERMX, DERFAC, DERUFC and DERLOW
+   */
+  struct Settings_t {
+    double ConstraintAccuracy;
+    double Chi2Accuracy;
+    int    MaxIterations;
+    double MeasuredStepSizeFactor;
+    double UnmeasuredStepSizeFactor;
+    double MinimalStepSizeFactor;
+    bool   WarmStart;
+    bool   BroydenUpdates; // see APBROY
+    bool   EvaluatePointsAtOnce; // see evaluate_points_t
+    const static Settings_t Default;
+  };
+
+  // evaluate the constraints at the current X into F
+  typedef std::function<void()> evaluate_t;
+  // provide the analytic rows of the Jacobian at the current X by SetJacobianRow
+  typedef std::function<void()> jacobian_t;
+  // evaluate the constraints at n points, where point k is X with X[columns[l]]
+  // replaced by values[l] for offsets[k] <= l < offsets[k+1], writing the rows
+  // of Variable_t::Rows of those variables consecutively to F[k]
+  typedef std::function<void(const double* X, const size_t* columns, const double* values,
+                             const size_t* offsets, size_t n, double* const* F)> evaluate_points_t;
+
+  /**
+   * @brief The Timing_t struct accumulates the wall time in seconds of the phases of Fit()
+   */
+  struct Timing_t {
+    double Constraints; // evaluations outside the numerical derivatives, and jacobian
+    double Derivatives; // numerical derivatives, including their evaluations
+    double Matrix;      // next iteration, i.e. mostly solving the equation system
+  };
+
+  /**
+   * @brief Init sets up the solver and sizes its storage
+   * @param variables settings of all nX variables
+   * @param nF number of scalar constraints
+   * @param settings fit settings
+   */
+  void Init(const std::vector<Variable_t>& variables, size_t nF, const Settings_t& settings);
+
+  /**
+   * @brief Fit runs the fit
+   * @param X values, replaced by the fitted values
+   * @param V packed covariance matrix, replaced by the fitted one
+   * @param F storage for the constraints, filled by evaluate
+   * @param evaluate callback to evaluate the constraints
+   * @param jacobian callback for analytic derivatives, only called if any variable is Analytic
+   * @param evaluate_points callback for the numerical derivatives, called with all
+   * points of a Jacobian if EvaluatePointsAtOnce, otherwise with the two points of each group
+   * @param timing optional, the time spent in each phase is added if given
+   * @return status as APLOOP's IRET, i.e. 0 for convergence or 2 for too many iterations
+   */
+  int Fit(double* X, double* V, double* F,
+          const evaluate_t& evaluate, const jacobian_t& jacobian,
+          const evaluate_points_t& evaluate_points,
+          Timing_t* timing = nullptr);
+
+  /**
+   * @brief SetJacobianRow stores the analytic derivatives of constraint j, see APJROW
+   * @param j index of the constraint, starting at 0
+   * @param X current values
+   * @param row derivatives w.r.t. all variables
+   */
+  void SetJacobianRow(size_t j, const double* X, const double* row);
+
+  /**
+   * @brief ClearWarmStart lets the next fit start from scratch, see Settings_t::WarmStart
+   */
+  void ClearWarmStart() { warm = false; }
+
+  const Settings_t& GetSettings() const { return settings; }
+  const std::vector<Variable_t>& GetVariables() const { return variables; }
+
+  double ChiSquare() const { return chisq; }
+  int NDoF() const { return ndf; }
+  double Probability() const;
+  int NIterations() const { return iter; }
+  int NFunctionCalls() const { return ncalls; }
+  int NJacobians() const { return njacobians; }
+  int NCutSteps() const { return ncutsteps; }
+  int MatrixRank() const { return rank; }
+  int NReusedColumns() const { return nreused; }
+  const std::vector<double>& Pulls() const { return pulls; }
+
+private:
+
+  // setup of the fit
+  size_t nX = 0;
+  size_t nF = 0;
+  std::vector<Variable_t> variables;
+  Settings_t settings = Settings_t::Default;
+
+  // state of a fit, named as their counterparts in comcfit.inc
+  std::vector<Transformation_t> ntvar; // reset to None for non-positive values
+  std::vector<int> ntder; // 1 if computed, 2 if linear and not recomputed, see NTDER
+  double chisq = 0, chsqp = 0, ftest = 0, ftestp = 0, weight = 1;
+  int ndf = 0, iter = 0, ncst = 0, ncalls = 0;
+  // statistics, see APLSTA
+  int njacobians = 0, ncutsteps = 0, rank = 0, nreused = 0;
+  // steps and transformations of the previous converged fit, its Jacobian is kept in A
+  bool warm = false;
+  std::vector<double> ST_warm;
+  std::vector<Transformation_t> ntvar_warm;
+
+  // storage, see APLOOP for the layout of AUX
+  std::vector<double> A;  // Jacobian, nX columns for each of the nF constraints
+  std::vector<double> ST, XS, DX, XP, pulls;
+  std::vector<double> FC, FCOPY, HH;
+  std::vector<double> RH, WM, DIAG; // equation system of size nX+nF
+  std::vector<int> QNEXT;
+  // the variables GV ordered by group, starting at GOFF,
+  // and the number of rows depending on each variable
+  std::vector<size_t> GV, GOFF, NROWS;
+  // the differentiated columns: variable, external and internal displaced values,
+  // steps to both sides (see ANUMDE) and the rows of the constraints there in FD
+  std::vector<size_t> DCOL, KCOL;
+  std::vector<double> XD, XT, FD;
+  std::vector<int> ILRDER;
+  std::vector<const double*> FK;
+  // the displaced points, two for each group, see evaluate_points_t
+  std::vector<size_t> PC, POFF;
+  std::vector<double> PV;
+  std::vector<double*> PF;
+  // sparse path instead of WM: the nU unmeasured variables KU (KQ is their position,
+  // or nX if measured), the non-zero off-diagonal covariances VN of each measured
+  // variable from VOFF, the diagonal VD used in the last iteration, the reduced
+  // system KW of size nU+nF with the right-hand side KB, A^T*RH in VY, and in Finish
+  // the product of KW with a column G of A*V in E (GS marks the rows in GJ)
+  bool sparse = false;
+  size_t nU = 0, nG = 0, gstamp = 0;
+  std::vector<size_t> KU, KQ, VOFF, GJ, GS;
+  std::vector< std::pair<size_t, double> > VN;
+  std::vector<double> VD, VY, KW, KB, G, E;
+  // Cholesky path without unmeasured variables: the packed factor of A*V*A^T in CS,
+  // A*V in CY (only without the sparse path), and a vector CB of size nF
+  bool cholesky = false;
+  std::vector<double> CS, CY, CB;
+
+  void SetSteps(double* X, double* V);
+  void NumericalDerivatives(double* X, const evaluate_points_t& evaluate_points);
+  void SetColumn(size_t k);
+  bool BroydenUpdate(const double* F);
+  void NextIteration(const double* X, const double* V);
+  int TestConvergence();
+  void AddToX(double* X);
+  void Finish(const double* X, double* V);
+  void SolveMatrix(); // DUMINV
+  bool SolveCholesky();
+  void CholeskyCovariance();
+  void InitSparse(const double* V);
+  void SolveSparse(const double* X, const double* V);
+  void FinishSparse(double* V);
+  void ColumnAV(size_t k); // column k of A*V into G, its nG rows into GJ
+};
+
+/**
+ * @brief SMAVAT computes W = A*V*A^T like the Fortran routine SMAVAT in condutil.F
+ * @param V packed symmetric N-by-N matrix
+ * @param A M-by-N matrix, stored row by row
+ * @param N number of columns of A
+ * @param M number of rows of A
+ * @param AV storage for M*N elements, filled with A*V
+ * @param W packed symmetric M-by-M result
+ */
+void SMAVAT(const double* V, const double* A, size_t N, size_t M, double* AV, double* W);
+
+/**
+ * @brief ChiSquareProbability computes the p-value like the Fortran function CHPROB
+ * @param chisq chi-square
+ * @param ndf number of degrees of freedom
+ * @return probability to find a larger chi-square
+ */
+double ChiSquareProbability(double chisq, int ndf);
+
+} // namespace APLCON_
+
+#endif // _APLCON_APLCON_SOLVER_HPP
@@ -0,0 +1,275 @@
+#ifndef _APLCON_APLCON_STATIC_HPP
+#define _APLCON_APLCON_STATIC_HPP 1
+
+// included at the end of APLCON.hpp, as APLCON::Static needs the complete APLCON class
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace APLCON_ {
+
+// true if the functor F can be called as f(x, out) with std::array's of T,
+// x of size NVar and out of size NCon
+
+template<typename F, typename T, std::size_t NVar, std::size_t NCon>
+struct is_array_callable {
+  template<typename G>
+  static auto check(const G* g) -> decltype((*g)(std::declval<const std::array<T, NVar>&>(),
+                                                 std::declval<std::array<T, NCon>&>()),
+                                            std::true_type());
+  static std::false_type check(...);
+  static constexpr bool value = decltype(check(static_cast<const F*>(nullptr)))::value;
+};
+
+} // namespace APLCON_
+
+/**
+ * @brief The APLCON::Static class fits NVar scalar variables with NCon scalar constraints
+ *
+ * The values, covariances and constraints are kept in std::array's, and the constraints are
+ * one functor of type Constraints, which is called directly as constraints(x, f) with
+ * x of type const std::array<T, NVar>& and f of type std::array<T, NCon>&.
+ * If its call operator is templated, the derivatives are computed with the dual numbers
+ * APLCON_::DualLanes<1, NVar>, otherwise numerically, displacing one variable at a time.
+ *
+ * The fit is always done by the Native engine, so Engine, CollectStatistics, DerivativeThreads,
+ * BatchLanes and AllocationCounter of Fit_Settings_t are ignored. The result is the same as for
+ * an APLCON instance with the same variables and one constraint named "Constraints", but the
+ * variables are kept in the given order.
+ */
+template<std::size_t NVar, std::size_t NCon, typename Constraints>
+class APLCON::Static {
+public:
+  static_assert(NVar > 0 && NCon > 0, "APLCON::Static needs variables and constraints");
+  static_assert(APLCON_::is_array_callable<Constraints, double, NVar, NCon>::value,
+                "Constraints must be callable with (const std::array<double, NVar>&, std::array<double, NCon>&)");
+
+  typedef std::array<double, NVar> values_t;
+  typedef std::array<double, NVar*(NVar+1)/2> covariances_t;
+  typedef std::array<double, NCon> constraints_t;
+
+  // true if the derivatives are computed with dual numbers
+  static constexpr bool Analytic =
+      APLCON_::is_array_callable<Constraints, APLCON_::DualLanes<1, NVar>, NVar, NCon>::value;
+
+  /**
+   * @brief V_ij index of element (i,j) in the packed covariance matrices, as in Compact_Result_t
+   */
+  static constexpr std::size_t V_ij(std::size_t i, std::size_t j) {
+    return i>j ? i*(i+1)/2 + j : j*(j+1)/2 + i;
+  }
+
+  /**
+   * @brief Create new instance, all variables are unmeasured and zero
+   * @param _name name of the instance, as in the result
+   * @param _variable_names names of the variables, in the order of the arrays
+   * @param _constraints the constraints functor
+   * @param _fit_settings
+   */
+  Static(const std::string& _name,
+         const std::array<std::string, NVar>& _variable_names,
+         const Constraints& _constraints = Constraints(),
+         const Fit_Settings_t& _fit_settings = Fit_Settings_t::Default) :
+    instance_name(_name),
+    variable_names(_variable_names),
+    constraints(_constraints),
+    fit_settings(_fit_settings)
+  {
+    X_before.fill(0);
+    V_before.fill(0);
+    variable_settings.fill(Variable_Settings_t::Default);
+  }
+
+  /**
+   * @brief SetVariable sets the start value and sigma of variable i
+   * @param sigma 0 for an unmeasured variable
+   */
+  void SetVariable(std::size_t i, double value, double sigma) {
+    X_before[i] = value;
+    V_before[V_ij(i,i)] = sigma*sigma;
+  }
+
+  /**
+   * @brief SetCovariance sets the covariance of variables i and j
+   */
+  void SetCovariance(std::size_t i, std::size_t j, double covariance) {
+    V_before[V_ij(i,j)] = covariance;
+  }
+
+  /**
+   * @brief SetVariableSettings changes the settings of variable i, e.g. to fix it
+   * @note the instance is initialized again in the next fit
+   */
+  void SetVariableSettings(std::size_t i, const Variable_Settings_t& settings) {
+    variable_settings[i] = settings;
+    initialized = false;
+  }
+
+  const Fit_Settings_t& GetSettings() const { return fit_settings; }
+  void SetSettings(const Fit_Settings_t& settings) {
+    fit_settings = settings;
+    initialized = false;
+  }
+
+  const values_t& Values() const { return X_before; }
+  const covariances_t& Covariances() const { return V_before; }
+
+  /**
+   * @brief DoFit does the fit, the set values and covariances are not changed
+   * @param result is filled like by APLCON::DoFit, reusing its storage
+   */
+  void DoFit(Compact_Result_t& result) {
+    if(!initialized)
+      Init();
+
+    X = X_before;
+    V = V_before;
+    // start unmeasured variables at the previous solution
+    if(warm) {
+      for(std::size_t i=0;i<NVar;i++) {
+        if(V[V_ij(i,i)] == 0)
+          X[i] = X_warm[i];
+      }
+    }
+
+    const int ret = solver.Fit(X.data(), V.data(), F.data(),
+                               [this] () { constraints(X, F); },
+                               [this] () { SetJacobianRows(std::integral_constant<bool, Analytic>()); },
+                               [this] (const double*, const std::size_t* columns, const double* values,
+                                       const std::size_t* offsets, std::size_t n, double* const* f) {
+      EvaluatePoints(columns, values, offsets, n, f);
+    });
+    if(ret >= static_cast<int>(Result_Status_t::_Unknown)) {
+      throw Error("Unkown return value after APLCON fit");
+    }
+    result.Status = static_cast<Result_Status_t>(ret);
+    warm = fit_settings.WarmStart == WarmStart_t::Unmeasured && result.Status == Result_Status_t::Success;
+    if(warm)
+      X_warm = X;
+    FillResult(result);
+  }
+
+  /**
+   * @brief DoFit does the fit
+   * @return the result as returned by APLCON::DoFit
+   */
+  Result_t DoFit() {
+    Compact_Result_t result;
+    DoFit(result);
+    return result.ToResult();
+  }
+
+private:
+
+  std::string instance_name;
+  std::array<std::string, NVar> variable_names;
+  std::array<Variable_Settings_t, NVar> variable_settings;
+  Constraints constraints;
+  Fit_Settings_t fit_settings;
+  bool initialized = false;
+
+  // the set values, and the storage for the fit as in APLCON
+  values_t X_before, X, X_center, X_warm;
+  covariances_t V_before, V;
+  constraints_t F, F_point;
+  bool warm = false;
+
+  APLCON_::Solver solver;
+  std::shared_ptr<const Result_Table_t> result_table;
+
+  void Init() {
+    // each variable depends on all constraints, so all are differentiated one by one
+    std::vector<APLCON_::Solver::Variable_t> solver_variables(NVar);
+    for(std::size_t i=0;i<NVar;i++) {
+      APLCON_::Solver::Variable_t& v = solver_variables[i];
+      v = SolverVariable(variable_settings[i]);
+      v.Analytic = Analytic;
+      v.Rows.emplace_back(0, NCon);
+      v.Group = i;
+    }
+    solver.Init(solver_variables, NCon, SolverSettings(fit_settings));
+
+    auto table = std::make_shared<Result_Table_t>();
+    table->VariableNames.assign(variable_names.begin(), variable_names.end());
+    table->PristineNames = table->VariableNames;
+    table->Dimensions.assign(NVar, 1);
+    table->Indices.assign(NVar, 0);
+    table->Settings.assign(variable_settings.begin(), variable_settings.end());
+    table->Constraints["Constraints"].Dimension = NCon;
+    result_table = table;
+
+    warm = false;
+    initialized = true;
+  }
+
+  // the derivatives of the dual numbers are the rows of the Jacobian
+  void SetJacobianRows(std::true_type) {
+    typedef APLCON_::DualLanes<1, NVar> dual_t;
+    std::array<dual_t, NVar> x;
+    for(std::size_t i=0;i<NVar;i++)
+      x[i] = dual_t(&X[i], i);
+    std::array<dual_t, NCon> f;
+    constraints(x, f);
+    values_t row;
+    for(std::size_t j=0;j<NCon;j++) {
+      for(std::size_t i=0;i<NVar;i++)
+        row[i] = f[j].Gradient[i].Value[0];
+      solver.SetJacobianRow(j, X.data(), row.data());
+    }
+  }
+  void SetJacobianRows(std::false_type) {}
+
+  // each variable has its own group, so each point displaces one variable of X,
+  // and all constraints are written to f[k]
+  void EvaluatePoints(const std::size_t* columns, const double* values,
+                      const std::size_t* offsets, std::size_t n, double* const* f) {
+    for(std::size_t k=0;k<n;k++) {
+      for(std::size_t l=offsets[k];l<offsets[k+1];l++) {
+        X_center[columns[l]] = X[columns[l]];
+        X[columns[l]] = values[l];
+      }
+      constraints(X, F_point);
+      std::copy(F_point.begin(), F_point.end(), f[k]);
+      for(std::size_t l=offsets[k];l<offsets[k+1];l++)
+        X[columns[l]] = X_center[columns[l]];
+    }
+  }
+
+  void FillResult(Compact_Result_t& result) const {
+    result.Name = instance_name;
+    result.ChiSquare = solver.ChiSquare();
+    result.NDoF = solver.NDoF();
+    result.Probability = solver.Probability();
+    result.NIterations = solver.NIterations();
+    result.NFunctionCalls = solver.NFunctionCalls();
+    result.NScalarConstraints = NCon;
+    result.Table = result_table;
+    result.Statistics = Result_t::Default.Statistics;
+
+    result.ValuesBefore.assign(X_before.begin(), X_before.end());
+    result.Values.assign(X.begin(), X.end());
+    result.Pulls.assign(solver.Pulls().begin(), solver.Pulls().begin()+NVar);
+    result.SigmasBefore.resize(NVar);
+    result.Sigmas.resize(NVar);
+    for(std::size_t i=0;i<NVar;i++) {
+      result.SigmasBefore[i] = std::sqrt(V_before[V_ij(i,i)]);
+      result.Sigmas[i] = std::sqrt(V[V_ij(i,i)]);
+    }
+
+    if(fit_settings.SkipCovariancesInResult) {
+      result.CovariancesBefore.clear();
+      result.Covariances.clear();
+      return;
+    }
+    result.CovariancesBefore.assign(V_before.begin(), V_before.end());
+    result.Covariances.assign(V.begin(), V.end());
+  }
+};
+
+#endif // _APLCON_APLCON_STATIC_HPP
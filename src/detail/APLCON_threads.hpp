@@ -0,0 +1,59 @@
+#ifndef _APLCON_APLCON_THREADS_HPP
+#define _APLCON_APLCON_THREADS_HPP 1
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace APLCON_ {
+
+/**
+ * @brief The ThreadPool class keeps threads waiting for work, so they are not started for each task
+ *
+ * Run(n, task) calls task(t) for t = 0..n-1 concurrently, task(0) in the calling thread
+ * and the others in the waiting threads, and returns once all calls have finished.
+ * The threads are started by Resize(), and only stopped by Resize() with another number
+ * or the destructor. A copy of a pool starts without threads, so copying
+ * the owning instance never shares them.
+ */
+class ThreadPool {
+public:
+  ThreadPool() = default;
+  ThreadPool(const ThreadPool&) : ThreadPool() {}
+  ThreadPool& operator= (const ThreadPool&) = delete;
+  ~ThreadPool() { Resize(1); }
+
+  /**
+   * @brief Resize starts or stops threads, so that n tasks can run at once, including the caller
+   */
+  void Resize(size_t n);
+  size_t Size() const { return threads.size()+1; }
+
+  /**
+   * @brief Run calls task(t) for t < min(n, Size()), and waits for all of them
+   * @note the first exception thrown by a task is rethrown after all have finished
+   */
+  void Run(size_t n, const std::function<void(size_t)>& task);
+
+private:
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  // wakeup signals a new task (or stop) to the threads, done the end of the last call to the caller
+  std::condition_variable wakeup, done;
+  const std::function<void(size_t)>* task = nullptr;
+  size_t nTasks = 0;
+  size_t running = 0;
+  size_t generation = 0;
+  bool stop = false;
+  std::exception_ptr error;
+
+  void Loop(size_t t, size_t seen);
+};
+
+} // namespace APLCON_
+
+#endif // _APLCON_APLCON_THREADS_HPP
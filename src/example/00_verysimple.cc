@@ -26,14 +26,13 @@ int main() {
   cout << ra << endl;
 
   // this shows what can access in the result structure "ra"
-  // note that the correlations must be calculated on demand
+  // note that the correlations are calculated on demand
   cout << "C's value (should be 30 due to constraint):         "
        << ra.Variables.at("C").Value.After << endl;
   cout << "C's sigma (should be 0.5 due to error propagation): "
        << ra.Variables.at("C").Sigma.After << endl;
-  const auto& correlations = APLCON::CalculateCorrelations(ra.Variables);
   cout << "Correlation between C and B:                        ";
-  cout << 100*correlations.at("C").After.at("B") << " %" << endl << endl;
+  cout << 100*ra.Correlation("C", "B") << " %" << endl << endl;
 
   // let's try the same with Poissonian variables
   APLCON b("Poissonian error propagation");
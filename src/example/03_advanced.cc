@@ -56,10 +56,10 @@ int main() {
   // you might have also specified the particle by energy, theta and phi
 
   // for instance a, we separate E and p
-  constexpr auto linker_E = [] (Vec& v) -> vector<double*> {
+  const auto linker_E = [] (Vec& v) -> vector<double*> {
     return {addressof(v.E)};
   };
-  constexpr auto linker_p = [] (Vec& v) -> vector<double*> {
+  const auto linker_p = [] (Vec& v) -> vector<double*> {
     return {addressof(v.px), addressof(v.py), addressof(v.pz)};
   };
   APLCON::Variable_Settings_t fixvar = APLCON::Variable_Settings_t::Default;
@@ -138,7 +138,7 @@ int main() {
   // in case of (3), (4) the provided constraint aggregates several scalar constraints into one function
 
   // example for case (2)
-  constexpr auto invariant_mass = [] (const vector<double>& E, const vector<double>& p) -> double {
+  const auto invariant_mass = [] (const vector<double>& E, const vector<double>& p) -> double {
     // note that, although E is a scalar variable,
     // it is provided as a vector with one element
     // (mixing scalar/vector arguments are not supported at the moment)
@@ -150,7 +150,7 @@ int main() {
   a.AddConstraint("invariant_mass2", {"Vec2_E", "Vec2_p"}, invariant_mass);
 
   // example for case (4)
-  constexpr auto opposite_momentum_3 = [] (const vector<double>& a, const vector<double>& b) -> vector<double> {
+  const auto opposite_momentum_3 = [] (const vector<double>& a, const vector<double>& b) -> vector<double> {
     // one may check that the vectors a, b have the appropiate lengths
     // that's something the interface can't do for you...
     return {
@@ -164,7 +164,7 @@ int main() {
 
   // to make the fit at least somewhat meaningful, provide the four-momentum conservation,
   // so Vec1+Vec2=Vec3 aka Vec1+Vec2-Vec3 = 0
-  constexpr auto require_conservation = [] (
+  const auto require_conservation = [] (
       const vector<double>& v1_E,
       const vector<double>& v1_p,
       const vector<double>& v2_E,
@@ -198,7 +198,7 @@ int main() {
   Vec vec3b = vec3a;
 
   // for instance b, we link all 4 components at once
-  constexpr auto linker4   = [] (Vec& v) -> vector<double*> {
+  const auto linker4   = [] (Vec& v) -> vector<double*> {
     return {addressof(v.E), addressof(v.px), addressof(v.py), addressof(v.pz)};
   };
   b.LinkVariable("Vec1", linker4(vec1b), sigma1);
@@ -221,7 +221,7 @@ int main() {
     NaN, pzpx, pzpy
   };
   // then we create the pointers array with some general lambda
-  constexpr auto link_vector = [] (vector<double>& v) {
+  const auto link_vector = [] (vector<double>& v) {
     vector<double*> vp;
     vp.resize(v.size());
     transform(v.begin(),v.end(),vp.begin(), [] (double& d) {return addressof(d);});
@@ -275,7 +275,7 @@ int main() {
   b.AddConstraint("invariant_mass1", {"Vec1"}, parametrized_invariant_mass);
   b.AddConstraint("invariant_mass2", {"Vec2"}, parametrized_invariant_mass);
 
-  constexpr auto opposite_momentum_4 = [] (const vector<double>& a, const vector<double>& b) -> vector<double> {
+  const auto opposite_momentum_4 = [] (const vector<double>& a, const vector<double>& b) -> vector<double> {
     // one may check that the vectors a, b have the appropiate lengths
     // that's something the interface can't do for you...
     return {
@@ -288,7 +288,7 @@ int main() {
 
   // you may also pass a constraint as a function of a matrix which
   // has all variable arguments collocated into one vector of vector
-  constexpr auto require_conservation_4 = [] (const vector< vector<double> >& m) -> vector<double> {
+  const auto require_conservation_4 = [] (const vector< vector<double> >& m) -> vector<double> {
     // assume that m[0] (later assigned to Vec3) is the sum of
     // the remaining elements m[1..2] (aka Vec1/Vec2)
     // assume that all vectors inside m have the same size
@@ -3,6 +3,7 @@
 #include <limits>
 #include <iomanip>
 #include <functional>
+#include <algorithm>
 
 using namespace std;
 
@@ -38,7 +39,7 @@ int main() {
   // to get the proper vector of pointers
   auto linker = [] (vector<double>& v) {
     vector<double*> v_p(v.size());
-    transform(v.begin(), v.end(), v_p.begin(), addressof<double>);
+    transform(v.begin(), v.end(), v_p.begin(), [] (double& d) { return addressof(d); });
     return v_p;
   };
   
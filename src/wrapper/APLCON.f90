@@ -7,16 +7,36 @@ contains
   subroutine C_APLCON_APLCON(NVAR,MCST) bind(c)
     integer(c_int), value, intent(in) :: NVAR, MCST
     CALL APLCON(NVAR,MCST)
-    CALL FLUSH
+    CALL APFLSH
   end subroutine C_APLCON_APLCON
 
   subroutine C_APLCON_APLOOP(X,VX,F,IRET) bind(c)
     real(c_double), dimension(*), intent(inout) :: X,VX,F
     integer(c_int), intent(out) :: IRET
     CALL APLOOP(X,VX,F,IRET)
-    CALL FLUSH
+    CALL APFLSH
   end subroutine C_APLCON_APLOOP
 
+  ! workspace
+  subroutine C_APLCON_APWORK(WORK,NWORK) bind(c)
+    real(c_double), dimension(*), intent(inout) :: WORK
+    integer(c_int), value, intent(in) :: NWORK
+    CALL APWORK(WORK,NWORK)
+  end subroutine C_APLCON_APWORK
+
+  subroutine C_APLCON_APNAUX(NVAR,MCST,NDIM) bind(c)
+    integer(c_int), value, intent(in) :: NVAR,MCST
+    integer(c_long_long), intent(out) :: NDIM
+    CALL APNAUX(NVAR,MCST,NDIM)
+  end subroutine C_APLCON_APNAUX
+
+  ! analytic derivatives
+  subroutine C_APLCON_APJROW(X,J,ROW) bind(c)
+    real(c_double), dimension(*), intent(in) :: X,ROW
+    integer(c_int), value, intent(in) :: J
+    CALL APJROW(X,J,ROW)
+  end subroutine C_APLCON_APJROW
+
   ! routines to obtain results
   subroutine C_APLCON_CHNDPV(CHI2,ND,PVAL) bind(c)
     real(c_float), intent(out) :: CHI2,PVAL
@@ -30,11 +50,24 @@ contains
     CALL APSTAT(FOPT,NFUN,NITER)
   end subroutine C_APLCON_APSTAT
 
+  subroutine C_APLCON_APLSTA(ISTATU,NJAC,NCUT,NRANK,NREUS) bind(c)
+    integer(c_int), intent(out) :: ISTATU, NJAC, NCUT, NRANK, NREUS
+    CALL APLSTA(ISTATU,NJAC,NCUT,NRANK,NREUS)
+  end subroutine C_APLCON_APLSTA
+
   subroutine C_APLCON_APPULL(PULLS) bind(c)
     real(c_double), dimension(*), intent(out) :: PULLS
     CALL APPULL(PULLS)
   end subroutine C_APLCON_APPULL
 
+  ! error propagation, see the C++ version APLCON_::SMAVAT
+  subroutine C_APLCON_SMAVAT(V,A,W,N,M) bind(c)
+    real(c_double), dimension(*), intent(in) :: V,A
+    real(c_double), dimension(*), intent(out) :: W
+    integer(c_int), value, intent(in) :: N,M
+    CALL SMAVAT(V,A,W,N,M)
+  end subroutine C_APLCON_SMAVAT
+
   ! variable reduction
   subroutine C_APLCON_SIMSEL(X,VX,NY,LIST,Y,VY) bind(c)
     real(c_double), dimension(*), intent(in) :: X,VX,LIST
@@ -106,6 +139,11 @@ contains
     CALL APITER(ITERMX)
   end subroutine C_APLCON_APITER
 
+  subroutine C_APLCON_APBROY(IARG) bind(c)
+    integer(c_int), value, intent(in) :: IARG
+    CALL APBROY(IARG)
+  end subroutine C_APLCON_APBROY
+
   subroutine C_APLCON_APROFL(I1,I2) bind(c)
     integer(c_int), value, intent(in) :: I1, I2
     CALL APROFL(I1,I2)
@@ -163,4 +201,9 @@ contains
     CALL APOSIT(I)
   end subroutine C_APLCON_APOSIT
 
+  subroutine C_APLCON_APANAL(I) bind(c)
+    integer(c_int), value, intent(in) :: I
+    CALL APANAL(I)
+  end subroutine C_APLCON_APANAL
+
 end module APLCON_wrapper
@@ -16,6 +16,26 @@ void c_aplcon_aplcon(const int NVAR, const int MCST);
  * @param IRET status of fit iteration
  */
 void c_aplcon_aploop(double X[], double VX[], double F[], int* IRET);
+/**
+ * @brief Use WORK as workspace for the following fits in this thread, call before c_aplcon_aplcon
+ * @param WORK array of at least NWORK elements, must stay valid during the fit
+ * @param NWORK size of WORK
+ */
+void c_aplcon_apwork(double WORK[], const int NWORK);
+/**
+ * @brief Obtain the required size of the workspace
+ * @param NVAR number of variables
+ * @param MCST number of constraints
+ * @param NDIM required number of elements
+ */
+void c_aplcon_apnaux(const int NVAR, const int MCST, long long* NDIM);
+/**
+ * @brief Provide analytic derivatives, called if c_aplcon_aploop returned IRET=-3
+ * @param X current variable values
+ * @param J index of constraint (starting from 1)
+ * @param ROW derivatives of constraint J w.r.t. all variables in X
+ */
+void c_aplcon_apjrow(const double X[], const int J, const double ROW[]);
 
 // routines to obtain results
 /**
@@ -33,11 +53,29 @@ void c_aplcon_chndpv(float* CHI2, int* ND, float* PVAL);
  * @param NITER number of iterations
  */
 void c_aplcon_apstat(double* FOPT, int* NFUN, int* NITER);
+/**
+ * @brief Obtain the state of the loop and some statistics, also during the fit
+ * @param ISTATU state of the loop, -1 while calculating numerical derivatives
+ * @param NJAC number of Jacobian computations
+ * @param NCUT number of cutsteps
+ * @param NRANK rank of the equation system in the last iteration
+ * @param NREUS number of Jacobian columns of linear variables not recomputed
+ */
+void c_aplcon_aplsta(int* ISTATU, int* NJAC, int* NCUT, int* NRANK, int* NREUS);
 /**
  * @brief Obtain pulls
  * @param PULLS Array of pulls for each variable in X
  */
 void c_aplcon_appull(double* PULLS);
+/**
+ * @brief Error propagation W = A*V*A^T, used to benchmark APLCON_::SMAVAT
+ * @param V packed symmetric N-by-N matrix
+ * @param A M-by-N matrix, stored row by row
+ * @param W packed symmetric M-by-M result
+ * @param N number of columns of A
+ * @param M number of rows of A
+ */
+void c_aplcon_smavat(const double V[], const double A[], double W[], const int N, const int M);
 
 // variable reduction (currently unused)
 //void c_aplcon_simsel(const double X[], const double VX[], const int NY, const int LIST[], double Y[], double VY[]);
@@ -85,6 +123,11 @@ void c_aplcon_apdlow(const double DERLOW);
  * @param ITERMX number of maximum iterations
  */
 void c_aplcon_apiter(const int ITERMX);
+/**
+ * @brief Setup Broyden updates of the Jacobian between iterations
+ * @param IARG 1 to update, 0 to recompute the Jacobian numerically (default)
+ */
+void c_aplcon_apbroy(const int IARG);
 /**
  * @brief Setup stepsize for variable with index I
  * @param I index of variable (starting from 1)
@@ -118,6 +161,12 @@ void c_aplcon_apsqrt(const int I);
  * @param I index of variable
  */
 void c_aplcon_aplogn(const int I);
+/**
+ * @brief Setup variable I to have analytic derivatives
+ * @see c_aplcon_apjrow
+ * @param I index of variable
+ */
+void c_aplcon_apanal(const int I);
 
 // rather undocumented additional APLCON routines
 //void c_aplcon_abinom(const int I);
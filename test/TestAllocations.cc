@@ -0,0 +1,96 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// count all heap allocations of this program,
+// the constraint evaluation in DoFit should not contribute to it,
+// the operators are not inlined, so the compiler doesn't pair free() with new
+
+static size_t nAllocations = 0;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  ++nAllocations;
+  void* p = malloc(size == 0 ? 1 : size);
+  if(p == nullptr)
+    throw bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+
+// differentiated with dual numbers, which must not allocate either
+struct generic_constraint {
+  template<typename T>
+  T operator()(const T& a, const T& b, const T& c) const {
+    using std::sqrt;
+    return sqrt(c*c) - a - b;
+  }
+};
+
+// vector arguments are differentiated in chunks of duals, kept by the constraint
+struct generic_vector_constraint {
+  template<typename T>
+  T operator()(const vector<T>& p) const {
+    return p[1]*p[1] - p[2]*p[2];
+  }
+};
+
+void RequireNoAllocations(const APLCON::Fit_Settings_t& settings) {
+  double a = 10, b = 2;
+  vector<double> p{0.5, 0.5, 0.5};
+
+  APLCON fit("Allocations", settings);
+  fit.LinkVariable("A", {&a}, vector<double>{0.3});
+  fit.LinkVariable("B", {&b}, vector<double>{0.4});
+  fit.LinkVariable("p", {&p[0], &p[1], &p[2]}, {0.1, 0.1, 0.1});
+  // scalar, vector and matrix arguments
+  fit.AddConstraint("A*B=20", {"A", "B"},
+                    [] (double a, double b) { return a*b - 20; });
+  fit.AddConstraint("|p|=1", {"p"},
+                    [] (const vector<double>& p) { return p[0]*p[0]+p[1]*p[1]+p[2]*p[2] - 1; });
+  fit.AddConstraint("p_x*A=5", {"p", "A"},
+                    [] (const vector< vector<double> >& x) { return x[0][0]*x[1][0] - 5; });
+  // and generic functors
+  fit.AddMeasuredVariable("C", 12, 0.5);
+  fit.AddConstraint("A+B=C", {"A", "B", "C"}, generic_constraint());
+  fit.AddConstraint("p_y=p_z", {"p"}, generic_vector_constraint());
+
+  // the first fit builds the storage
+  fit.DoFit();
+
+  // fit twice, starting at different values, so
+  // the number of iterations differs, but the number of allocations must not
+  const auto fit_from = [&] (double a_, double b_) {
+    a = a_;
+    b = b_;
+    p = {0.5, 0.5, 0.5};
+    const size_t before = nAllocations;
+    const APLCON::Result_t& r = fit.DoFit();
+    const size_t allocations = nAllocations - before;
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+    return make_pair(allocations, r.NFunctionCalls);
+  };
+
+  const auto& r1 = fit_from(10, 2);
+  const auto& r2 = fit_from(30, 0.5);
+  REQUIRE(r1.second != r2.second);
+  REQUIRE(r1.first == r2.first);
+}
+
+TEST_CASE("No allocations in fit iterations", "") {
+  RequireNoAllocations(APLCON::Fit_Settings_t::Default);
+}
+
+TEST_CASE("No allocations in native fit iterations", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = APLCON::Engine_t::Native;
+  RequireNoAllocations(settings);
+}
@@ -0,0 +1,167 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// the variables are ordered by name in the fitter,
+// so A, B, C correspond to index 0, 1, 2 in the batch arrays
+void SetupFit(APLCON& a, double A, double B, double sA, double sB) {
+  a.AddMeasuredVariable("A", A, sA);
+  a.AddMeasuredVariable("B", B, sB);
+  a.AddUnmeasuredVariable("C");
+  a.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                  [] (double a, double b, double c) { return c - sqrt(a*b); });
+  a.AddConstraint("A+B=30", {"A", "B"},
+                  [] (double a, double b) { return a + b - 30; });
+}
+
+void RequireSame(const APLCON::Batch_Result_t& rb, size_t n,
+                 const APLCON::Result_t& r) {
+  const size_t N = rb.NEvents;
+  REQUIRE(rb.Status[n] == r.Status);
+  REQUIRE(rb.ChiSquare[n] == Approx(r.ChiSquare));
+  REQUIRE(rb.NDoF[n] == r.NDoF);
+  REQUIRE(rb.NIterations[n] == r.NIterations);
+  for(size_t i=0;i<rb.VariableNames.size();i++) {
+    const auto& var = r.Variables.at(rb.VariableNames[i]);
+    REQUIRE(rb.Values[i*N+n] == Approx(var.Value.After));
+    REQUIRE(rb.Sigmas[i*N+n] == Approx(var.Sigma.After));
+    REQUIRE(rb.Pulls[i*N+n] == Approx(var.Pull));
+  }
+}
+
+TEST_CASE("Batch with values and sigmas", "") {
+  APLCON a("Batch");
+  SetupFit(a, 10, 20, 0.3, 0.4);
+
+  const size_t N = 50;
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  input.Values.resize(3*N);
+  input.Sigmas.resize(3*N);
+  for(size_t n=0;n<N;n++) {
+    input.Values[0*N+n] = 10+0.05*n;
+    input.Values[1*N+n] = 20-0.03*n;
+    input.Values[2*N+n] = 0;
+    input.Sigmas[0*N+n] = 0.3+0.01*n;
+    input.Sigmas[1*N+n] = 0.4;
+    input.Sigmas[2*N+n] = 0; // unmeasured
+  }
+
+  for(unsigned nThreads : {1u, 4u}) {
+    const auto& rb = a.FitBatch(input, nThreads);
+    REQUIRE(rb.NEvents == N);
+    REQUIRE(rb.VariableNames == a.VariableNames());
+    REQUIRE(rb.Covariances.size() == 6*N);
+    for(size_t n=0;n<N;n++) {
+      APLCON b("Single");
+      SetupFit(b, input.Values[0*N+n], input.Values[1*N+n],
+               input.Sigmas[0*N+n], input.Sigmas[1*N+n]);
+      const auto& r = b.DoFit();
+      REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+      RequireSame(rb, n, r);
+      REQUIRE(rb.Covariances[1*N+n] ==
+              Approx(r.Covariance("A", "B")));
+    }
+  }
+
+  // the template itself is left untouched
+  const auto& r = a.DoFit();
+  REQUIRE(r.Variables.at("A").Value.Before == 10);
+}
+
+TEST_CASE("Batch with covariances", "") {
+  APLCON a("Batch");
+  SetupFit(a, 10, 20, 0.3, 0.4);
+
+  const size_t N = 10;
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  input.Values.resize(3*N);
+  input.Covariances.resize(6*N, 0);
+  for(size_t n=0;n<N;n++) {
+    input.Values[0*N+n] = 10+0.1*n;
+    input.Values[1*N+n] = 19.5;
+    input.Values[2*N+n] = 0;
+    input.Covariances[0*N+n] = 0.09; // <A,A>
+    input.Covariances[1*N+n] = 0.01*n; // <A,B>
+    input.Covariances[2*N+n] = 0.16; // <B,B>
+  }
+
+  const auto& rb = a.FitBatch(input);
+  for(size_t n=0;n<N;n++) {
+    APLCON b("Single");
+    SetupFit(b, input.Values[0*N+n], input.Values[1*N+n], 0.3, 0.4);
+    b.SetCovariance("A", "B", 0.01*n);
+    RequireSame(rb, n, b.DoFit());
+  }
+}
+
+TEST_CASE("Batch errors", "") {
+  APLCON a("Batch");
+  SetupFit(a, 10, 20, 0.3, 0.4);
+
+  APLCON::Batch_Input_t input;
+  input.NEvents = 2;
+  input.Values.resize(5);
+  REQUIRE_THROWS_AS(a.FitBatch(input), const APLCON::Error&);
+  input.Values.resize(6);
+  input.Sigmas.resize(6, 1);
+  input.Covariances.resize(12);
+  REQUIRE_THROWS_AS(a.FitBatch(input), const APLCON::Error&);
+
+  // exceptions in the constraints are passed to the caller
+  APLCON c("Throwing");
+  c.AddMeasuredVariable("A", 1, 0.1);
+  c.AddConstraint("A=1", {"A"}, [] (double a) {
+    if(a>5)
+      throw runtime_error("A too large");
+    return a-1;
+  });
+  APLCON::Batch_Input_t bad;
+  bad.NEvents = 8;
+  bad.Values = {1, 1, 1, 10, 1, 1, 1, 1};
+  REQUIRE_THROWS_AS(c.FitBatch(bad, 3), const runtime_error&);
+  // the workers are still usable after an exception
+  bad.Values[3] = 1;
+  REQUIRE(c.FitBatch(bad, 3).Status[3] == APLCON::Result_Status_t::Success);
+}
+
+TEST_CASE("Batch workers kept across calls", "") {
+  APLCON a("Batch");
+  SetupFit(a, 10, 20, 0.3, 0.4);
+
+  const size_t N = 20;
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  input.Values.resize(3*N);
+  for(size_t n=0;n<N;n++) {
+    input.Values[0*N+n] = 10+0.05*n;
+    input.Values[1*N+n] = 20-0.03*n;
+    input.Values[2*N+n] = 0;
+  }
+
+  const auto& r1 = a.FitBatch(input, 4);
+  // fewer threads reuse some of the workers
+  const auto& r2 = a.FitBatch(input, 2);
+  const auto& r3 = a.FitBatch(input, 4);
+  REQUIRE(r2.Values == r1.Values);
+  REQUIRE(r3.Values == r1.Values);
+
+  // changing the instance rebuilds the workers
+  a.AddMeasuredVariable("D", 10, 0.1);
+  a.AddConstraint("A=D", {"A", "D"}, [] (double a, double d) { return a - d; });
+  input.Values.resize(4*N, 10);
+  const auto& r4 = a.FitBatch(input, 4);
+  REQUIRE(r4.NScalarConstraints == 3);
+  for(size_t n=0;n<N;n++) {
+    APLCON b("Single");
+    SetupFit(b, input.Values[0*N+n], input.Values[1*N+n], 0.3, 0.4);
+    b.AddMeasuredVariable("D", 10, 0.1);
+    b.AddConstraint("A=D", {"A", "D"}, [] (double a, double d) { return a - d; });
+    RequireSame(r4, n, b.DoFit());
+  }
+}
@@ -0,0 +1,65 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// exponential curve through n measured points, which needs some iterations
+APLCON::Result_t FitCurve(APLCON::Engine_t engine, bool broyden) {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = engine;
+  settings.BroydenUpdates = broyden;
+  settings.CollectStatistics = true;
+  settings.MaxIterations = 50;
+  APLCON a("Curve", settings);
+
+  const size_t n = 20;
+  vector<double> x(n);
+  for(size_t i=0;i<n;i++) {
+    x[i] = 0.1*i;
+    a.AddMeasuredVariable("y"+to_string(i), 2*exp(0.5*x[i]) + 0.01*sin(i), 0.05);
+  }
+  a.AddUnmeasuredVariable("a", 1);
+  a.AddUnmeasuredVariable("b", 0);
+  for(size_t i=0;i<n;i++) {
+    const double x_i = x[i];
+    a.AddConstraint("curve"+to_string(i), {"a", "b", "y"+to_string(i)},
+                    [x_i] (double a, double b, double y) { return a*exp(b*x_i) - y; });
+  }
+  return a.DoFit();
+}
+
+TEST_CASE("Broyden updates", "") {
+  for(auto engine : {APLCON::Engine_t::Fortran, APLCON::Engine_t::Native}) {
+    const auto& r = FitCurve(engine, false);
+    const auto& r_b = FitCurve(engine, true);
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+    REQUIRE(r_b.Status == APLCON::Result_Status_t::Success);
+
+    // fewer Jacobians, and fewer evaluations
+    REQUIRE(r_b.Statistics.NJacobians < r.Statistics.NJacobians);
+    REQUIRE(r_b.NFunctionCalls < r.NFunctionCalls);
+
+    // the same solution, and the covariances are from a computed Jacobian
+    REQUIRE(r_b.ChiSquare == Approx(r.ChiSquare).epsilon(1e-4));
+    for(const char* v : {"a", "b", "y0", "y19"}) {
+      REQUIRE(r_b.Variables.at(v).Value.After == Approx(r.Variables.at(v).Value.After).epsilon(1e-5));
+      REQUIRE(r_b.Variables.at(v).Sigma.After == Approx(r.Variables.at(v).Sigma.After).epsilon(1e-4));
+    }
+    REQUIRE(r_b.Covariance("a", "b") == Approx(r.Covariance("a", "b")).epsilon(1e-4));
+  }
+}
+
+TEST_CASE("Broyden updates of engines agree", "") {
+  const auto& rf = FitCurve(APLCON::Engine_t::Fortran, true);
+  const auto& rn = FitCurve(APLCON::Engine_t::Native, true);
+  REQUIRE(rf.NIterations == rn.NIterations);
+  REQUIRE(rf.Statistics.NJacobians == rn.Statistics.NJacobians);
+  // all y are displaced at once by the Native engine
+  REQUIRE(rn.NFunctionCalls < rf.NFunctionCalls);
+  REQUIRE(rf.ChiSquare == Approx(rn.ChiSquare));
+  for(size_t k=0;k<rf.Covariances.size();k++)
+    REQUIRE(rn.Covariances[k] == Approx(rf.Covariances[k]));
+}
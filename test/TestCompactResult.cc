@@ -0,0 +1,214 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+void AddTestSetup(APLCON& a) {
+  // internally stored variables, so each fit starts from the same values
+  a.AddMeasuredVariable("A", 10, 0.3);
+  a.AddUnmeasuredVariable("B", 5);
+  for(size_t i=0;i<12;i++)
+    a.AddMeasuredVariable("p"+to_string(i), 1 + 0.1*i, 0.1 + 0.01*i);
+  a.SetCovariance("A", "p3", 0.001);
+  a.AddConstraint("A=2B", {"A", "B"}, [] (double a, double b) { return a - 2*b; });
+  a.AddConstraint("p0+p11=A/4", {"p0", "p11", "A"}, [] (double p0, double p11, double a) { return p0 + p11 - a/4; });
+}
+
+void RequireSameVariables(const map<string, APLCON::Result_Variable_t>& v1,
+                          const map<string, APLCON::Result_Variable_t>& v2)
+{
+  REQUIRE(v1.size() == v2.size());
+  for(const auto& it : v1) {
+    const APLCON::Result_Variable_t& a = it.second;
+    const APLCON::Result_Variable_t& b = v2.at(it.first);
+    REQUIRE(a.PristineName == b.PristineName);
+    REQUIRE(a.Dimension == b.Dimension);
+    REQUIRE(a.Index == b.Index);
+    REQUIRE(a.Value.Before == b.Value.Before);
+    REQUIRE(a.Value.After == b.Value.After);
+    REQUIRE(a.Sigma.Before == b.Sigma.Before);
+    REQUIRE(a.Sigma.After == b.Sigma.After);
+    REQUIRE(a.Pull == b.Pull);
+    REQUIRE(a.Covariances.Before == b.Covariances.Before);
+    REQUIRE(a.Covariances.After == b.Covariances.After);
+  }
+}
+
+TEST_CASE("Compact result", "") {
+  APLCON a("Compact");
+  AddTestSetup(a);
+
+  APLCON::Compact_Result_t c;
+  a.DoFit(c);
+  const APLCON::Result_t& r = a.DoFit();
+  REQUIRE(c.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(c.Name == r.Name);
+  REQUIRE(c.ChiSquare == r.ChiSquare);
+  REQUIRE(c.NIterations == r.NIterations);
+  REQUIRE(c.NScalarConstraints == r.NScalarConstraints);
+
+  // the arrays are indexed like VariableNames()
+  const vector<string>& names = a.VariableNames();
+  REQUIRE(c.Table->VariableNames == names);
+  REQUIRE(c.Values.size() == names.size());
+  REQUIRE(c.Covariances.size() == names.size()*(names.size()+1)/2);
+  for(size_t i=0;i<names.size();i++) {
+    REQUIRE(c.Index(names[i]) == i);
+    const APLCON::Result_Variable_t& var = r.Variables.at(names[i]);
+    REQUIRE(c.Values[i] == var.Value.After);
+    REQUIRE(c.Sigmas[i] == var.Sigma.After);
+    REQUIRE(c.Pulls[i] == var.Pull);
+    for(size_t j=0;j<=i;j++) {
+      REQUIRE(c.Covariances[i*(i+1)/2+j] == r.Covariance(i, j));
+      REQUIRE(c.CovariancesBefore[i*(i+1)/2+j] == r.CovarianceBefore(i, j));
+    }
+  }
+  REQUIRE(c.CovariancesBefore[c.Index("p3")*(c.Index("p3")+1)/2+c.Index("A")] == 0.001);
+
+  RequireSameVariables(c.Variables(), r.Variables);
+  const APLCON::Result_t& r_c = c.ToResult();
+  RequireSameVariables(r_c.Variables, r.Variables);
+  REQUIRE(r_c.Constraints.size() == r.Constraints.size());
+
+  REQUIRE_THROWS_AS(c.Index("C"), const APLCON::Error&);
+}
+
+TEST_CASE("Compact result reuses storage", "") {
+  APLCON a("Compact");
+  AddTestSetup(a);
+
+  APLCON::Compact_Result_t c1, c2;
+  a.DoFit(c1);
+  const double* values = c1.Values.data();
+  const double* covariances = c1.Covariances.data();
+  a.DoFit(c1);
+  REQUIRE(c1.Values.data() == values);
+  REQUIRE(c1.Covariances.data() == covariances);
+
+  // the names are shared until the instance is changed
+  a.DoFit(c2);
+  REQUIRE(c1.Table == c2.Table);
+  a.AddConstraint("p1=p2", {"p1", "p2"}, [] (double a, double b) { return a - b; });
+  a.DoFit(c2);
+  REQUIRE(c1.Table != c2.Table);
+  REQUIRE(c2.Table->Constraints.size() == 3);
+}
+
+TEST_CASE("Compact result without covariances", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.SkipCovariancesInResult = true;
+  APLCON a("Compact", settings);
+  AddTestSetup(a);
+
+  APLCON::Compact_Result_t c;
+  a.DoFit(c);
+  REQUIRE(c.Covariances.empty());
+  REQUIRE(c.CovariancesBefore.empty());
+  REQUIRE(c.Sigmas.size() == c.Values.size());
+  RequireSameVariables(c.Variables(), a.DoFit().Variables);
+}
+
+TEST_CASE("Compact result with vector variables", "") {
+  // more than 10 entries, so the names are not sorted like X
+  const size_t n = 12;
+  vector<double> x(n);
+  vector<double*> x_ptr;
+  for(size_t i=0;i<n;i++) {
+    x[i] = i;
+    x_ptr.push_back(&x[i]);
+  }
+  vector<double> sigmas(n);
+  for(size_t i=0;i<n;i++)
+    sigmas[i] = 0.1*(i+1);
+
+  APLCON a("Vector");
+  a.LinkVariable("x", x_ptr, sigmas);
+  a.AddConstraint("x0+x10=x2", {"x"}, [] (const vector<double>& x) { return x[0] + x[10] - x[2]; });
+
+  APLCON::Compact_Result_t c;
+  a.DoFit(c);
+  REQUIRE(c.Status == APLCON::Result_Status_t::Success);
+
+  APLCON::Result_t r = c.ToResult();
+  r.FillCovariances();
+  const auto& vars = r.Variables;
+  const size_t i10 = c.Index("x[10]");
+  const size_t i2 = c.Index("x[2]");
+  REQUIRE(i10 == 10);
+  REQUIRE(vars.at("x[10]").Index == 10);
+  REQUIRE(vars.at("x[10]").Sigma.Before == Approx(1.1));
+  REQUIRE(vars.at("x[10]").Covariances.After.at("x[2]") == c.Covariances[i10*(i10+1)/2+i2]);
+  REQUIRE(vars.at("x[10]").Covariances.Before.at("x[10]") == Approx(1.1*1.1));
+}
+
+TEST_CASE("Lazy covariances", "") {
+  APLCON a("Lazy");
+  AddTestSetup(a);
+  APLCON::Result_t r = a.DoFit();
+  for(const auto& it : r.Variables)
+    REQUIRE(it.second.Covariances.After.empty());
+
+  // accessors by name and index agree, and are symmetric
+  const size_t iA = r.Index("A");
+  const size_t ip3 = r.Index("p3");
+  REQUIRE(r.CovarianceBefore("A", "p3") == 0.001);
+  REQUIRE(r.CovarianceBefore("p3", "A") == 0.001);
+  REQUIRE(r.Covariance("A", "p3") == r.Covariance(ip3, iA));
+  REQUIRE(r.Covariance("A", "A") == Approx(pow(r.Variables.at("A").Sigma.After, 2)));
+  REQUIRE(r.Correlation("A", "A") == Approx(1));
+  REQUIRE(r.CorrelationBefore("A", "p3") == Approx(0.001/0.3/0.13));
+  REQUIRE_THROWS_AS(r.Covariance("A", "C"), const APLCON::Error&);
+
+  // filling the maps gives the same as the accessors
+  r.FillCovariances();
+  const vector<string>& names = a.VariableNames();
+  const auto correlations = APLCON::CalculateCorrelations(r.Variables);
+  for(size_t i=0;i<names.size();i++) {
+    const APLCON::Result_Variable_t& var = r.Variables.at(names[i]);
+    REQUIRE(var.Covariances.After.size() == names.size());
+    for(size_t j=0;j<names.size();j++) {
+      REQUIRE(var.Covariances.After.at(names[j]) == r.Covariance(i, j));
+      REQUIRE(var.Covariances.Before.at(names[j]) == r.CovarianceBefore(i, j));
+      REQUIRE(correlations.at(names[i]).After.at(names[j]) == Approx(r.Correlation(i, j)));
+    }
+  }
+}
+
+TEST_CASE("Lazy covariances skipped", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.SkipCovariancesInResult = true;
+  APLCON a("Skipped", settings);
+  AddTestSetup(a);
+  APLCON::Result_t r = a.DoFit();
+  REQUIRE_THROWS_AS(r.Covariance("A", "B"), const APLCON::Error&);
+  REQUIRE_THROWS_AS(r.Correlation(0, 0), const APLCON::Error&);
+  r.FillCovariances();
+  REQUIRE(r.Variables.at("A").Covariances.After.empty());
+}
+
+TEST_CASE("Correlations of packed matrix", "") {
+  APLCON a("Packed");
+  AddTestSetup(a);
+  const APLCON::Result_t& r = a.DoFit();
+
+  const vector<double>& after = APLCON::CalculateCorrelations(r.Covariances);
+  vector<double> before;
+  APLCON::CalculateCorrelations(r.CovariancesBefore, before);
+  REQUIRE(after.size() == r.Covariances.size());
+  const size_t n = a.VariableNames().size();
+  for(size_t i=0;i<n;i++) {
+    for(size_t j=0;j<=i;j++) {
+      REQUIRE(after[i*(i+1)/2+j] == Approx(r.Correlation(i, j)));
+      // B is unmeasured
+      if(i == r.Index("B") || j == r.Index("B"))
+        REQUIRE(std::isnan(before[i*(i+1)/2+j]));
+      else
+        REQUIRE(before[i*(i+1)/2+j] == Approx(r.CorrelationBefore(i, j)));
+    }
+  }
+
+  REQUIRE_THROWS_AS(APLCON::CalculateCorrelations(vector<double>(2)), const APLCON::Error&);
+}
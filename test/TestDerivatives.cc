@@ -0,0 +1,271 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+void RequireSame(const APLCON::Result_t& r1, const APLCON::Result_t& r2) {
+  REQUIRE(r1.Status == r2.Status);
+  REQUIRE(r1.ChiSquare == Approx(r2.ChiSquare));
+  REQUIRE(r1.NDoF == r2.NDoF);
+  for(const auto& it_var : r1.Variables) {
+    const auto& var = r2.Variables.at(it_var.first);
+    REQUIRE(it_var.second.Value.After == Approx(var.Value.After));
+    REQUIRE(it_var.second.Sigma.After == Approx(var.Sigma.After).epsilon(1e-4));
+    REQUIRE(it_var.second.Pull == Approx(var.Pull).epsilon(1e-4));
+  }
+}
+
+const auto sqrt_constraint = [] (double a, double b, double c) {
+  return c - sqrt(a*b);
+};
+const auto sqrt_derivative = [] (double a, double b, double) -> vector<double> {
+  const double s = sqrt(a*b);
+  return {-b/(2*s), -a/(2*s), 1};
+};
+const auto sum_constraint = [] (double a, double b) {
+  return a + b - 30;
+};
+const auto sum_derivative = [] (double, double) -> vector<double> {
+  return {1, 1};
+};
+
+void SetupVariables(APLCON& a, const APLCON::Distribution_t& dist) {
+  APLCON::Variable_Settings_t settings = APLCON::Variable_Settings_t::Default;
+  settings.Distribution = dist;
+  a.AddMeasuredVariable("A", 10, 0.3, settings);
+  a.AddMeasuredVariable("B", 20, 0.4);
+  a.AddUnmeasuredVariable("C");
+  a.AddFixedVariable("D", 3, 0.1);
+}
+
+TEST_CASE("Scalar derivatives", "") {
+  for(auto dist : {APLCON::Distribution_t::Gaussian,
+                   APLCON::Distribution_t::LogNormal,
+                   APLCON::Distribution_t::SquareRoot}) {
+    APLCON numerical("Numerical");
+    SetupVariables(numerical, dist);
+    numerical.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_constraint);
+    numerical.AddConstraint("A+B=30", {"A", "B"}, sum_constraint);
+    numerical.AddConstraint("D=3", {"D"}, [] (double d) { return d - 3; });
+
+    APLCON analytic("Analytic");
+    SetupVariables(analytic, dist);
+    analytic.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_constraint, sqrt_derivative);
+    analytic.AddConstraint("A+B=30", {"A", "B"}, sum_constraint, sum_derivative);
+    analytic.AddConstraint("D=3", {"D"}, [] (double d) { return d - 3; },
+                           [] (double) -> vector<double> { return {1}; });
+
+    const auto& rn = numerical.DoFit();
+    const auto& ra = analytic.DoFit();
+    REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+    RequireSame(rn, ra);
+    // no numerical differentiation at all
+    REQUIRE(ra.NFunctionCalls < rn.NFunctionCalls);
+    REQUIRE(ra.NFunctionCalls == 2*ra.NIterations+1);
+  }
+}
+
+TEST_CASE("Mixed derivatives", "") {
+  // only one constraint has derivatives,
+  // so only the unmeasured C is not numerically differentiated
+  APLCON numerical("Numerical");
+  SetupVariables(numerical, APLCON::Distribution_t::Gaussian);
+  numerical.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_constraint);
+  numerical.AddConstraint("A+B=30", {"A", "B"}, sum_constraint);
+
+  APLCON mixed("Mixed");
+  SetupVariables(mixed, APLCON::Distribution_t::Gaussian);
+  mixed.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_constraint, sqrt_derivative);
+  mixed.AddConstraint("A+B=30", {"A", "B"}, sum_constraint);
+
+  const auto& rn = numerical.DoFit();
+  const auto& rm = mixed.DoFit();
+  RequireSame(rn, rm);
+  REQUIRE(rm.NFunctionCalls < rn.NFunctionCalls);
+}
+
+TEST_CASE("Vector derivatives", "") {
+  // a vector-valued constraint on vector variables:
+  // p1 + p2 = {1, 2}, and the sum of the squares of p1 is 1
+  const auto momentum = [] (const vector<double>& p1, const vector<double>& p2) {
+    return vector<double>{p1[0]+p2[0]-1, p1[1]+p2[1]-2, p1[0]*p1[0]+p1[1]*p1[1]-1};
+  };
+  const auto momentum_derivative = [] (const vector<double>& p1, const vector<double>&) {
+    return vector< vector<double> >{
+      {1, 0, 1, 0},
+      {0, 1, 0, 1},
+      {2*p1[0], 2*p1[1], 0, 0}
+    };
+  };
+  vector<double> p1{0.5, 0.8}, p2{0.6, 1.1};
+  const vector<double> s{0.1, 0.1};
+
+  APLCON numerical("Numerical");
+  numerical.LinkVariable("p1", {&p1[0], &p1[1]}, s);
+  numerical.LinkVariable("p2", {&p2[0], &p2[1]}, s);
+  numerical.AddConstraint("momentum", {"p1", "p2"}, momentum);
+
+  vector<double> q1{0.5, 0.8}, q2{0.6, 1.1};
+  APLCON analytic("Analytic");
+  analytic.LinkVariable("p1", {&q1[0], &q1[1]}, s);
+  analytic.LinkVariable("p2", {&q2[0], &q2[1]}, s);
+  analytic.AddConstraint("momentum", {"p1", "p2"}, momentum, momentum_derivative);
+
+  const auto& rn = numerical.DoFit();
+  const auto& ra = analytic.DoFit();
+  REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+  RequireSame(rn, ra);
+
+  // wrong number of derivatives is reported
+  APLCON wrong("Wrong");
+  wrong.LinkVariable("p1", {&q1[0], &q1[1]}, s);
+  wrong.LinkVariable("p2", {&q2[0], &q2[1]}, s);
+  wrong.AddConstraint("momentum", {"p1", "p2"}, momentum,
+                      [] (const vector<double>&, const vector<double>&) {
+    return vector< vector<double> >{{1, 0, 1, 0}};
+  });
+  REQUIRE_THROWS_AS(wrong.DoFit(), const APLCON::Error&);
+}
+
+// generic functors, differentiated automatically
+
+struct sqrt_generic {
+  template<typename T>
+  T operator()(const T& a, const T& b, const T& c) const {
+    using std::sqrt;
+    return c - sqrt(a*b);
+  }
+};
+
+struct sum_generic {
+  template<typename T>
+  T operator()(const T& a, const T& b) const {
+    return a + b - 30;
+  }
+};
+
+struct invariant_mass_generic {
+  template<typename T>
+  T operator()(const vector<T>& E, const vector<T>& p) const {
+    using std::pow;
+    return pow(E[0],2) - pow(p[0],2) - pow(p[1],2) - pow(p[2],2);
+  }
+};
+
+struct momentum_generic {
+  template<typename T>
+  vector<T> operator()(const vector< vector<T> >& x) const {
+    using std::cos;
+    using std::sin;
+    // sum of the transverse momenta given by (pt, phi)
+    return {
+      x[0][0]*cos(x[1][0]) + x[2][0]*cos(x[3][0]),
+      x[0][0]*sin(x[1][0]) + x[2][0]*sin(x[3][0])
+    };
+  }
+};
+
+TEST_CASE("Generic scalar constraints", "") {
+  APLCON numerical("Numerical");
+  SetupVariables(numerical, APLCON::Distribution_t::LogNormal);
+  numerical.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_constraint);
+  numerical.AddConstraint("A+B=30", {"A", "B"}, sum_constraint);
+
+  APLCON generic("Generic");
+  SetupVariables(generic, APLCON::Distribution_t::LogNormal);
+  generic.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_generic());
+  generic.AddConstraint("A+B=30", {"A", "B"}, sum_generic());
+
+  const auto& rn = numerical.DoFit();
+  const auto& rg = generic.DoFit();
+  REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+  RequireSame(rn, rg);
+  // D is not used by any constraint, so nothing is differentiated numerically
+  REQUIRE(rg.NFunctionCalls == 2*rg.NIterations+1);
+
+  REQUIRE_THROWS_AS(generic.AddConstraint("wrong", {"A"}, sum_generic()), const APLCON::Error&);
+}
+
+TEST_CASE("Generic vector constraints", "") {
+  const auto invariant_mass = [] (const vector<double>& E, const vector<double>& p) {
+    return pow(E[0],2) - pow(p[0],2) - pow(p[1],2) - pow(p[2],2);
+  };
+  const auto momentum = [] (const vector< vector<double> >& x) {
+    return momentum_generic()(x);
+  };
+
+  vector<double> p_numerical{0.1, 0.5, 0.9}, p_generic(p_numerical);
+  const auto setup = [] (APLCON& a, vector<double>& p) {
+    a.AddMeasuredVariable("E", 1.1, 0.1);
+    a.LinkVariable("p", {&p[0], &p[1], &p[2]}, {0.05, 0.05, 0.05});
+    a.AddMeasuredVariable("pt1", 2.0, 0.2);
+    a.AddMeasuredVariable("phi1", 0.1, 0.05);
+    a.AddMeasuredVariable("pt2", 1.8, 0.2);
+    a.AddMeasuredVariable("phi2", 3.0, 0.05);
+  };
+
+  APLCON numerical("Numerical");
+  setup(numerical, p_numerical);
+  numerical.AddConstraint("invariant_mass", {"E", "p"}, invariant_mass);
+  numerical.AddConstraint("momentum", {"pt1", "phi1", "pt2", "phi2"}, momentum);
+
+  APLCON generic("Generic");
+  setup(generic, p_generic);
+  generic.AddConstraint("invariant_mass", {"E", "p"}, invariant_mass_generic());
+  generic.AddConstraint("momentum", {"pt1", "phi1", "pt2", "phi2"}, momentum_generic());
+
+  const auto& rn = numerical.DoFit();
+  const auto& rg = generic.DoFit();
+  REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+  RequireSame(rn, rg);
+  REQUIRE(rg.NFunctionCalls < rn.NFunctionCalls);
+}
+
+// more values than one chunk of duals
+struct curve_generic {
+  template<typename T>
+  vector<T> operator()(const vector<T>& y, const vector<T>& ab) const {
+    using std::exp;
+    vector<T> r;
+    for(size_t i=0;i<y.size();i++)
+      r.push_back(ab[0]*exp(ab[1]*(0.1*i)) - y[i]);
+    return r;
+  }
+};
+
+TEST_CASE("Generic constraints in chunks", "") {
+  const auto curve = [] (const vector<double>& y, const vector<double>& ab) {
+    return curve_generic()(y, ab);
+  };
+
+  const size_t n = 12;
+  vector<double> y_numerical(n);
+  for(size_t i=0;i<n;i++)
+    y_numerical[i] = 2*exp(0.05*i) + 0.01*sin(i);
+  vector<double> y_generic(y_numerical);
+  vector<double> ab_numerical{1, 0}, ab_generic(ab_numerical);
+  const auto setup = [n] (APLCON& a, vector<double>& y, vector<double>& ab) {
+    vector<double*> y_ptrs;
+    for(double& v : y)
+      y_ptrs.push_back(&v);
+    a.LinkVariable("y", y_ptrs, vector<double>(n, 0.05));
+    a.LinkVariable("ab", {&ab[0], &ab[1]}, vector<double>{0, 0});
+  };
+
+  APLCON numerical("Numerical");
+  setup(numerical, y_numerical, ab_numerical);
+  numerical.AddConstraint("curve", {"y", "ab"}, curve);
+
+  APLCON generic("Generic");
+  setup(generic, y_generic, ab_generic);
+  generic.AddConstraint("curve", {"y", "ab"}, curve_generic());
+
+  const auto& rn = numerical.DoFit();
+  const auto& rg = generic.DoFit();
+  REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+  RequireSame(rn, rg);
+  REQUIRE(rg.NFunctionCalls < rn.NFunctionCalls);
+}
@@ -0,0 +1,248 @@
+#include <APLCON.hpp>
+#include "detail/APLCON_solver.hpp"
+#include <vector>
+#include <cmath>
+
+// compare with the Fortran routines directly
+extern "C" {
+#include "wrapper/APLCON.h"
+}
+
+#include "catch.hpp"
+
+using namespace std;
+
+APLCON::Fit_Settings_t NativeSettings(APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default) {
+  settings.Engine = APLCON::Engine_t::Native;
+  return settings;
+}
+
+void RequireSame(const APLCON::Result_t& r1, const APLCON::Result_t& r2) {
+  REQUIRE(r1.Status == r2.Status);
+  REQUIRE(r1.NDoF == r2.NDoF);
+  REQUIRE(r1.NIterations == r2.NIterations);
+  // the Native engine displaces variables sharing no constraint at once
+  REQUIRE(r2.NFunctionCalls <= r1.NFunctionCalls);
+  REQUIRE(r1.ChiSquare == Approx(r2.ChiSquare));
+  // APLCON returns the probability as float
+  REQUIRE(r1.Probability == Approx(r2.Probability).epsilon(1e-5));
+  REQUIRE(r1.Variables.size() == r2.Variables.size());
+  for(const auto& it_var : r1.Variables) {
+    const auto& var = r2.Variables.at(it_var.first);
+    REQUIRE(it_var.second.Value.After == Approx(var.Value.After));
+    REQUIRE(it_var.second.Sigma.After == Approx(var.Sigma.After));
+    REQUIRE(it_var.second.Pull == Approx(var.Pull));
+  }
+  REQUIRE(r1.Covariances.size() == r2.Covariances.size());
+  for(size_t k=0;k<r1.Covariances.size();k++)
+    REQUIRE(r1.Covariances[k] == Approx(r2.Covariances[k]));
+}
+
+const auto equality_constraint = [] (double a, double b) { return a - b; };
+
+TEST_CASE("Simple fit", "") {
+  APLCON fortran("Fortran");
+  fortran.AddMeasuredVariable("BF_e_A",   0.1050, 0.01);
+  fortran.AddMeasuredVariable("BF_e_B",   0.135,  0.03);
+  fortran.AddMeasuredVariable("BF_tau_A", 0.095,  0.03);
+  fortran.AddMeasuredVariable("BF_tau_B", 0.14,   0.03);
+  fortran.AddConstraint("BF_e_equal", {"BF_e_A", "BF_e_B"}, equality_constraint);
+  fortran.AddConstraint("BF_tau_equal", {"BF_tau_A", "BF_tau_B"}, equality_constraint);
+  fortran.AddConstraint("BF_equal", {"BF_e_A", "BF_tau_A"}, equality_constraint);
+  fortran.SetCovariance("BF_e_B", "BF_tau_B", 8.96e-4);
+
+  APLCON native(fortran, "Native", NativeSettings());
+
+  const auto& r = native.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  RequireSame(fortran.DoFit(), r);
+  // a second fit gives the same result
+  RequireSame(fortran.DoFit(), native.DoFit());
+}
+
+TEST_CASE("Distributions, limits and unmeasured variables", "") {
+  const auto constraint = [] (double a, double b, double c, double d) {
+    return c - sqrt(a*b) + d - 3;
+  };
+
+  for(auto dist : {APLCON::Distribution_t::Gaussian,
+                   APLCON::Distribution_t::Poissonian,
+                   APLCON::Distribution_t::LogNormal,
+                   APLCON::Distribution_t::SquareRoot}) {
+    APLCON::Variable_Settings_t settings = APLCON::Variable_Settings_t::Default;
+    settings.Distribution = dist;
+    APLCON::Variable_Settings_t limited = APLCON::Variable_Settings_t::Default;
+    limited.Limit = {19.5, 20.5};
+
+    APLCON fortran("Fortran");
+    fortran.AddMeasuredVariable("A", 10, 0.3, settings);
+    fortran.AddMeasuredVariable("B", 20, 0.4, limited);
+    fortran.AddUnmeasuredVariable("C");
+    fortran.AddFixedVariable("D", 3, 0.1);
+    fortran.AddConstraint("sqrt(A*B)=C", {"A", "B", "C", "D"}, constraint);
+    fortran.AddConstraint("A+B=30", {"A", "B"}, [] (double a, double b) { return a + b - 30; });
+
+    APLCON native(fortran, "Native", NativeSettings());
+    const auto& r = native.DoFit();
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+    RequireSame(fortran.DoFit(), r);
+  }
+}
+
+TEST_CASE("Line fit", "") {
+  // see also 04_linefit.cc
+  const vector<double> x{1, 2, 3, 4};
+  const vector<double> sx{0.2, 0.23, 0.16, 0.21};
+  const vector<double> y{1.1, 1.95, 2.02, 3.98};
+  const vector<double> sy{0.08, 0.04, 0.11, 0.07};
+
+  const auto residuals = [] (const vector< vector<double> >& arg) {
+    const double& a = arg[0][0];
+    const double& b = arg[1][0];
+    vector<double> r(arg[2].size());
+    for(size_t i=0;i<r.size();i++)
+      r[i] = a + b*arg[2][i] - arg[3][i];
+    return r;
+  };
+
+  // each instance needs its own linked storage
+  vector<double> x_f(x), y_f(y), x_n(x), y_n(y);
+  auto linker = [] (vector<double>& v) {
+    vector<double*> p;
+    for(double& d : v)
+      p.push_back(&d);
+    return p;
+  };
+
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.MaxIterations = 500;
+  APLCON fortran("Fortran", settings);
+  APLCON native("Native", NativeSettings(settings));
+  fortran.LinkVariable("x", linker(x_f), sx);
+  fortran.LinkVariable("y", linker(y_f), sy);
+  native.LinkVariable("x", linker(x_n), sx);
+  native.LinkVariable("y", linker(y_n), sy);
+  for(APLCON* a : {&fortran, &native}) {
+    a->AddUnmeasuredVariable("a");
+    a->AddUnmeasuredVariable("b");
+    a->AddConstraint("residuals", vector<string>{"a", "b", "x", "y"}, residuals);
+  }
+
+  const auto& r = native.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  RequireSame(fortran.DoFit(), r);
+  for(size_t i=0;i<x.size();i++) {
+    REQUIRE(x_n[i] == Approx(x_f[i]));
+    REQUIRE(y_n[i] == Approx(y_f[i]));
+  }
+}
+
+TEST_CASE("Analytic derivatives", "") {
+  APLCON fortran("Fortran");
+  fortran.AddMeasuredVariable("A", 10, 0.3);
+  fortran.AddMeasuredVariable("B", 20, 0.4);
+  fortran.AddUnmeasuredVariable("C");
+  fortran.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                        [] (double a, double b, double c) { return c - sqrt(a*b); },
+                        [] (double a, double b, double) -> vector<double> {
+    const double s = sqrt(a*b);
+    return {-b/(2*s), -a/(2*s), 1};
+  });
+  fortran.AddConstraint("A+B=30", {"A", "B"}, [] (double a, double b) { return a + b - 30; });
+
+  APLCON native(fortran, "Native", NativeSettings());
+  const auto& r = native.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  RequireSame(fortran.DoFit(), r);
+}
+
+TEST_CASE("Redundant constraint", "") {
+  // all variables are measured, but A*V*A^T is singular,
+  // so the Native engine falls back to the pivot search of DUMINV
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.CollectStatistics = true;
+  APLCON fortran("Fortran", settings);
+  fortran.AddMeasuredVariable("A", 10, 0.3);
+  fortran.AddMeasuredVariable("B", 11, 0.4);
+  fortran.AddMeasuredVariable("C", 12, 0.5);
+  fortran.AddConstraint("A=B", {"A", "B"}, equality_constraint);
+  fortran.AddConstraint("B=C", {"B", "C"}, equality_constraint);
+  fortran.AddConstraint("A=C", {"A", "C"}, equality_constraint);
+
+  APLCON native(fortran, "Native", NativeSettings(settings));
+  const auto& r = native.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  const auto& rf = fortran.DoFit();
+  RequireSame(rf, r);
+  REQUIRE(r.Statistics.MatrixRank == rf.Statistics.MatrixRank);
+}
+
+TEST_CASE("Too many iterations", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.MaxIterations = 3;
+  settings.ConstraintAccuracy = 1e-30;
+  APLCON fortran("Fortran", settings);
+  fortran.AddMeasuredVariable("A", 10, 0.3);
+  fortran.AddMeasuredVariable("B", 20, 0.4);
+  fortran.AddConstraint("A*B=300", {"A", "B"}, [] (double a, double b) { return a*b - 300; });
+
+  APLCON native(fortran, "Native", NativeSettings(settings));
+  const auto& r = native.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::TooManyIterations);
+  RequireSame(fortran.DoFit(), r);
+}
+
+TEST_CASE("Batch", "") {
+  APLCON fortran("Fortran");
+  fortran.AddMeasuredVariable("A", 10, 0.3);
+  fortran.AddMeasuredVariable("B", 20, 0.4);
+  fortran.AddUnmeasuredVariable("C");
+  fortran.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                        [] (double a, double b, double c) { return c - sqrt(a*b); });
+  fortran.AddConstraint("A+B=30", {"A", "B"}, [] (double a, double b) { return a + b - 30; });
+  APLCON native(fortran, "Native", NativeSettings());
+
+  const size_t N = 100;
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  for(size_t i=0;i<3;i++)
+    for(size_t n=0;n<N;n++)
+      input.Values.push_back(10*(i+1) + 0.01*n);
+
+  const auto& rf = fortran.FitBatch(input, 2);
+  const auto& rn = native.FitBatch(input, 2);
+  for(size_t n=0;n<N;n++) {
+    REQUIRE(rn.Status[n] == rf.Status[n]);
+    REQUIRE(rn.NFunctionCalls[n] <= rf.NFunctionCalls[n]);
+    REQUIRE(rn.ChiSquare[n] == Approx(rf.ChiSquare[n]));
+  }
+  for(size_t k=0;k<rf.Values.size();k++) {
+    REQUIRE(rn.Values[k] == Approx(rf.Values[k]));
+    REQUIRE(rn.Pulls[k] == Approx(rf.Pulls[k]));
+  }
+  for(size_t k=0;k<rf.Covariances.size();k++)
+    REQUIRE(rn.Covariances[k] == Approx(rf.Covariances[k]));
+}
+
+TEST_CASE("SMAVAT", "") {
+  // the C++ kernel gives the same packed A*V*A^T as the Fortran routine,
+  // also for leading zeros in the rows of V and a zero row of A
+  for(bool diagonal : {false, true}) {
+    const size_t n = 37;
+    const size_t m = 9;
+    vector<double> V((n*n+n)/2), A(m*n);
+    for(size_t i=0;i<n;i++) {
+      for(size_t k=0;k<=i;k++)
+        V[(i*i+i)/2+k] = k == i ? 1 + 0.1*i : diagonal || k < i/2 ? 0 : sin(i+k)/n;
+    }
+    for(size_t j=0;j<m;j++) {
+      for(size_t i=0;i<n;i++)
+        A[n*j+i] = j == 3 ? 0 : cos(j*n+i);
+    }
+    vector<double> AV(m*n), W((m*m+m)/2), W_fortran(W.size());
+    c_aplcon_smavat(V.data(), A.data(), W_fortran.data(), n, m);
+    APLCON_::SMAVAT(V.data(), A.data(), n, m, AV.data(), W.data());
+    for(size_t k=0;k<W.size();k++)
+      REQUIRE(W[k] == Approx(W_fortran[k]));
+  }
+}
@@ -0,0 +1,100 @@
+#include "detail/APLCON_kernels.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+using APLCON_::Kernels_t;
+
+vector<double> KernelsInput(size_t n, double seed) {
+  vector<double> x(n);
+  for(size_t i=0;i<n;i++)
+    x[i] = sin(seed*(i+1)) / (1+0.1*i);
+  return x;
+}
+
+// compares the outputs bit by bit
+bool Same(const vector<double>& a, const vector<double>& b) {
+  return a.size() == b.size() && equal(a.begin(), a.end(), b.begin());
+}
+
+TEST_CASE("Kernels selected", "") {
+  const Kernels_t& k = APLCON_::Kernels();
+  REQUIRE(APLCON_::KernelsFor(k.ISA) == &k);
+  REQUIRE(APLCON_::KernelsFor(Kernels_t::ISA_t::Default) != nullptr);
+}
+
+TEST_CASE("Kernels", "") {
+  const Kernels_t& d = *APLCON_::KernelsFor(Kernels_t::ISA_t::Default);
+
+  // the default variant computes what it should
+  const vector<double> x = {1, 2, 3, 4, 5};
+  const vector<double> y = {0.5, -1, 2, 0.25, 1};
+  REQUIRE(d.Dot(x.data(), y.data(), 5) == Approx(0.5-2+6+1+5));
+  vector<double> z = y;
+  d.Axpy(2, x.data(), z.data(), 5);
+  REQUIRE(z == vector<double>({2.5, 3, 8, 8.25, 11}));
+  d.Scale(-1, x.data(), z.data(), 5);
+  REQUIRE(z == vector<double>({-1, -2, -3, -4, -5}));
+  // packed 3x3
+  const vector<double> V = {4, 1, 9, 2, 3, 16};
+  vector<double> diag(3);
+  d.Diagonal(V.data(), 3, diag.data());
+  REQUIRE(diag == vector<double>({4, 9, 16}));
+  const vector<double> s = {0.5, 1.0/3, 0.25};
+  vector<double> R(6);
+  d.ScaleSymmetric(V.data(), s.data(), 3, R.data());
+  REQUIRE(R[0] == 1);
+  REQUIRE(R[1] == Approx(1.0/6));
+  REQUIRE(R[2] == Approx(1));
+  REQUIRE(R[5] == 1);
+
+  // all variants supported by this CPU agree bit by bit, also for the remainders
+  for(auto isa : {Kernels_t::ISA_t::AVX2, Kernels_t::ISA_t::AVX512}) {
+    const Kernels_t* k = APLCON_::KernelsFor(isa);
+    if(k == nullptr)
+      continue;
+    REQUIRE(k->ISA == isa);
+    for(size_t n : {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 64, 101}) {
+      const vector<double> a = KernelsInput(n, 1.3);
+      const vector<double> b = KernelsInput(n, 0.7);
+      REQUIRE(k->Dot(a.data(), b.data(), n) == d.Dot(a.data(), b.data(), n));
+
+      vector<double> r1 = b, r2 = b;
+      k->Axpy(0.3, a.data(), r1.data(), n);
+      d.Axpy(0.3, a.data(), r2.data(), n);
+      REQUIRE(Same(r1, r2));
+      for(double f : {1.0, -1.0, 1.7}) {
+        k->Scale(f, a.data(), r1.data(), n);
+        d.Scale(f, a.data(), r2.data(), n);
+        REQUIRE(Same(r1, r2));
+      }
+
+      const vector<double> P = KernelsInput(n*(n+1)/2, 0.9);
+      vector<double> d1(n), d2(n);
+      k->Diagonal(P.data(), n, d1.data());
+      d.Diagonal(P.data(), n, d2.data());
+      REQUIRE(Same(d1, d2));
+      vector<double> R1(P.size()), R2(P.size());
+      k->ScaleSymmetric(P.data(), a.data(), n, R1.data());
+      d.ScaleSymmetric(P.data(), a.data(), n, R2.data());
+      REQUIRE(Same(R1, R2));
+
+      // A*V*A^T with 3 rows, where V has leading zeros in some rows
+      const size_t m = 3;
+      vector<double> A = KernelsInput(m*n, 0.4);
+      vector<double> Q = P;
+      for(size_t i=1;i<n;i+=2)
+        Q[i*(i+1)/2] = 0;
+      vector<double> Y1(m*n), Y2(m*n), W1(m*(m+1)/2), W2(m*(m+1)/2);
+      k->MultiplyAV(Q.data(), A.data(), n, m, Y1.data());
+      d.MultiplyAV(Q.data(), A.data(), n, m, Y2.data());
+      REQUIRE(Same(Y1, Y2));
+      k->MultiplyABt(Y1.data(), A.data(), n, m, W1.data());
+      d.MultiplyABt(Y2.data(), A.data(), n, m, W2.data());
+      REQUIRE(Same(W1, W2));
+    }
+  }
+}
@@ -0,0 +1,201 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// generic functors, evaluated for several events at once by FitBatch
+
+struct sqrt_generic {
+  template<typename T>
+  T operator()(const T& a, const T& b, const T& c) const {
+    using std::sqrt;
+    return c - sqrt(a*b);
+  }
+};
+
+struct sum_generic {
+  template<typename T>
+  T operator()(const T& a, const T& b, const T& d) const {
+    return a + b - d;
+  }
+};
+
+struct momentum_generic {
+  template<typename T>
+  T operator()(const T& pt1, const T& phi1, const T& pt2, const T& phi2) const {
+    using std::cos;
+    return pt1*cos(phi1) + pt2*cos(phi2);
+  }
+};
+
+// the variables are ordered by name in the fitter,
+// so A, B, C, D, phi1, phi2, pt1, pt2 correspond to index 0 to 7
+void SetupFit(APLCON& a, APLCON::Engine_t engine, unsigned lanes) {
+  a.AddMeasuredVariable("A", 10, 0.3);
+  a.AddMeasuredVariable("B", 20, 0.4);
+  a.AddUnmeasuredVariable("C");
+  a.AddFixedVariable("D", 30, 0.5);
+  a.AddMeasuredVariable("pt1", 2.0, 0.2);
+  a.AddMeasuredVariable("phi1", 0.1, 0.05);
+  a.AddMeasuredVariable("pt2", 1.8, 0.2);
+  a.AddMeasuredVariable("phi2", 3.0, 0.05);
+  a.SetCovariance("pt1", "pt2", 0.01);
+  a.AddLaneConstraint("sqrt(A*B)=C", {"A", "B", "C"}, sqrt_generic());
+  a.AddLaneConstraint("A+B=D", {"A", "B", "D"}, sum_generic());
+  a.AddLaneConstraint("momentum", {"pt1", "phi1", "pt2", "phi2"}, momentum_generic());
+  auto settings = a.GetSettings();
+  settings.Engine = engine;
+  settings.BatchLanes = lanes;
+  a.SetSettings(settings);
+}
+
+APLCON::Batch_Input_t MakeInput(size_t N) {
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  input.Values.resize(8*N);
+  input.Sigmas.resize(8*N);
+  const vector<double> values{10, 20, 0, 30, 0.1, 3.0, 2.0, 1.8};
+  const vector<double> sigmas{0.3, 0.4, 0, 0.5, 0.05, 0.05, 0.2, 0.2};
+  for(size_t n=0;n<N;n++) {
+    for(size_t i=0;i<8;i++) {
+      input.Values[i*N+n] = values[i];
+      input.Sigmas[i*N+n] = sigmas[i];
+    }
+    // spread the events, so they need different numbers of iterations
+    input.Values[0*N+n] += 0.05*n;
+    input.Values[1*N+n] -= 0.03*(n%7);
+    input.Values[4*N+n] += 0.02*(n%5);
+    input.Values[6*N+n] += 0.1*(n%3);
+    input.Sigmas[0*N+n] += 0.01*n;
+  }
+  return input;
+}
+
+void RequireSame(const APLCON::Batch_Result_t& rl, const APLCON::Batch_Result_t& rs) {
+  const size_t N = rs.NEvents;
+  REQUIRE(rl.NEvents == N);
+  REQUIRE(rl.VariableNames == rs.VariableNames);
+  for(size_t n=0;n<N;n++) {
+    REQUIRE(rl.Status[n] == rs.Status[n]);
+    REQUIRE(rl.ChiSquare[n] == Approx(rs.ChiSquare[n]).scale(1));
+    REQUIRE(rl.NDoF[n] == rs.NDoF[n]);
+    REQUIRE(rl.Probability[n] == Approx(rs.Probability[n]));
+    REQUIRE(rl.NIterations[n] == rs.NIterations[n]);
+    REQUIRE(rl.NFunctionCalls[n] == rs.NFunctionCalls[n]);
+  }
+  for(size_t k=0;k<rs.Values.size();k++) {
+    REQUIRE(rl.Values[k] == Approx(rs.Values[k]).scale(1));
+    REQUIRE(rl.Sigmas[k] == Approx(rs.Sigmas[k]).scale(1));
+    REQUIRE(rl.Pulls[k] == Approx(rs.Pulls[k]).scale(1));
+  }
+  REQUIRE(rl.Covariances.size() == rs.Covariances.size());
+  for(size_t k=0;k<rs.Covariances.size();k++)
+    REQUIRE(rl.Covariances[k] == Approx(rs.Covariances[k]).scale(1));
+}
+
+TEST_CASE("Lanes like single fits", "") {
+  // not a multiple of the lanes
+  const auto& input = MakeInput(37);
+
+  APLCON single("Single");
+  SetupFit(single, APLCON::Engine_t::Native, 0);
+  const auto& rs = single.FitBatch(input, 1);
+  REQUIRE(rs.Status[0] == APLCON::Result_Status_t::Success);
+  REQUIRE(rs.NDoF[0] == 2);
+
+  // the Fortran engine fits each event on its own
+  APLCON fortran("Fortran");
+  SetupFit(fortran, APLCON::Engine_t::Fortran, 4);
+  RequireSame(fortran.FitBatch(input, 1), rs);
+
+  for(unsigned lanes : {4u, 8u}) {
+    APLCON a("Lanes");
+    SetupFit(a, APLCON::Engine_t::Native, lanes);
+    for(unsigned nThreads : {1u, 3u})
+      RequireSame(a.FitBatch(input, nThreads), rs);
+  }
+}
+
+TEST_CASE("Lanes with different events", "") {
+  auto input = MakeInput(20);
+  const size_t N = input.NEvents;
+  // C is measured in one event, and A unmeasured in another,
+  // these are fitted on their own
+  input.Values[2*N+3] = 14;
+  input.Sigmas[2*N+3] = 1;
+  input.Sigmas[0*N+11] = 0;
+  // far off, needs more iterations than allowed
+  input.Values[4*N+6] = 1.4;
+
+  APLCON single("Single");
+  SetupFit(single, APLCON::Engine_t::Native, 0);
+  auto settings = single.GetSettings();
+  settings.MaxIterations = 3;
+  single.SetSettings(settings);
+  const auto& rs = single.FitBatch(input, 1);
+  REQUIRE(rs.NDoF[3] == 3);
+  REQUIRE(rs.NDoF[11] == 1);
+  REQUIRE(rs.Status[6] == APLCON::Result_Status_t::TooManyIterations);
+
+  APLCON a("Lanes");
+  SetupFit(a, APLCON::Engine_t::Native, 0);
+  settings.BatchLanes = 4;
+  a.SetSettings(settings);
+  RequireSame(a.FitBatch(input, 1), rs);
+}
+
+struct difference_generic {
+  template<typename T>
+  T operator()(const T& a, const T& b, const T& d) const {
+    return a - b - d;
+  }
+};
+
+struct fixed_generic {
+  template<typename T>
+  T operator()(const T& c) const {
+    return c - 30;
+  }
+};
+
+TEST_CASE("Lanes with more constraints than measured variables", "") {
+  // C and D are unmeasured, so A*V*A^T is singular
+  const auto setup = [] (APLCON& a, unsigned lanes) {
+    a.AddMeasuredVariable("A", 10, 0.3);
+    a.AddMeasuredVariable("B", 20, 0.4);
+    a.AddUnmeasuredVariable("C");
+    a.AddUnmeasuredVariable("D");
+    a.SetCovariance("A", "B", 0.02);
+    a.AddLaneConstraint("A+B=C", {"A", "B", "C"}, sum_generic());
+    a.AddLaneConstraint("C=30", {"C"}, fixed_generic());
+    a.AddLaneConstraint("A-B=D", {"A", "B", "D"}, difference_generic());
+    auto settings = a.GetSettings();
+    settings.Engine = APLCON::Engine_t::Native;
+    settings.BatchLanes = lanes;
+    a.SetSettings(settings);
+  };
+
+  const size_t N = 13;
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  for(size_t n=0;n<N;n++)
+    input.Values.push_back(10+0.1*n); // A
+  for(size_t n=0;n<N;n++)
+    input.Values.push_back(20-0.2*n); // B
+  input.Values.resize(4*N, 0);
+
+  APLCON single("Single");
+  setup(single, 0);
+  const auto& rs = single.FitBatch(input, 1);
+  REQUIRE(rs.Status[0] == APLCON::Result_Status_t::Success);
+  REQUIRE(rs.NDoF[0] == 1);
+
+  for(unsigned lanes : {4u, 8u}) {
+    APLCON a("Lanes");
+    setup(a, lanes);
+    RequireSame(a.FitBatch(input, 1), rs);
+  }
+}
@@ -0,0 +1,100 @@
+#include <APLCON.hpp>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// runs f with the file descriptor of STDOUT redirected to a temporary file,
+// which also catches the output of the Fortran unit 6,
+// provided it is unbuffered (see CMakeLists.txt)
+string CaptureStdout(const function<void()>& f) {
+  cout.flush();
+  fflush(stdout);
+  FILE* tmp = tmpfile();
+  REQUIRE(tmp != nullptr);
+  const int saved = dup(STDOUT_FILENO);
+  dup2(fileno(tmp), STDOUT_FILENO);
+  f();
+  cout.flush();
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  string output;
+  rewind(tmp);
+  int c;
+  while((c = fgetc(tmp)) != EOF)
+    output.push_back(static_cast<char>(c));
+  fclose(tmp);
+  return output;
+}
+
+TEST_CASE("Capture output", "") {
+  const string& output = CaptureStdout([] () {
+    APLCON a("Output");
+    a.AddMeasuredVariable("A", 10, 0.3);
+    a.AddMeasuredVariable("B", 20, 0.4);
+    a.AddConstraint("A+B=30", {"A", "B"},
+                    [] (double a, double b) { return a + b - 30; });
+    auto settings = a.GetSettings();
+    settings.DebugLevel = 5;
+    a.SetSettings(settings);
+    a.DoFit();
+  });
+  // the banner is printed for DebugLevel 5
+  REQUIRE(output.find("APLCON - constrained least squares") != string::npos);
+}
+
+TEST_CASE("No banner in threads", "") {
+  APLCON a("Batch");
+  a.AddMeasuredVariable("A", 10, 0.3);
+  a.AddMeasuredVariable("B", 20, 0.4);
+  a.AddUnmeasuredVariable("C");
+  a.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                  [] (double a, double b, double c) { return c - sqrt(a*b); });
+  a.AddConstraint("A+B=30", {"A", "B"},
+                  [] (double a, double b) { return a + b - 30; });
+
+  const size_t N = 20;
+  APLCON::Batch_Input_t input;
+  input.NEvents = N;
+  input.Values.resize(3*N);
+  for(size_t n=0;n<N;n++) {
+    input.Values[0*N+n] = 10+0.05*n;
+    input.Values[1*N+n] = 20-0.03*n;
+    input.Values[2*N+n] = 0;
+  }
+
+  // each worker thread starts with a fresh Fortran state
+  const string& output = CaptureStdout([&] () {
+    const auto& rb = a.FitBatch(input, 4);
+    REQUIRE(rb.NEvents == N);
+  });
+  REQUIRE(output == "");
+}
+
+TEST_CASE("No output with DebugLevel 0", "") {
+  const string& output = CaptureStdout([] () {
+    APLCON a("Silent");
+    APLCON::Variable_Settings_t lognormal = APLCON::Variable_Settings_t::Default;
+    lognormal.Distribution = APLCON::Distribution_t::LogNormal;
+    APLCON::Variable_Settings_t squareroot = APLCON::Variable_Settings_t::Default;
+    squareroot.Distribution = APLCON::Distribution_t::SquareRoot;
+    a.AddMeasuredVariable("A", 10, 0.3, lognormal);
+    a.AddMeasuredVariable("B", 20, 0.4, squareroot);
+    a.AddUnmeasuredVariable("C");
+    a.SetCovariance("A", "B", 0.05);
+    a.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                    [] (double a, double b, double c) { return c - sqrt(a*b); });
+    a.AddConstraint("A+B=30", {"A", "B"},
+                    [] (double a, double b) { return a + b - 30; });
+    const auto& r = a.DoFit();
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  });
+  REQUIRE(output == "");
+}
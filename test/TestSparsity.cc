@@ -0,0 +1,152 @@
+#include <APLCON.hpp>
+#include <atomic>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// exponential curve with one constraint per point,
+// counting the evaluations of all constraints
+APLCON::Result_t FitCurve(const APLCON::Fit_Settings_t& settings, atomic<size_t>& nEvaluated) {
+  APLCON a("Curve", settings);
+  const size_t n = 20;
+  for(size_t i=0;i<n;i++)
+    a.AddMeasuredVariable("y"+to_string(i), 2*exp(0.05*i) + 0.01*sin(i), 0.05);
+  a.AddUnmeasuredVariable("a", 1);
+  a.AddUnmeasuredVariable("b", 0);
+  for(size_t i=0;i<n;i++) {
+    const double x_i = 0.1*i;
+    a.AddConstraint("curve"+to_string(i), {"a", "b", "y"+to_string(i)},
+                    [x_i, &nEvaluated] (double a, double b, double y) {
+      nEvaluated++;
+      return a*exp(b*x_i) - y;
+    });
+  }
+  nEvaluated = 0;
+  return a.DoFit();
+}
+
+TEST_CASE("Sparse numerical derivatives", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.MaxIterations = 50;
+  atomic<size_t> nFortran(0);
+  const APLCON::Result_t rf = FitCurve(settings, nFortran);
+  settings.Engine = APLCON::Engine_t::Native;
+  atomic<size_t> nNative(0);
+  const APLCON::Result_t rn = FitCurve(settings, nNative);
+  REQUIRE(rf.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+
+  // the same derivatives, but all y are displaced at once
+  REQUIRE(rf.NIterations == rn.NIterations);
+  REQUIRE(rn.NFunctionCalls < rf.NFunctionCalls);
+  REQUIRE(rf.ChiSquare == Approx(rn.ChiSquare));
+  for(size_t k=0;k<rf.Covariances.size();k++)
+    REQUIRE(rn.Covariances[k] == Approx(rf.Covariances[k]));
+
+  // but each displaced y only evaluates its own constraint,
+  // (the first fit evaluates all once more to count their values)
+  REQUIRE(nFortran == 20*(rf.NFunctionCalls+1));
+  REQUIRE(nNative < nFortran/2);
+}
+
+TEST_CASE("Grouped numerical derivatives", "") {
+  // independent sub-fits sharing an unmeasured variable,
+  // all variables enter non-linearly, so no column is reused
+  const size_t n = 10;
+  APLCON::Result_t results[2];
+  for(auto engine : {APLCON::Engine_t::Fortran, APLCON::Engine_t::Native}) {
+    APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+    settings.Engine = engine;
+    settings.CollectStatistics = true;
+    settings.MaxIterations = 50;
+    APLCON a("Groups", settings);
+    a.AddUnmeasuredVariable("s", 1);
+    for(size_t i=0;i<n;i++) {
+      const string p = "p"+to_string(i);
+      const string q = "q"+to_string(i);
+      a.AddMeasuredVariable(p, 1+0.1*i, 0.1);
+      a.AddMeasuredVariable(q, 2-0.1*i, 0.1);
+      a.AddConstraint(p+"*"+q+"=s", {p, q, "s"}, [] (double p, double q, double s) { return p*q - s; });
+    }
+    results[engine == APLCON::Engine_t::Native] = a.DoFit();
+  }
+  const APLCON::Result_t& rf = results[0];
+  const APLCON::Result_t& rn = results[1];
+  REQUIRE(rf.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(rn.Status == rf.Status);
+  REQUIRE(rn.NIterations == rf.NIterations);
+  REQUIRE(rn.Statistics.NReusedColumns == 0);
+  REQUIRE(rn.Statistics.NJacobians == rf.Statistics.NJacobians);
+  REQUIRE(rn.ChiSquare == Approx(rf.ChiSquare));
+  for(size_t k=0;k<rf.Covariances.size();k++)
+    REQUIRE(rn.Covariances[k] == Approx(rf.Covariances[k]));
+
+  // s, all p and all q form three groups,
+  // so a Jacobian needs 2*3 instead of 2*21 points
+  REQUIRE(rf.NFunctionCalls-rn.NFunctionCalls == 2*(21-3)*rf.Statistics.NJacobians);
+}
+
+TEST_CASE("Sparse numerical derivatives in threads", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.MaxIterations = 50;
+  settings.Engine = APLCON::Engine_t::Native;
+  atomic<size_t> nSerial(0);
+  const APLCON::Result_t expected = FitCurve(settings, nSerial);
+  settings.DerivativeThreads = 3;
+  atomic<size_t> nThreads(0);
+  const APLCON::Result_t r = FitCurve(settings, nThreads);
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(r.NFunctionCalls == expected.NFunctionCalls);
+  REQUIRE(r.ChiSquare == expected.ChiSquare);
+  REQUIRE(r.Covariances == expected.Covariances);
+  REQUIRE(nThreads == nSerial);
+}
+
+TEST_CASE("Sparse equation system", "") {
+  // large enough for the sparse path of the Native engine, with correlated
+  // neighbours and a second unmeasured variable in some constraints
+  const size_t n = 150;
+  APLCON::Result_t results[2];
+  for(auto engine : {APLCON::Engine_t::Fortran, APLCON::Engine_t::Native}) {
+    APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+    settings.Engine = engine;
+    settings.MaxIterations = 50;
+    APLCON a("Sparse", settings);
+    a.AddUnmeasuredVariable("a", 1);
+    a.AddUnmeasuredVariable("b", 0);
+    a.AddUnmeasuredVariable("c", 0);
+    for(size_t i=0;i<n;i++) {
+      const string y = "y"+to_string(i);
+      a.AddMeasuredVariable(y, 2*exp(0.01*i) + 0.01*sin(i), 0.05);
+      if(i % 2 == 1)
+        a.SetCovariance(y, "y"+to_string(i-1), 0.001);
+      const double x = 0.01*i;
+      if(i % 10 == 0)
+        a.AddConstraint(y, {"a", "b", "c", y}, [x] (double a, double b, double c, double y) {
+          return a*exp(b*x) + c - y;
+        });
+      else
+        a.AddConstraint(y, {"a", "b", y}, [x] (double a, double b, double y) {
+          return a*exp(b*x) - y;
+        });
+    }
+    results[engine == APLCON::Engine_t::Native] = a.DoFit();
+  }
+  const APLCON::Result_t& rf = results[0];
+  const APLCON::Result_t& rn = results[1];
+  REQUIRE(rf.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(rn.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(rf.NIterations == rn.NIterations);
+  REQUIRE(rf.ChiSquare == Approx(rn.ChiSquare));
+  REQUIRE(rf.Covariances.size() == rn.Covariances.size());
+  for(size_t k=0;k<rf.Covariances.size();k++)
+    REQUIRE(rn.Covariances[k] == Approx(rf.Covariances[k]));
+  for(const auto& it : rf.Variables) {
+    const APLCON::Result_Variable_t& v = rn.Variables.at(it.first);
+    REQUIRE(v.Value.After == Approx(it.second.Value.After));
+    REQUIRE(v.Pull == Approx(it.second.Pull));
+  }
+}
@@ -0,0 +1,163 @@
+#include <APLCON.hpp>
+#include <array>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// the same fit as in TestLanes, with the variables ordered by name as in APLCON,
+// so A, B, C, D, phi1, phi2, pt1, pt2 correspond to index 0 to 7
+
+struct constraints_generic {
+  template<typename T>
+  void operator()(const array<T, 8>& x, array<T, 3>& f) const {
+    using std::sqrt;
+    using std::cos;
+    f[0] = x[2] - sqrt(x[0]*x[1]);
+    f[1] = x[0] + x[1] - x[3];
+    f[2] = x[6]*cos(x[4]) + x[7]*cos(x[5]);
+  }
+};
+
+struct constraints_double {
+  void operator()(const array<double, 8>& x, array<double, 3>& f) const {
+    constraints_generic()(x, f);
+  }
+};
+
+static_assert(APLCON::Static<8, 3, constraints_generic>::Analytic, "dual numbers for templated functor");
+static_assert(!APLCON::Static<8, 3, constraints_double>::Analytic, "numerical derivatives otherwise");
+static_assert(APLCON::Static<8, 3, constraints_double>::V_ij(2, 5) == 17, "packed index at compile time");
+
+struct constraints_args {
+  template<typename T>
+  vector<T> operator()(const T& A, const T& B, const T& C, const T& D,
+                       const T& phi1, const T& phi2, const T& pt1, const T& pt2) const {
+    array<T, 3> f;
+    constraints_generic()(array<T, 8>{{A, B, C, D, phi1, phi2, pt1, pt2}}, f);
+    return vector<T>(f.begin(), f.end());
+  }
+};
+
+const array<string, 8> names{{"A", "B", "C", "D", "phi1", "phi2", "pt1", "pt2"}};
+
+void SetupFit(APLCON& a, bool analytic) {
+  a.AddMeasuredVariable("A", 10, 0.3);
+  a.AddMeasuredVariable("B", 20, 0.4);
+  a.AddUnmeasuredVariable("C");
+  a.AddFixedVariable("D", 30, 0.5);
+  a.AddMeasuredVariable("pt1", 2.0, 0.2);
+  a.AddMeasuredVariable("phi1", 0.1, 0.05);
+  a.AddMeasuredVariable("pt2", 1.8, 0.2);
+  a.AddMeasuredVariable("phi2", 3.0, 0.05);
+  a.SetCovariance("pt1", "pt2", 0.01);
+  // the same constraints for the dynamic instance
+  const auto& constraint = [] (double A, double B, double C, double D,
+                               double phi1, double phi2, double pt1, double pt2) {
+    array<double, 3> f;
+    constraints_double()({{A, B, C, D, phi1, phi2, pt1, pt2}}, f);
+    return vector<double>(f.begin(), f.end());
+  };
+  const vector<string> varnames(names.begin(), names.end());
+  if(analytic)
+    a.AddConstraint("Constraints", varnames, constraints_args());
+  else
+    a.AddConstraint("Constraints", varnames, constraint);
+  auto settings = a.GetSettings();
+  settings.Engine = APLCON::Engine_t::Native;
+  a.SetSettings(settings);
+}
+
+template<typename Fit>
+void SetupFit(Fit& s) {
+  s.SetVariable(0, 10, 0.3);
+  s.SetVariable(1, 20, 0.4);
+  s.SetVariable(3, 30, 0.5);
+  s.SetVariable(4, 0.1, 0.05);
+  s.SetVariable(5, 3.0, 0.05);
+  s.SetVariable(6, 2.0, 0.2);
+  s.SetVariable(7, 1.8, 0.2);
+  s.SetCovariance(6, 7, 0.01);
+  APLCON::Variable_Settings_t fixed = APLCON::Variable_Settings_t::Default;
+  fixed.StepSize = 0;
+  s.SetVariableSettings(3, fixed);
+}
+
+void RequireSame(const APLCON::Result_t& r1, const APLCON::Result_t& r2, bool same_calls) {
+  REQUIRE(r1.Status == r2.Status);
+  REQUIRE(r1.NDoF == r2.NDoF);
+  REQUIRE(r1.NIterations == r2.NIterations);
+  if(same_calls)
+    REQUIRE(r1.NFunctionCalls == r2.NFunctionCalls);
+  REQUIRE(r1.ChiSquare == Approx(r2.ChiSquare));
+  REQUIRE(r1.Probability == Approx(r2.Probability));
+  REQUIRE(r1.Variables.size() == r2.Variables.size());
+  for(const auto& it_var : r1.Variables) {
+    const auto& var = r2.Variables.at(it_var.first);
+    REQUIRE(it_var.second.Value.Before == var.Value.Before);
+    REQUIRE(it_var.second.Sigma.Before == Approx(var.Sigma.Before));
+    REQUIRE(it_var.second.Value.After == Approx(var.Value.After));
+    REQUIRE(it_var.second.Sigma.After == Approx(var.Sigma.After).scale(1));
+    REQUIRE(it_var.second.Pull == Approx(var.Pull).scale(1));
+  }
+  REQUIRE(r1.Constraints.size() == r2.Constraints.size());
+  REQUIRE(r1.Constraints.at("Constraints").Dimension == 3);
+  REQUIRE(r1.Covariances.size() == r2.Covariances.size());
+  for(size_t k=0;k<r1.Covariances.size();k++)
+    REQUIRE(r1.Covariances[k] == Approx(r2.Covariances[k]).scale(1));
+}
+
+TEST_CASE("Static with dual numbers", "") {
+  APLCON a("Dynamic");
+  SetupFit(a, true);
+  const auto& r = a.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(r.NDoF == 2);
+
+  APLCON::Static<8, 3, constraints_generic> s("Static", names);
+  SetupFit(s);
+  RequireSame(s.DoFit(), r, true);
+  // a second fit gives the same result
+  RequireSame(s.DoFit(), r, true);
+}
+
+TEST_CASE("Static with numerical derivatives", "") {
+  APLCON a("Dynamic");
+  SetupFit(a, false);
+  const auto& r = a.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+
+  APLCON::Static<8, 3, constraints_double> s("Static", names);
+  SetupFit(s);
+  RequireSame(s.DoFit(), r, false);
+}
+
+TEST_CASE("Static compact result", "") {
+  APLCON::Static<8, 3, constraints_generic> s("Static", names);
+  SetupFit(s);
+  auto settings = s.GetSettings();
+  settings.WarmStart = APLCON::WarmStart_t::Unmeasured;
+  s.SetSettings(settings);
+
+  APLCON::Compact_Result_t r;
+  s.DoFit(r);
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(r.Name == "Static");
+  REQUIRE(r.NScalarConstraints == 3);
+  REQUIRE(r.Index("pt1") == 6);
+  REQUIRE(r.ValuesBefore[2] == 0);
+  REQUIRE(r.Values[2] == Approx(sqrt(r.Values[0]*r.Values[1])));
+  REQUIRE(r.Values[3] == 30);
+  REQUIRE(r.Covariances.size() == 36);
+  REQUIRE(r.Covariances[s.V_ij(6,7)] == Approx(r.Covariances[s.V_ij(7,6)]));
+
+  // C starts at its fitted value, and the storage is reused
+  const double* values = r.Values.data();
+  s.SetVariable(0, 10.2, 0.3);
+  s.DoFit(r);
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(r.Values.data() == values);
+  REQUIRE(r.ValuesBefore[0] == 10.2);
+  REQUIRE(r.Values[2] == Approx(sqrt(r.Values[0]*r.Values[1])));
+}
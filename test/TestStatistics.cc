@@ -0,0 +1,131 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+APLCON::Fit_Settings_t StatisticsSettings(APLCON::Engine_t engine) {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = engine;
+  settings.CollectStatistics = true;
+  return settings;
+}
+
+void AddTestSetup(APLCON& a) {
+  a.AddMeasuredVariable("A", 10, 0.3);
+  a.AddMeasuredVariable("B", 20, 0.4);
+  a.AddUnmeasuredVariable("C");
+  a.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                  [] (double a, double b, double c) { return c - sqrt(a*b); });
+  a.AddConstraint("A+B=30", {"A", "B"}, [] (double a, double b) { return a + b - 30; });
+}
+
+TEST_CASE("Statistics disabled by default", "") {
+  APLCON a("Disabled");
+  AddTestSetup(a);
+  const auto& r = a.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE_FALSE(r.Statistics.Collected);
+  REQUIRE(r.Statistics.NJacobians == -1);
+}
+
+TEST_CASE("Statistics", "") {
+  for(auto engine : {APLCON::Engine_t::Fortran, APLCON::Engine_t::Native}) {
+    APLCON a("Statistics", StatisticsSettings(engine));
+    AddTestSetup(a);
+    const auto& r = a.DoFit();
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+
+    const APLCON::Result_Statistics_t& s = r.Statistics;
+    REQUIRE(s.Collected);
+    for(double t : {s.InitTime, s.ConstraintTime, s.DerivativeTime,
+                    s.MatrixTime, s.EngineTime, s.ResultTime})
+      REQUIRE(t >= 0);
+    REQUIRE(s.DerivativeTime > 0);
+    REQUIRE(s.MatrixTime > 0);
+    // each iteration uses a new Jacobian
+    REQUIRE(s.NJacobians == r.NIterations);
+    REQUIRE(s.NCutSteps >= 0);
+    // 3 variables and 2 constraints
+    REQUIRE(s.MatrixRank == 5);
+    REQUIRE(s.NReusedColumns >= 0);
+    REQUIRE(s.NAllocations == -1);
+  }
+}
+
+TEST_CASE("Statistics of engines agree", "") {
+  const auto constraint = [] (double a, double b, double c) {
+    return a*b*b - c;
+  };
+  APLCON::Fit_Settings_t settings = StatisticsSettings(APLCON::Engine_t::Fortran);
+  settings.MaxIterations = 100;
+  APLCON fortran("Fortran", settings);
+  fortran.AddMeasuredVariable("A", 1, 0.5);
+  fortran.AddMeasuredVariable("B", 10, 3);
+  fortran.AddFixedVariable("C", 300, 1);
+  fortran.AddConstraint("A*B^2=C", {"A", "B", "C"}, constraint);
+  settings.Engine = APLCON::Engine_t::Native;
+  APLCON native(fortran, "Native", settings);
+
+  const auto& rf = fortran.DoFit();
+  const auto& rn = native.DoFit();
+  REQUIRE(rf.NIterations == rn.NIterations);
+  REQUIRE(rf.Statistics.NJacobians == rn.Statistics.NJacobians);
+  REQUIRE(rf.Statistics.NCutSteps == rn.Statistics.NCutSteps);
+  // the fixed variable is still part of the equation system
+  REQUIRE(rf.Statistics.MatrixRank == 4);
+  REQUIRE(rn.Statistics.MatrixRank == 4);
+}
+
+TEST_CASE("Statistics of linear variables", "") {
+  // the measured values enter linearly, the slope does not,
+  // and c is not linear, even though its column doesn't change as c stays at 2
+  const size_t n = 10;
+  APLCON::Result_t results[2];
+  for(auto engine : {APLCON::Engine_t::Fortran, APLCON::Engine_t::Native}) {
+    APLCON::Fit_Settings_t settings = StatisticsSettings(engine);
+    settings.MaxIterations = 50;
+    APLCON a("Linear", settings);
+    a.AddUnmeasuredVariable("a", 1);
+    a.AddUnmeasuredVariable("b", 0);
+    for(size_t i=0;i<n;i++) {
+      const string y = "y"+to_string(i);
+      const double x = 0.1*i;
+      a.AddMeasuredVariable(y, 2*exp(0.5*x), 0.05);
+      a.AddConstraint(y, {"a", "b", y}, [x] (double a, double b, double y) { return a*exp(b*x) - y; });
+    }
+    a.AddMeasuredVariable("c", 2, 0.1);
+    a.AddConstraint("c*c=4", {"c"}, [] (double c) { return c*c - 4; });
+    const auto& r = a.DoFit();
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+    const APLCON::Result_Statistics_t& s = r.Statistics;
+    // the columns are reused after two Jacobians
+    REQUIRE(s.NJacobians > 2);
+    REQUIRE(s.NReusedColumns == n*(s.NJacobians-2));
+    results[engine == APLCON::Engine_t::Native] = r;
+  }
+  REQUIRE(results[0].Statistics.NJacobians == results[1].Statistics.NJacobians);
+}
+
+TEST_CASE("Statistics count allocations", "") {
+  long counter = 0;
+  APLCON::Fit_Settings_t settings = StatisticsSettings(APLCON::Engine_t::Native);
+  settings.AllocationCounter = [&counter] () { return counter += 7; };
+  APLCON a("Allocations", settings);
+  AddTestSetup(a);
+  APLCON::Compact_Result_t c;
+  a.DoFit(c);
+  REQUIRE(c.Statistics.NAllocations == 7);
+  // building the maps of Result_t is counted separately
+  const auto& r = a.DoFit();
+  REQUIRE(r.Statistics.NAllocations == 14);
+
+  // the counter belongs to the settings of each instance
+  const long before = counter;
+  APLCON b("NoCounter", StatisticsSettings(APLCON::Engine_t::Native));
+  AddTestSetup(b);
+  REQUIRE(b.DoFit().Statistics.NAllocations == -1);
+  REQUIRE(counter == before);
+}
@@ -0,0 +1,146 @@
+#include <APLCON.hpp>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+// build a small fit with one unmeasured variable and a
+// non-linear constraint, slightly different per index
+void SetupFit(APLCON& a, size_t i) {
+  a.AddMeasuredVariable("A", 10+0.1*i, 0.3);
+  a.AddMeasuredVariable("B", 20-0.2*i, 0.4);
+  a.AddUnmeasuredVariable("C");
+  a.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                  [] (double a, double b, double c) { return c - sqrt(a*b); });
+  a.AddConstraint("A+B=30", {"A", "B"},
+                  [] (double a, double b) { return a + b - 30; });
+}
+
+TEST_CASE("Concurrent instances", "") {
+  const size_t n = 8;
+  const size_t nRepeat = 20;
+
+  // serial reference
+  vector<APLCON::Result_t> expected;
+  for(size_t i=0;i<n;i++) {
+    APLCON a("Serial "+to_string(i));
+    SetupFit(a, i);
+    expected.emplace_back(a.DoFit());
+    REQUIRE(expected.back().Status == APLCON::Result_Status_t::Success);
+  }
+
+  // now the same fits, but concurrently and repeated,
+  // each thread owning its own instance
+  vector<vector<APLCON::Result_t>> results(n);
+  vector<thread> threads;
+  for(size_t i=0;i<n;i++) {
+    threads.emplace_back([i,nRepeat,&results] () {
+      APLCON a("Thread "+to_string(i));
+      SetupFit(a, i);
+      for(size_t j=0;j<nRepeat;j++)
+        results[i].emplace_back(a.DoFit());
+    });
+  }
+  for(auto& t : threads)
+    t.join();
+
+  for(size_t i=0;i<n;i++) {
+    REQUIRE(results[i].size() == nRepeat);
+    for(const auto& r : results[i]) {
+      REQUIRE(r.Status == expected[i].Status);
+      REQUIRE(r.NIterations == expected[i].NIterations);
+      REQUIRE(r.ChiSquare == expected[i].ChiSquare);
+      for(const auto& it_var : expected[i].Variables) {
+        const auto& var = r.Variables.at(it_var.first);
+        REQUIRE(var.Value.After == it_var.second.Value.After);
+        REQUIRE(var.Sigma.After == it_var.second.Sigma.After);
+      }
+    }
+  }
+}
+
+TEST_CASE("Copied instance", "") {
+  // the copy must not evaluate the constraints on
+  // the original's storage, even if the original was fitted before
+  APLCON a("Original");
+  SetupFit(a, 1);
+  const APLCON::Result_t ra = a.DoFit();
+  APLCON b(a, "Copy");
+  b.AddMeasuredVariable("D", 5, 1);
+  b.AddConstraint("D=A/2", {"A", "D"},
+                  [] (double a, double d) { return d - a/2; });
+  const APLCON::Result_t& rb = b.DoFit();
+  REQUIRE(rb.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(rb.Variables.at("D").Value.After
+          == Approx(rb.Variables.at("A").Value.After/2));
+  const APLCON::Result_t& ra2 = a.DoFit();
+  REQUIRE(ra2.ChiSquare == ra.ChiSquare);
+}
+
+TEST_CASE("Parallel numerical derivatives", "") {
+  // more variables than threads, including a vector variable and limits
+  const size_t n = 20;
+  vector<double> y(n);
+  vector<double*> y_ptr;
+  for(size_t i=0;i<n;i++)
+    y_ptr.push_back(&y[i]);
+  auto setup = [&] (const APLCON::Fit_Settings_t& settings) {
+    for(size_t i=0;i<n;i++)
+      y[i] = 2*exp(0.05*i) + 0.01*(i%3);
+    APLCON a("Parallel", settings);
+    a.LinkVariable("y", y_ptr, vector<double>{0.05});
+    APLCON::Variable_Settings_t limited = APLCON::Variable_Settings_t::Default;
+    limited.Limit = {0, 10};
+    a.AddUnmeasuredVariable("a", 1, limited);
+    a.AddUnmeasuredVariable("b", 0);
+    a.AddConstraint("y=a*exp(b*x)", vector<string>{"a", "b", "y"},
+                    [] (const vector< vector<double> >& arg) {
+      vector<double> r(arg[2].size());
+      for(size_t i=0;i<r.size();i++)
+        r[i] = arg[0][0]*exp(arg[1][0]*0.1*i) - arg[2][i];
+      return r;
+    });
+    return a.DoFit();
+  };
+
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = APLCON::Engine_t::Native;
+  settings.MaxIterations = 50;
+  const APLCON::Result_t expected = setup(settings);
+  REQUIRE(expected.Status == APLCON::Result_Status_t::Success);
+
+  // the same points are evaluated, so the result is identical,
+  // 0 evaluates them serially as well
+  for(unsigned nThreads : {0u, 2u, 7u, APLCON::AllThreads}) {
+    settings.DerivativeThreads = nThreads;
+    const APLCON::Result_t r = setup(settings);
+    REQUIRE(r.Status == expected.Status);
+    REQUIRE(r.NIterations == expected.NIterations);
+    REQUIRE(r.NFunctionCalls == expected.NFunctionCalls);
+    REQUIRE(r.ChiSquare == expected.ChiSquare);
+    for(const auto& it_var : expected.Variables) {
+      const auto& var = r.Variables.at(it_var.first);
+      REQUIRE(var.Value.After == it_var.second.Value.After);
+      REQUIRE(var.Sigma.After == it_var.second.Sigma.After);
+    }
+  }
+}
+
+TEST_CASE("Parallel numerical derivatives throw", "") {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = APLCON::Engine_t::Native;
+  settings.DerivativeThreads = 4;
+  APLCON a("Throwing", settings);
+  SetupFit(a, 0);
+  a.AddConstraint("B>0", {"B"}, [] (double b) -> double {
+    // only throws at the displaced points
+    if(b != 20 && b < 20.1)
+      throw runtime_error("displaced");
+    return 0;
+  });
+  REQUIRE_THROWS_AS(a.DoFit(), const runtime_error&);
+}
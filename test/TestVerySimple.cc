@@ -28,7 +28,7 @@ TEST_CASE("Very Simple", "") {
   cout << ra << endl;
 
   // this shows what can access in the result structure "ra"
-  // note that the correlations must be calculated on demand
+  // note that the correlations are calculated on demand
   cout << "C's value (should be 30 due to constraint):         "
        << ra.Variables.at("C").Value.After << endl;
 
@@ -39,10 +39,9 @@ TEST_CASE("Very Simple", "") {
 
   REQUIRE(ra.Variables.at("C").Sigma.After == Approx(0.5));
 
-  const auto& correlations = APLCON::CalculateCorrelations(ra.Variables);
   cout << "Correlation between C and B:                        ";
-  cout << 100*correlations.at("C").After.at("B") << " %" << endl << endl;
+  cout << 100*ra.Correlation("C", "B") << " %" << endl << endl;
 
-  REQUIRE( correlations.at("C").After.at("B") == Approx(0.8));
+  REQUIRE(ra.Correlation("C", "B") == Approx(0.8));
 
 }
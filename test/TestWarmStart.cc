@@ -0,0 +1,137 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <cmath>
+
+#include "catch.hpp"
+
+using namespace std;
+
+APLCON::Fit_Settings_t WarmSettings(APLCON::Engine_t engine, APLCON::WarmStart_t warmstart) {
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.Engine = engine;
+  settings.WarmStart = warmstart;
+  settings.CollectStatistics = true;
+  return settings;
+}
+
+// linked measurements, and the first value of the unmeasured C seen by the constraint
+struct Event_t {
+  double A = 10;
+  double B = 20;
+  double C = 0;
+  double C_start = 0;
+  bool first = true;
+};
+
+void AddTestSetup(APLCON& a, Event_t& e) {
+  a.LinkVariable("A", {&e.A}, vector<double>{0.3});
+  a.LinkVariable("B", {&e.B}, vector<double>{0.4});
+  a.LinkVariable("C", {&e.C}, vector<double>{0});
+  a.AddConstraint("sqrt(A*B)=C", {"A", "B", "C"},
+                  [&e] (double a, double b, double c) {
+    if(e.first)
+      e.C_start = c;
+    e.first = false;
+    return c - sqrt(a*b);
+  });
+  a.AddConstraint("A+B=30", {"A", "B"}, [] (double a, double b) { return a + b - 30; });
+}
+
+// similar events, as in a sorted event stream
+void NextEvent(Event_t& e, int n) {
+  e.A = 10 + 0.01*n;
+  e.B = 20 - 0.02*n;
+  e.C = 0;
+  e.first = true;
+}
+
+TEST_CASE("Warm start reuses derivatives", "") {
+  Event_t e_cold, e_warm;
+  APLCON cold("Cold", WarmSettings(APLCON::Engine_t::Native, APLCON::WarmStart_t::None));
+  APLCON warm("Warm", WarmSettings(APLCON::Engine_t::Native, APLCON::WarmStart_t::Derivatives));
+  AddTestSetup(cold, e_cold);
+  AddTestSetup(warm, e_warm);
+
+  for(int n=0;n<5;n++) {
+    NextEvent(e_cold, n);
+    NextEvent(e_warm, n);
+    const auto& rc = cold.DoFit();
+    const auto& rw = warm.DoFit();
+    REQUIRE(rc.Status == APLCON::Result_Status_t::Success);
+    REQUIRE(rw.Status == APLCON::Result_Status_t::Success);
+    REQUIRE(rw.ChiSquare == Approx(rc.ChiSquare));
+    REQUIRE(e_warm.A == Approx(e_cold.A));
+    REQUIRE(e_warm.C == Approx(e_cold.C));
+    // only derivatives are reused, C starts from the given value
+    REQUIRE(e_warm.C_start == 0);
+    if(n == 0) {
+      REQUIRE(rw.NFunctionCalls == rc.NFunctionCalls);
+    }
+    else {
+      REQUIRE(rw.Statistics.NJacobians < rc.Statistics.NJacobians);
+      REQUIRE(rw.NFunctionCalls < rc.NFunctionCalls);
+    }
+  }
+
+  // changing the instance starts from scratch again
+  cold.AddConstraint("B=2A", {"A", "B"}, [] (double a, double b) { return b - 2*a; });
+  warm.AddConstraint("B=2A", {"A", "B"}, [] (double a, double b) { return b - 2*a; });
+  NextEvent(e_cold, 5);
+  NextEvent(e_warm, 5);
+  REQUIRE(warm.DoFit().NFunctionCalls == cold.DoFit().NFunctionCalls);
+}
+
+TEST_CASE("Warm start of unmeasured variables", "") {
+  for(auto engine : {APLCON::Engine_t::Fortran, APLCON::Engine_t::Native}) {
+    Event_t e;
+    APLCON a("Unmeasured", WarmSettings(engine, APLCON::WarmStart_t::Unmeasured));
+    AddTestSetup(a, e);
+
+    NextEvent(e, 0);
+    REQUIRE(a.DoFit().Status == APLCON::Result_Status_t::Success);
+    REQUIRE(e.C_start == 0);
+    const double C_fitted = e.C;
+
+    NextEvent(e, 1);
+    const auto& r = a.DoFit();
+    REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+    REQUIRE(e.C_start == C_fitted);
+    // the value before the fit is still the given one
+    REQUIRE(r.Variables.at("C").Value.Before == 0);
+  }
+}
+
+TEST_CASE("Warm start after failed fit", "") {
+  Event_t e;
+  APLCON::Fit_Settings_t settings = WarmSettings(APLCON::Engine_t::Native, APLCON::WarmStart_t::Unmeasured);
+  settings.MaxIterations = 3;
+  APLCON a("Failed", settings);
+  AddTestSetup(a, e);
+
+  NextEvent(e, 0);
+  REQUIRE(a.DoFit().Status == APLCON::Result_Status_t::Success);
+
+  // the constraints cannot be fulfilled, so the fit fails
+  e.A = -10;
+  e.first = true;
+  REQUIRE(a.DoFit().Status != APLCON::Result_Status_t::Success);
+
+  // and the next fit starts from scratch
+  NextEvent(e, 1);
+  const auto& r = a.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(e.C_start == 0);
+}
+
+TEST_CASE("Warm start of derivatives needs the Native engine", "") {
+  Event_t e;
+  APLCON::Fit_Settings_t settings = WarmSettings(APLCON::Engine_t::Fortran, APLCON::WarmStart_t::Derivatives);
+  APLCON a("Fortran", settings);
+  AddTestSetup(a, e);
+  REQUIRE_THROWS_AS(a.DoFit(), const APLCON::Error&);
+
+  // but the Fortran engine can start the unmeasured variables
+  settings.WarmStart = APLCON::WarmStart_t::Unmeasured;
+  a.SetSettings(settings);
+  REQUIRE(a.DoFit().Status == APLCON::Result_Status_t::Success);
+}
@@ -0,0 +1,60 @@
+#include <APLCON.hpp>
+#include <vector>
+#include <string>
+
+// directly test the Fortran workspace handling
+extern "C" {
+#include "wrapper/APLCON.h"
+}
+
+#include "catch.hpp"
+
+using namespace std;
+
+TEST_CASE("Large fit", "") {
+  // more than 1000 variables plus constraints, and more than 100 constraints,
+  // which exceeded the former fixed size of APLCON's internal arrays
+  const size_t n = 800;
+  APLCON::Fit_Settings_t settings = APLCON::Fit_Settings_t::Default;
+  settings.SkipCovariancesInResult = true;
+  APLCON a("Large", settings);
+  for(size_t i=0;i<n;i++)
+    a.AddMeasuredVariable("X"+to_string(i), 1+0.01*(i%7), 0.1);
+  // pairs of variables should add up to 2
+  for(size_t i=0;i<n;i+=2) {
+    a.AddConstraint("C"+to_string(i), {"X"+to_string(i), "X"+to_string(i+1)},
+                    [] (double x, double y) { return x + y - 2; });
+  }
+  const APLCON::Result_t& r = a.DoFit();
+  REQUIRE(r.Status == APLCON::Result_Status_t::Success);
+  REQUIRE(r.NDoF == n/2);
+  REQUIRE(r.Variables.at("X0").Value.After + r.Variables.at("X1").Value.After == Approx(2));
+}
+
+TEST_CASE("Workspace too small", "") {
+  // APLCON used to STOP the whole process
+  long long nAUX;
+  c_aplcon_apnaux(2, 1, &nAUX);
+  vector<double> aux(nAUX/2);
+  vector<double> X{1, 2}, VX{1, 0, 1}, F{0};
+  int ret;
+
+  c_aplcon_apwork(aux.data(), aux.size());
+  c_aplcon_aplcon(2, 1);
+  c_aplcon_aprint(6, 0);
+  c_aplcon_aploop(X.data(), VX.data(), F.data(), &ret);
+  REQUIRE(ret == static_cast<int>(APLCON::Result_Status_t::OutOfMemory));
+
+  // with sufficient space, the fit works again
+  aux.resize(nAUX);
+  c_aplcon_apwork(aux.data(), aux.size());
+  c_aplcon_aplcon(2, 1);
+  c_aplcon_aprint(6, 0);
+  do {
+    F[0] = X[0] + X[1] - 4;
+    c_aplcon_aploop(X.data(), VX.data(), F.data(), &ret);
+  }
+  while(ret<0);
+  REQUIRE(ret == static_cast<int>(APLCON::Result_Status_t::Success));
+  REQUIRE(X[0] + X[1] == Approx(4));
+}